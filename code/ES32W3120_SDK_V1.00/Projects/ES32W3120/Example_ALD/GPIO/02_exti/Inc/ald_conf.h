@@ -39,7 +39,7 @@
 #define ALD_BKPC
 /* #define ALD_CALC */
 #define ALD_CMU
-/* #define ALD_CRC */
+#define ALD_CRC
 /* #define ALD_DAC */
 #define ALD_DMA
 /* #define ALD_FLASH */
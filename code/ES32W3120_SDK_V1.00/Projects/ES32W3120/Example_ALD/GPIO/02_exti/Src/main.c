@@ -38,6 +38,7 @@
 
 #include "bsp_system.h"
 #include "bsp_dx_bt24_t.h"
+#include "bsp_flash.h"
 
 #include "task_common.h"
 
@@ -104,6 +105,12 @@ int main()
             Task_Struct[m_temp].function(m_temp);
         }
         
+        /* 空闲时预擦除外部flash */
+        flash_writer_idle();
+        
+        /* 发出因连接状态暂停的数据 */
+        uart_tx_idle();
+        
 //        ble_test();
     }
 }
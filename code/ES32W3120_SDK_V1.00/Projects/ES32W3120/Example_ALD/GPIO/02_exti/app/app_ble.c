@@ -6,7 +6,9 @@
 
 #include "app_ble.h"
 #include "app_common.h"
+#include "app_frame.h"
 #include "app_calculate.h"
+#include "app_statistic.h"
 
 #include "task_common.h"
 
@@ -15,7 +17,7 @@
 /* Private Variables --------------------------------------------------------- */
 
 /* Public Variables ---------------------------------------------------------- */
-uint8_t ble_rx_buf[UART_RX_BUF_LEN];
+ble_parse_t ble_parse;
 
 /* Private Constants --------------------------------------------------------- */
 
@@ -30,31 +32,157 @@ extern timer_cnt_t time_cnt;
 extern timer_flg_t time_flg;
 extern uint32_t g_adc_result;
 extern uint8_t mpu6050_timeout;
-//extern uint8_t *calibrate_data_p;
-extern uint8_t calibrate_data_p[15000];
-extern uint16_t calibrate_packet_cnt;
+extern uint16_t rate_change_cnt;
 
 //extern uint8_t retry_cnt;
+extern flash_stat_t flash_stat;
+extern flash_range_t flash_range;
+extern flash_calib_t flash_calib;
+extern pool_stat_t pool_stat;
+extern uart_tx_t uart_tx;
+extern uart_rx_t uart_rx;
+extern uint16_t calibrate_send_packet_cnt;
+extern uint8_t send_page_temp;
 
-int ble_data_decode(void)
+/**
+  * @brief  Tell the app there is no stored data to upload.
+  * @retval None
+  */
+static void ble_send_no_data(uint8_t *buf)
 {
-    ble_data_t *ble_data;
-    uint8_t sum = 0;
+    frame_pack(buf, 0xc2, CONTROL_NO_DATA, NULL, 0);
+    
+    send_ble_data(buf, 20);
+}
+
+/**
+  * @brief  Take a summed frame out of the receive ring and decode it. The
+  *         DMA keeps writing the ring while a command runs, so the frame is
+  *         copied out first and checked again on the copy.
+  * @retval None
+  */
+static void ble_parse_accept(void)
+{
+    ble_data_t ble_data;
+    const uint8_t *frame = (const uint8_t *)&ble_data;
     uint8_t i = 0;
-    int ret = 0;
-    data_utc_t *data_utc = NULL;
-    data_wxid_t *data_wxid = NULL;
-    uint8_t ble_tx_buf[20];
     
-    ble_data = (ble_data_t *)ble_rx_buf;
-    for(i=0; i<19; i++){
-        sum += ble_rx_buf[i];
+    uart_rx_read((uint8_t *)&ble_data, FRAME_LEN);
+    if(false == frame_check(frame)){
+        /* 求和之后被新数据覆盖 */
+        ble_parse.stat.sum_err_cnt++;
+        return;
     }
     
-    if(sum != ble_data->sum){
-        ES_LOG_PRINT("ble data sum err\n");
-        return -1;
+    ES_LOG_PRINT("receive data: ");
+    for(i=0; i<FRAME_LEN; i++)
+    {
+        ES_LOG_PRINT("%.2x", frame[i]);
     }
+    ES_LOG_PRINT("\n");
+    
+    ble_parse.stat.frame_cnt++;
+    ble_data_decode(&ble_data);
+}
+
+/**
+  * @brief  Drop the SOF of a bad frame and hunt again from the byte after
+  *         it, a real frame may start inside the bad one.
+  * @retval None
+  */
+static void ble_parse_resync(void)
+{
+    uart_rx_skip(1);
+    ble_parse.state = BLE_PARSE_SOF;
+    ble_parse.pos = 0;
+}
+
+/**
+  * @brief  Decode every complete frame in the receive ring. The parser
+  *         keeps its place between calls, a frame split over two idle
+  *         interrupts is finished on the next call and each byte is summed
+  *         once.
+  * @retval None
+  */
+void ble_data_parse(void)
+{
+    uint16_t cnt = uart_rx_count();
+    uint8_t byte = 0;
+    
+    /* 缓存溢出, 检查过的字节已被覆盖 */
+    if(ble_parse.overrun_cnt != uart_rx.overrun_cnt){
+        ble_parse.overrun_cnt = uart_rx.overrun_cnt;
+        ble_parse.state = BLE_PARSE_SOF;
+        ble_parse.pos = 0;
+    }
+    
+    while(ble_parse.pos < cnt){
+        byte = uart_rx_peek(ble_parse.pos);
+        
+        switch(ble_parse.state){
+            case BLE_PARSE_SOF:
+                if(FRAME_SOF != byte){
+                    uart_rx_skip(1);
+                    cnt--;
+                    ble_parse.stat.skip_cnt++;
+                    break;
+                }
+                ble_parse.sum = byte;
+                ble_parse.pos = 1;
+                ble_parse.state = BLE_PARSE_LEN;
+                break;
+            
+            case BLE_PARSE_LEN:
+                if(FRAME_LENGTH != byte){
+                    ble_parse.stat.len_err_cnt++;
+                    ble_parse_resync();
+                    cnt--;
+                    break;
+                }
+                ble_parse.sum += byte;
+                ble_parse.pos++;
+                ble_parse.state = BLE_PARSE_BODY;
+                break;
+            
+            case BLE_PARSE_BODY:
+                if(FRAME_LEN-1 > ble_parse.pos){
+                    ble_parse.sum += byte;
+                    ble_parse.pos++;
+                    break;
+                }
+                if(ble_parse.sum != byte){
+                    ES_LOG_PRINT("ble data sum err\n");
+                    ble_parse.stat.sum_err_cnt++;
+                    ble_parse_resync();
+                    cnt--;
+                    break;
+                }
+                ble_parse_accept();
+                cnt -= FRAME_LEN;
+                ble_parse.state = BLE_PARSE_SOF;
+                ble_parse.pos = 0;
+                break;
+            
+            default:
+                ble_parse_resync();
+                cnt--;
+                break;
+        }
+    }
+}
+
+/**
+  * @brief  Execute one command frame, the checksum is already checked.
+  * @param  ble_data: The frame, copied out of the receive ring.
+  * @retval 0: done, -1: unknown command.
+  */
+int ble_data_decode(const ble_data_t *ble_data)
+{
+    int ret = 0;
+    const data_utc_t *data_utc = NULL;
+    const data_wxid_t *data_wxid = NULL;
+    uint8_t ble_tx_buf[20];
+    frame_packer_t packer;
     
     switch(ble_data->cmd){
         case SYSTEM_CMD:
@@ -82,43 +210,45 @@ int ble_data_decode(void)
                 case CONTROL_SCAN:
                     break;
                 
+                case CONTROL_SEND_SCAN_DATA:
+                    ES_LOG_PRINT("CONTROL_SEND_SCAN_DATA %u\n", ble_data->data[0]);
+                    /* 按段上传flash中的校准采样 */
+                    if(0 < flash_calib_select(ble_data->data[0])){
+                        calibrate_send_packet_cnt = 0;
+                        set_task(BLUETOOTH, SEND_CALIBRATE_DATA);
+                    }
+                    else{
+                        ble_send_no_data(ble_tx_buf);
+                    }
+                    break;
+                
                 case CONTROL_SEND_FLASH_DATA:
                     switch(ble_data->data[0]){
                         case SEND_FLASH_DATA_START:
                             ES_LOG_PRINT("SEND_FLASH_DATA_START\n");
+                            /* 按时间范围上传时继续下一轮 */
+                            if(1 == flash_range.active){
+                                if(1 == flash_range_ready()){
+                                    set_task(MEM_READ, FLASH_READ);
+                                }
+                                else{
+                                    ble_send_no_data(ble_tx_buf);
+                                }
+                                break;
+                            }
                             if(system_state.flash_data.flash_data_send_page < system_state.flash_data.flash_data_current_page){
                                 if(2 <= (system_state.flash_data.flash_data_current_page-system_state.flash_data.flash_data_send_page)){
                                     set_task(MEM_READ, FLASH_READ);  //上传数据
                                 }
                                 else{
                                     ES_LOG_PRINT("no data\n");
-                                    memset(ble_tx_buf, 0, 20);
-                                    ble_tx_buf[0] = 0xaa;
-                                    ble_tx_buf[1] = 0x13;
-                                    ble_tx_buf[2] = 0xc2;
-                                    ble_tx_buf[3] = 0x06;
-                                    
-                                    sum = 0;
-                                    for(i=0; i<19; i++){
-                                        sum += ble_tx_buf[i];
-                                    }
-                                    ble_tx_buf[19] = sum;
+                                    frame_pack(ble_tx_buf, 0xc2, 0x06, NULL, 0);
                                     
                                     send_ble_data(ble_tx_buf, 20);
                                 }
                             }
                             else if(system_state.flash_data.flash_data_send_page == system_state.flash_data.flash_data_current_page){
-                                memset(ble_tx_buf, 0, 20);
-                                ble_tx_buf[0] = 0xaa;
-                                ble_tx_buf[1] = 0x13;
-                                ble_tx_buf[2] = 0xc2;
-                                ble_tx_buf[3] = 0x06;
-                                
-                                sum = 0;
-                                for(i=0; i<19; i++){
-                                    sum += ble_tx_buf[i];
-                                }
-                                ble_tx_buf[19] = sum;
+                                frame_pack(ble_tx_buf, 0xc2, 0x06, NULL, 0);
                                 
                                 send_ble_data(ble_tx_buf, 20);
                             }
@@ -127,17 +257,7 @@ int ble_data_decode(void)
                                     set_task(MEM_READ, FLASH_READ);  //上传数据
                                 }
                                 else{
-                                    memset(ble_tx_buf, 0, 20);
-                                    ble_tx_buf[0] = 0xaa;
-                                    ble_tx_buf[1] = 0x13;
-                                    ble_tx_buf[2] = 0xc2;
-                                    ble_tx_buf[3] = 0x06;
-                                    
-                                    sum = 0;
-                                    for(i=0; i<19; i++){
-                                        sum += ble_tx_buf[i];
-                                    }
-                                    ble_tx_buf[19] = sum;
+                                    frame_pack(ble_tx_buf, 0xc2, 0x06, NULL, 0);
                                     
                                     send_ble_data(ble_tx_buf, 20);
                                 }
@@ -161,6 +281,20 @@ int ble_data_decode(void)
                             
                             break;
                         
+                        case SEND_FLASH_DATA_RANGE:
+                            ES_LOG_PRINT("SEND_FLASH_DATA_RANGE\n");
+                            if(0 != send_page_temp){
+                                break;  //正在上传
+                            }
+                            if(0 == flash_range_start(utc_get_minute(ble_data->data[1], ble_data->data[2], ble_data->data[3], ble_data->data[4], ble_data->data[5]),
+                                                      utc_get_minute(ble_data->data[6], ble_data->data[7], ble_data->data[8], ble_data->data[9], ble_data->data[10]))){
+                                set_task(MEM_READ, FLASH_READ);
+                            }
+                            else{
+                                ble_send_no_data(ble_tx_buf);
+                            }
+                            break;
+                        
                         default:
                             ret = -1;
                             break;
@@ -183,6 +317,12 @@ int ble_data_decode(void)
                     system_state.shake_fre = ble_data->data[0];
                     break;
                 
+                case SET_RAW_LOG:
+                    ES_LOG_PRINT("SET_RAW_LOG %u\n", ble_data->data[0]);
+                    calculate_raw_log_set(ble_data->data[0]);
+                    set_task(MEM_WRITE, WRITE_SYSTEM_INFO);
+                    break;
+                
                 default:
                     ret = -1;
                     break;
@@ -194,40 +334,31 @@ int ble_data_decode(void)
                 case STATE_INFO:
                     ES_LOG_PRINT("STATE_INFO\n");
                     
-                    memset(ble_tx_buf, 0, 20);
-                    ble_tx_buf[0] = 0xaa;
-                    ble_tx_buf[1] = 0x13;
-                    ble_tx_buf[2] = 0xd4;
-                    ble_tx_buf[3] = 0x01;
-                    ble_tx_buf[4] = (g_adc_result - 2900) * 100 / 4200;
+                    frame_open(&packer, ble_tx_buf, 0xd4, 0x01);
+                    frame_put_u8(&packer, (g_adc_result - 2900) * 100 / 4200);
                     if(system_state.flash_data.flash_data_send_page < system_state.flash_data.flash_data_current_page){
-                        ble_tx_buf[5] = (system_state.flash_data.flash_data_current_page - system_state.flash_data.flash_data_send_page)/10;
+                        frame_put_u8(&packer, (system_state.flash_data.flash_data_current_page - system_state.flash_data.flash_data_send_page)/10);
                     }
                     else if(system_state.flash_data.flash_data_send_page == system_state.flash_data.flash_data_current_page){
-                        ble_tx_buf[5] = 0;
-                    }
-                    else if(system_state.flash_data.flash_data_send_page > system_state.flash_data.flash_data_current_page){
-                        ble_tx_buf[5] = (FLASH_DATA_END-system_state.flash_data.flash_data_send_page+system_state.flash_data.flash_data_current_page-4)/10;
+                        frame_put_u8(&packer, 0);
                     }
-                    ble_tx_buf[6] = system_state.shake_fre;
-                    ble_tx_buf[7] = system_state.ble_addr[0];
-                    ble_tx_buf[8] = system_state.ble_addr[1];
-                    ble_tx_buf[9] = system_state.ble_addr[2];
-                    ble_tx_buf[10] = system_state.ble_addr[3];
-                    ble_tx_buf[11] = system_state.ble_addr[4];
-                    ble_tx_buf[12] = system_state.ble_addr[5];
-                    ble_tx_buf[13] = 0xb2;
-                    ble_tx_buf[14] = 21;
-                    ble_tx_buf[15] = 10;
-                    ble_tx_buf[16] = 26;
-                    ble_tx_buf[17] = 01;
-                    ble_tx_buf[18] = 0xef;
-                    
-                    sum = 0;
-                    for(i=0; i<19; i++){
-                        sum += ble_tx_buf[i];
+                    else{
+                        frame_put_u8(&packer, (FLASH_DATA_END-system_state.flash_data.flash_data_send_page+system_state.flash_data.flash_data_current_page-4)/10);
                     }
-                    ble_tx_buf[19] = sum;
+                    frame_put_u8(&packer, system_state.shake_fre);
+                    frame_put_u8(&packer, system_state.ble_addr[0]);
+                    frame_put_u8(&packer, system_state.ble_addr[1]);
+                    frame_put_u8(&packer, system_state.ble_addr[2]);
+                    frame_put_u8(&packer, system_state.ble_addr[3]);
+                    frame_put_u8(&packer, system_state.ble_addr[4]);
+                    frame_put_u8(&packer, system_state.ble_addr[5]);
+                    frame_put_u8(&packer, 0xb2);
+                    frame_put_u8(&packer, 21);
+                    frame_put_u8(&packer, 10);
+                    frame_put_u8(&packer, 26);
+                    frame_put_u8(&packer, 01);
+                    frame_put_u8(&packer, 0xef);
+                    frame_close(&packer);
                     
                     send_ble_data(ble_tx_buf, 20);
                     break;
@@ -242,11 +373,9 @@ int ble_data_decode(void)
                         time_cnt.calibrate_timeout_cnt = 0;
                         time_flg.calibrate_flg = 0;
                         
-                        time_cnt.mpu6050_data_cnt = 0;
-                        mpu6050_timeout = MPU6050_NORMAL_TIMEOUT;
+                        calculate_rate_set(RATE_LEVEL_NORMAL);
                         
-                        calibrate_packet_cnt = 0;
-//                        free(calibrate_data_p);
+                        flash_calib_stop();
                     }
                     else if(0x01 == ble_data->data[0]){
                         ES_LOG_PRINT("enter calibrate mode\n");
@@ -256,20 +385,138 @@ int ble_data_decode(void)
                         mpu6050_timeout = MPU6050_CALIBRATE_TIMEOUT;
                     }
                     
-                    memset(ble_tx_buf, 0, 20);
-                    ble_tx_buf[0] = 0xaa;
-                    ble_tx_buf[1] = 0x13;
-                    ble_tx_buf[2] = 0xc1;
-                    ble_tx_buf[3] = 0x02;
-                    ble_tx_buf[4] = 0x01;
+                    frame_open(&packer, ble_tx_buf, 0xc1, 0x02);
+                    frame_put_u8(&packer, 0x01);
+                    frame_close(&packer);
+                    
+                    send_ble_data(ble_tx_buf, 20);
+                    break;
+                
+                case STATE_RATE:
+                    ES_LOG_PRINT("STATE_RATE\n");
+                    
+                    frame_open(&packer, ble_tx_buf, 0xd4, STATE_RATE);
+                    frame_put_u8(&packer, calculate_rate_get());
+                    frame_put_u16(&packer, mpu6050_timeout * TIME_TICK_MS);
+                    frame_put_u16(&packer, rate_change_cnt);
+                    frame_close(&packer);
+                    
+                    send_ble_data(ble_tx_buf, 20);
+                    break;
+                
+                case STATE_FLASH:
+                    ES_LOG_PRINT("STATE_FLASH\n");
+                    
+                    frame_open(&packer, ble_tx_buf, 0xd4, STATE_FLASH);
+                    frame_put_u16(&packer, flash_stat.flush.us_last);
+                    frame_put_u16(&packer, (0 == flash_stat.flush.cnt) ? 0 : flash_stat.flush.us_sum / flash_stat.flush.cnt);
+                    frame_put_u16(&packer, flash_stat.flush.us_max);
+                    frame_put_u16(&packer, flash_stat.erase.us_max / 1000);
+                    frame_put_u16(&packer, flash_stat.flush.cnt);
+                    frame_put_u16(&packer, flash_stat.timeout_cnt);
+                    frame_put_u8(&packer, (255 < flash_stat.both_full_cnt) ? 255 : flash_stat.both_full_cnt);
+                    frame_put_u8(&packer, (255 < flash_stat.drop_cnt) ? 255 : flash_stat.drop_cnt);
+                    frame_put_u8(&packer, (255 < flash_stat.fail_cnt) ? 255 : flash_stat.fail_cnt);
+                    frame_close(&packer);
+                    
+                    send_ble_data(ble_tx_buf, 20);
+                    break;
+                
+                case STATE_FLASH_HEALTH:
+                {
+                    flash_health_t health;
+                    
+                    ES_LOG_PRINT("STATE_FLASH_HEALTH\n");
+                    
+                    /* [4-5] 数据扇区擦除次数, [6-7] 确认记录扇区擦除次数, [8-9] 写放大x100,
+                       [10-12] 写页耗时 p50 p90 p99 ms, [13-14] 编程失败, [15-16] 擦除失败, [17-18] 未上传页数 */
+                    flash_health_get(&health);
+                    frame_open(&packer, ble_tx_buf, 0xd4, STATE_FLASH_HEALTH);
+                    frame_put_u16(&packer, health.sector_erase);
+                    frame_put_u16(&packer, health.ack_erase);
+                    frame_put_u16(&packer, health.write_amp);
+                    frame_put_u8(&packer, health.flush_p50);
+                    frame_put_u8(&packer, health.flush_p90);
+                    frame_put_u8(&packer, health.flush_p99);
+                    frame_put_u16(&packer, health.program_fail);
+                    frame_put_u16(&packer, health.erase_fail);
+                    frame_put_u16(&packer, health.buffered);
+                    frame_close(&packer);
+                    
+                    send_ble_data(ble_tx_buf, 20);
+                }
+                    break;
+                
+                case STATE_CALIBRATE:
+                {
+                    uint8_t cnt = 0;
+                    uint8_t j = 0;
+                    
+                    ES_LOG_PRINT("STATE_CALIBRATE\n");
+                    
+                    /* [4] 段数, [5-16] 从最新开始三段的段号和帧数, [17-18] 最近一段写满后丢弃的帧数 */
+                    if(0 == flash_calib.scanned){
+                        flash_calib_select(0);      //建立索引
+                    }
+                    cnt = flash_calib.cnt;
+                    frame_open(&packer, ble_tx_buf, 0xd4, STATE_CALIBRATE);
+                    frame_put_u8(&packer, cnt);
+                    for(j=0; j<3; j++){
+                        frame_put_u16(&packer, (j < cnt) ? flash_calib.session[cnt - 1 - j].id : 0);
+                        frame_put_u16(&packer, (j < cnt) ? flash_calib.session[cnt - 1 - j].frames : 0);
+                    }
+                    frame_put_u16(&packer, flash_calib.drop_cnt);
+                    frame_close(&packer);
+                    
+                    send_ble_data(ble_tx_buf, 20);
+                }
+                    break;
+                
+                case STATE_POOL:
+                {
+                    uint32_t fail = 0;
+                    uint8_t j = 0;
                     
-                    sum = 0;
-                    for(i=0; i<19; i++){
-                        sum += ble_tx_buf[i];
+                    ES_LOG_PRINT("STATE_POOL\n");
+                    
+                    /* [4-6] 大块数、占用、最高占用, [7-9] 小块, [10-15] 记录、校准、上传的占用和最高占用, [16-17] 失败次数 */
+                    frame_open(&packer, ble_tx_buf, 0xd4, STATE_POOL);
+                    frame_put_u8(&packer, POOL_LARGE_NUM);
+                    frame_put_u8(&packer, pool_stat.large_used);
+                    frame_put_u8(&packer, pool_stat.large_high);
+                    frame_put_u8(&packer, POOL_SMALL_NUM);
+                    frame_put_u8(&packer, pool_stat.small_used);
+                    frame_put_u8(&packer, pool_stat.small_high);
+                    for(j=0; j<POOL_ARENA_NUM; j++){
+                        frame_put_u8(&packer, pool_stat.arena[j].used);
+                        frame_put_u8(&packer, pool_stat.arena[j].high);
+                        fail += pool_stat.arena[j].fail_cnt;
                     }
-                    ble_tx_buf[19] = sum;
+                    frame_put_u16(&packer, fail);
+                    frame_close(&packer);
+                    
+                    send_ble_data(ble_tx_buf, 20);
+                }
+                    break;
+                
+                case STATE_UART:
+                {
+                    ES_LOG_PRINT("STATE_UART\n");
+                    
+                    /* [4-5] 当前队列深度, [6-7] 最大深度, [8-9] 丢弃次数, [10-11] 暂停次数, [12-13] 发送KB, [14-15] 接收溢出次数, [16-17] 断开时清掉的字节数, [18] 波特率/9600 */
+                    frame_open(&packer, ble_tx_buf, 0xd4, STATE_UART);
+                    frame_put_u16(&packer, uart_tx_count());
+                    frame_put_u16(&packer, uart_tx.stat.depth_max);
+                    frame_put_u16(&packer, uart_tx.stat.drop_cnt);
+                    frame_put_u16(&packer, uart_tx.stat.stall_cnt);
+                    frame_put_u16(&packer, uart_tx.stat.byte_cnt / 1024);
+                    frame_put_u16(&packer, uart_rx.overrun_cnt);
+                    frame_put_u16(&packer, uart_tx.stat.flush_cnt);
+                    frame_put_u8(&packer, uart_get_baud() / 9600);
+                    frame_close(&packer);
                     
                     send_ble_data(ble_tx_buf, 20);
+                }
                     break;
                 
                 default:
@@ -290,6 +537,12 @@ int ble_data_decode(void)
                 case DATA_UTC:
                     break;
                 
+                case DATA_DAILY_STATS:
+                    ES_LOG_PRINT("DATA_DAILY_STATS\n");
+                    statistic_get_frame(ble_tx_buf);
+                    send_ble_data(ble_tx_buf, 20);
+                    break;
+                
                 default:
                     ret = -1;
                     break;
@@ -300,7 +553,7 @@ int ble_data_decode(void)
             switch(ble_data->address){
                 case DATA_UTC:
                     ES_LOG_PRINT("DATA_UTC\n");
-                    data_utc = (data_utc_t *)ble_data->data;
+                    data_utc = (const data_utc_t *)ble_data->data;
                     utc_time.utc_y = data_utc->utc_y;
                     utc_time.utc_m = data_utc->utc_m;
                     utc_time.utc_d = data_utc->utc_d;
@@ -320,51 +573,22 @@ int ble_data_decode(void)
             switch(ble_data->address){
                 case WXID_WRITE:
                     ES_LOG_PRINT("WXID_WRITE\n");
-                    data_wxid = (data_wxid_t *)ble_data->data;
+                    data_wxid = (const data_wxid_t *)ble_data->data;
                     if((0x00 == system_state.wxid[0] && 0x00 == system_state.wxid[1] && 0x00 == system_state.wxid[2] && 0x00 == system_state.wxid[3]) ||
                         (0xff == system_state.wxid[0] && 0xff == system_state.wxid[1] && 0xff == system_state.wxid[2] && 0xff == system_state.wxid[3])){   //未绑定状态
                         memcpy(system_state.wxid, data_wxid, 4);
                         set_task(MEM_WRITE, WRITE_SYSTEM_INFO);
                         
-                        memset(ble_tx_buf, 0, 20);
-                        ble_tx_buf[0] = 0xaa;
-                        ble_tx_buf[1] = 0x13;
-                        ble_tx_buf[2] = 0xd9;
-                        ble_tx_buf[3] = 0x03;
-                        
-                        sum = 0;
-                        for(i=0; i<19; i++){
-                            sum += ble_tx_buf[i];
-                        }
-                        ble_tx_buf[19] = sum;
+                        frame_pack(ble_tx_buf, 0xd9, 0x03, NULL, 0);
                     }
                     else{
                         if(system_state.wxid[0] == data_wxid->wxid_0 && system_state.wxid[1] == data_wxid->wxid_1 && system_state.wxid[2] == data_wxid->wxid_2 && system_state.wxid[3] == data_wxid->wxid_3){   //已绑定状态
-                            memset(ble_tx_buf, 0, 20);
-                            ble_tx_buf[0] = 0xaa;
-                            ble_tx_buf[1] = 0x13;
-                            ble_tx_buf[2] = 0xd9;
-                            ble_tx_buf[3] = 0x03;
-                            
-                            sum = 0;
-                            for(i=0; i<19; i++){
-                                sum += ble_tx_buf[i];
-                            }
-                            ble_tx_buf[19] = sum;
+                            frame_pack(ble_tx_buf, 0xd9, 0x03, NULL, 0);
                         }
                         else{
-                            memset(ble_tx_buf, 0, 20);
-                            ble_tx_buf[0] = 0xaa;
-                            ble_tx_buf[1] = 0x13;
-                            ble_tx_buf[2] = 0xd9;
-                            ble_tx_buf[3] = 0x03;
-                            ble_tx_buf[4] = 0x01;
-                            
-                            sum = 0;
-                            for(i=0; i<19; i++){
-                                sum += ble_tx_buf[i];
-                            }
-                            ble_tx_buf[19] = sum;
+                            frame_open(&packer, ble_tx_buf, 0xd9, 0x03);
+                            frame_put_u8(&packer, 0x01);
+                            frame_close(&packer);
                         }
                     }
                     send_ble_data(ble_tx_buf, 20);
@@ -3,6 +3,8 @@
 
 #include "global.h"
 
+#include "app_frame.h"
+
 #define SYSTEM_CMD                  0xc1  //系统指令
 #define CONTROL_CMD                 0xc2  //控制指令
 #define SET_DATA_CMD                0xc3  //设置数据指令
@@ -23,7 +25,7 @@
 
 #define CONTROL_CALIBRATE           0x01  //姿态校准
 #define CONTROL_SCAN                0x02  //背部扫描
-#define CONTROL_SEND_SCAN_DATA      0x03  //上传扫描数据
+#define CONTROL_SEND_SCAN_DATA      0x03  //上传扫描数据, [4] 校准段 0 最新, 1 前一段...
 #define CONTROL_SEND_MONITOR_DATA   0x04  //上传实时监控数据
 #define CONTROL_SEND_FLASH_DATA     0x05  //上传存储数据
 #define CONTROL_NO_DATA             0x06  //没有离线数据
@@ -31,17 +33,29 @@
 #define SEND_FLASH_DATA_START       0x00  //上位机通知下位机开始上传数据
 #define SEND_FLASH_DATA_FINISH      0x01  //下位机通知上位机数据已经传输完毕
 #define SEND_FLASH_DATA_DELETE      0x02  //上位机通知下位机可以删除数据
+#define SEND_FLASH_DATA_RANGE       0x03  //上位机请求上传一段时间的数据: [5-9] 开始 y m d h f, [10-14] 结束 y m d h f, 结束全0表示到最新
 
 #define SET_SHAKE_FRE               0x01  //震动提醒频率
+#define SET_RAW_LOG                 0x02  //调试: [4] 1 同时存原始数据, 0 只存每分钟统计
 
 #define STATE_INFO                  0x01  //当前电量、内存、当前提醒设置状态、设备序列号
 #define STATE_SCAN                  0x02  //上位机当前是否处于扫描界面
+#define STATE_RATE                  0x03  //当前采样档位、读取周期、切换次数
+#define STATE_FLASH                 0x04  //外部flash写入耗时统计
+#define STATE_FLASH_HEALTH          0x05  //外部flash寿命: 擦除次数、写放大、写页耗时百分位、失败次数、未上传页数
+#define STATE_CALIBRATE             0x06  //flash中的校准段: 段数、最近三段的段号和帧数、丢弃帧数
+#define STATE_POOL                  0x07  //内存池: 大块小块的占用和最高占用、各功能的占用和最高占用、失败次数
+#define STATE_UART                  0x08  //模块串口: 发送队列深度和最大深度、丢弃和暂停次数、发送量、接收溢出次数、波特率
 
 #define DATA_MONITOR_DATA           0x01  //检测产品传感器数据
 #define DATA_UTC                    0x02  //北京时间
 #define DATA_ONLINE_IMU_DATA        0x01  //实时IMU传感器数据及时间戳
 #define DATA_OFFLINE_IMU_DATA       0x03  //离线IMU传感器数据及时间戳
 #define DATA_SCAN_DATA              0x04  //上传扫描数据及时间戳
+#define DATA_OFFLINE_STILL_DATA     0x05  //离线静止标记, 上一条数据重复次数及起始时间戳
+#define DATA_OFFLINE_SUMMARY        0x06  //离线每分钟统计: 时间戳、各姿态时间、平均角度、提醒次数、活动量
+#define DATA_DAILY_STATS            0x07  //当天统计: 正确姿态分钟、佩戴分钟、最长错误姿态、提醒次数
+#define DATA_OFFLINE_CODEC_DATA     0x08  //离线IMU数据压缩块, 格式见 app_codec.h
 
 #define WXID_WRITE                  0x01  //上位机下发wxid
 
@@ -75,17 +89,33 @@ typedef struct {
     
 } data_wxid_t;
 
+typedef frame_t ble_data_t;
+
+/* 接收解析: 在接收缓存里逐字节找帧头、长度, 累加校验和, 出错后从帧头的下一个字节重新找 */
+#define BLE_PARSE_SOF               0  //找帧头 0xaa
+#define BLE_PARSE_LEN               1  //长度字节
+#define BLE_PARSE_BODY              2  //命令、地址、数据和校验和
+
 typedef struct {
-    uint8_t start;
-    uint8_t len;
-    uint8_t cmd;
-    uint8_t address;
-    uint8_t data[15];
+    uint32_t frame_cnt;                         //解出的帧数
+    uint16_t skip_cnt;                          //找帧头时丢掉的字节数
+    uint16_t len_err_cnt;                       //长度字节不对的次数
+    uint16_t sum_err_cnt;                       //校验和不对的次数
+    
+}ble_parse_stat_t;
+
+typedef struct {
+    uint8_t state;
+    uint8_t pos;                                //本帧已检查的字节数, 这些字节还在接收缓存里
     uint8_t sum;
+    uint32_t overrun_cnt;                       //接收缓存溢出后重新找帧头
+    ble_parse_stat_t stat;
     
-} ble_data_t;
+}ble_parse_t;
+
+void ble_data_parse(void);
 
-int ble_data_decode(void);
+int ble_data_decode(const ble_data_t *ble_data);
 
 #endif
 
@@ -1,29 +1,50 @@
 #include <math.h>
 
 #include "bsp_motor.h"
+#include "bsp_mpu6050.h"
 #include "bsp_system.h"
 #include "bsp_flash.h"
 #include "bsp_time.h"
 
 #include "app_calculate.h"
+#include "app_statistic.h"
 #include "app_common.h"
+#include "app_frame.h"
 
 #include "task_common.h"
 
 /* Private Macros ------------------------------------------------------------ */
+#define CALCULATE_REF_DEG           (180.0 / 3.14)  //参考模型的弧度换算, 首个版本用 3.14 作为 pi
 
 /* Private Variables --------------------------------------------------------- */
 
 /* Public Variables ---------------------------------------------------------- */
-//uint8_t *calibrate_data_p = NULL;
-uint8_t calibrate_data_p[15000] = {0};
-uint16_t calibrate_packet_cnt = 0;
 short last_ax = 0;
 short last_ay = 0;
 short last_az = 0;
-uint32_t lpw_cnt = 0;
+uint32_t lpw_ms = 0;
+posture_e last_posture = POSTURE_NONE;
+uint8_t last_posture_valid = 0;
+uint16_t last_angle[3] = {0};
+uint16_t still_run_cnt = 0;
+utc_time_t still_run_utc = {0};
+calculate_summary_t calculate_summary = {0};
+rate_level_e rate_level = RATE_LEVEL_NORMAL;
+uint32_t rate_still_ms = 0;
+uint16_t rate_change_cnt = 0;
+#if CALCULATE_BENCH_EN
+calculate_bench_t calculate_bench_cur = {0};
+calculate_bench_t calculate_bench_ref = {0};
+uint32_t calculate_posture_mismatch = 0;
+uint32_t calculate_angle_mismatch = 0;
+#endif
 
 /* Private Constants --------------------------------------------------------- */
+static const rate_config_t rate_config[RATE_LEVEL_NUM] = {
+    {100, 10},                                  //RATE_LEVEL_SLOW
+    {MPU6050_NORMAL_TIMEOUT, 50},               //RATE_LEVEL_NORMAL
+    {10, 100},                                  //RATE_LEVEL_FAST
+};
 
 /* Private function prototypes ----------------------------------------------- */
 
@@ -32,29 +53,371 @@ uint32_t lpw_cnt = 0;
 /* Exported Variables -------------------------------------------------------- */
 extern system_state_t system_state;
 extern utc_time_t utc_time;
+extern uint8_t mpu6050_timeout;
+extern timer_cnt_t time_cnt;
 
-void calculate_accelerometer(short ax, short ay, short az)
+#if CALCULATE_BENCH_EN
+static void calculate_bench_add(calculate_bench_t *bench, uint32_t cycles)
+{
+    bench->samples++;
+    bench->cycles_last = cycles;
+    bench->cycles_sum += cycles;
+    if(cycles > bench->cycles_max){
+        bench->cycles_max = cycles;
+    }
+}
+
+/**
+  * @brief  Run the reference model on the same sample and compare outputs.
+  * @param  posture: decision of the current algorithm.
+  * @param  angle: angles of the current algorithm.
+  * @param  cycles: DWT cycles spent by the current algorithm.
+  * @retval None
+  */
+static void calculate_bench(short ax, short ay, short az, posture_e posture, uint16_t *angle, uint32_t cycles)
+{
+    uint16_t angle_ref[3] = {0};
+    posture_e posture_ref;
+    uint32_t start = 0;
+    
+    calculate_bench_add(&calculate_bench_cur, cycles);
+    
+    start = dwt_get_cycle();
+    posture_ref = calculate_posture_ref(ax, ay, az, angle_ref);
+    calculate_bench_add(&calculate_bench_ref, dwt_get_cycle() - start);
+    
+    if(posture != posture_ref){
+        calculate_posture_mismatch++;
+        ES_LOG_PRINT("posture mismatch ax:%d, ay:%d, az:%d, cur:%u, ref:%u\n", ax, ay, az, posture, posture_ref);
+    }
+    if(CALCULATE_ANGLE_TOL < calculate_angle_diff(angle, angle_ref)){
+        calculate_angle_mismatch++;
+    }
+    
+    if(0 == (calculate_bench_cur.samples % CALCULATE_BENCH_REPORT)){
+        ES_LOG_PRINT("bench cur avg:%u max:%u, ref avg:%u max:%u cycles/sample, mismatch posture:%u angle:%u\n",
+            calculate_bench_cur.cycles_sum / calculate_bench_cur.samples, calculate_bench_cur.cycles_max,
+            calculate_bench_ref.cycles_sum / calculate_bench_ref.samples, calculate_bench_ref.cycles_max,
+            calculate_posture_mismatch, calculate_angle_mismatch);
+        calculate_bench_cur.samples = 0;
+        calculate_bench_cur.cycles_sum = 0;
+        calculate_bench_ref.samples = 0;
+        calculate_bench_ref.cycles_sum = 0;
+    }
+}
+#endif
+
+/**
+  * @brief  Drive the motor from the posture decision.
+  * @retval 1 if a new alert was started, else 0.
+  */
+static uint8_t calculate_apply_posture(posture_e posture)
 {
-    uint16_t data[3] = {0};
+    uint8_t alert = 0;
+    
+    if(POSTURE_BAD == posture){
+        if(0 == system_state.system_flg.motor_start_flg){
+            alert = 1;
+        }
+        motor_start();  //超过阈值，震动提醒
+    }
+    else if(POSTURE_GOOD == posture){
+        if(1 == system_state.system_flg.motor_start_flg){
+            motor_stop();   //关闭提醒
+        }
+    }
+    
+    return alert;
+}
+
+/**
+  * @brief  Store the pending "unchanged" run as one marker record.
+  * @retval None
+  */
+static void calculate_still_flush(void)
+{
+    if(0 != still_run_cnt){
+        save_still_marker(still_run_cnt, &still_run_utc);
+        still_run_cnt = 0;
+    }
+}
+
+/**
+  * @brief  Store the running summary as one DATA_OFFLINE_SUMMARY record.
+  *         Frame: aa 13 d5 06, [4-8] start y m d h f, [9-11] good/bad/none
+  *         seconds, [12-14] mean pitch/roll/tilt, [15] alerts, [16] active
+  *         percent, [17-18] samples big endian, [19] sum.
+  * @retval None
+  */
+static void calculate_summary_flush(void)
+{
+    calculate_summary_t *summary = &calculate_summary;
     uint8_t save_data_temp[20];
-    uint8_t sum = 0;
+    frame_packer_t packer;
+    uint32_t sec = 0;
+    
+    if((0 == summary->valid) || (0 == summary->samples)){
+        summary->valid = 0;
+        return;
+    }
+    
+    frame_open(&packer, save_data_temp, 0xd5, 0x06);
+    frame_put_u8(&packer, summary->utc.utc_y);
+    frame_put_u8(&packer, summary->utc.utc_m);
+    frame_put_u8(&packer, summary->utc.utc_d);
+    frame_put_u8(&packer, summary->utc.utc_h);
+    frame_put_u8(&packer, summary->utc.utc_f);
+    sec = summary->posture_ms[POSTURE_GOOD] / 1000;
+    frame_put_u8(&packer, (255 < sec) ? 255 : sec);
+    sec = summary->posture_ms[POSTURE_BAD] / 1000;
+    frame_put_u8(&packer, (255 < sec) ? 255 : sec);
+    sec = summary->posture_ms[POSTURE_NONE] / 1000;
+    frame_put_u8(&packer, (255 < sec) ? 255 : sec);
+    frame_put_u8(&packer, (int8_t)(summary->angle_sum[0] / summary->samples));
+    frame_put_u8(&packer, (int8_t)(summary->angle_sum[1] / summary->samples));
+    frame_put_u8(&packer, (uint8_t)(summary->angle_sum[2] / summary->samples));
+    frame_put_u8(&packer, summary->alert_cnt);
+    frame_put_u8(&packer, (uint32_t)summary->active_samples * 100 / summary->samples);
+    frame_put_u16(&packer, summary->samples);
+    frame_close(&packer);
+    
+    save_frame(save_data_temp);
+    
+    summary->valid = 0;
+}
+
+/**
+  * @brief  Add one sample to the running summary, close the interval
+  *         when the minute changes.
+  * @param  angle: angles of the sample, signed values stored as uint16_t.
+  * @param  still: sample is within STILL_THRESHOLD of the reference.
+  * @param  alert: sample started a new alert.
+  * @param  sample_ms: time covered by the sample.
+  * @retval None
+  */
+static void calculate_summary_add(posture_e posture, uint16_t *angle, bool still, uint8_t alert, uint16_t sample_ms)
+{
+    calculate_summary_t *summary = &calculate_summary;
+    uint8_t i = 0;
+    
+    /* 年月日时分任一变化即结束当前区间 */
+    if((1 == summary->valid) && (0 != memcmp(&summary->utc, &utc_time, 5))){
+        calculate_summary_flush();
+    }
+    if(0 == summary->valid){
+        memset(summary, 0, sizeof(calculate_summary_t));
+        summary->utc = utc_time;
+        summary->valid = 1;
+    }
+    
+    summary->posture_ms[posture] += sample_ms;
+    for(i=0; i<3; i++){
+        summary->angle_sum[i] += (int16_t)angle[i];
+    }
+    summary->samples++;
+    if(!still){
+        summary->active_samples++;
+    }
+    summary->alert_cnt += alert;
+}
+
+/**
+  * @brief  Switch sensor ODR/DLPF and the read period to the given level.
+  * @retval None
+  */
+void calculate_rate_set(rate_level_e level)
+{
+    if(RATE_LEVEL_MIN > level){
+        level = RATE_LEVEL_MIN;
+    }
+    if(RATE_LEVEL_MAX < level){
+        level = RATE_LEVEL_MAX;
+    }
+    
+    mpu_set_rate(rate_config[level].odr);
+    mpu6050_timeout = rate_config[level].timeout;
+    time_cnt.mpu6050_data_cnt = 0;
+    
+    if(rate_level != level){
+        rate_change_cnt++;
+        ES_LOG_PRINT("rate level:%u, odr:%u, period:%u ms\n", level, rate_config[level].odr, rate_config[level].timeout * TIME_TICK_MS);
+    }
+    rate_level = level;
+    rate_still_ms = 0;
+}
+
+rate_level_e calculate_rate_get(void)
+{
+    return rate_level;
+}
+
+/**
+  * @brief  Turn the raw sample log on or off at run time, the minute
+  *         summaries are stored either way. Turning it off stores the
+  *         pending still run and sample block first.
+  * @param  on: 1 to store every sample as well.
+  * @retval None
+  */
+void calculate_raw_log_set(uint8_t on)
+{
+    if(0 == on){
+        calculate_still_flush();
+        save_accelerometer_flush();
+    }
+    system_state.system_flg.raw_log_flg = (0 != on) ? 1 : 0;
+}
+
+/**
+  * @brief  Go to the fastest level on motion or posture change, step down
+  *         one level after RATE_DOWN_MS of stillness.
+  * @param  active: sample moved or changed the posture decision.
+  * @param  sample_ms: time covered by the sample.
+  * @retval None
+  */
+static void calculate_rate_update(bool active, uint16_t sample_ms)
+{
+    if(active){
+        rate_still_ms = 0;
+        if(RATE_LEVEL_MAX != rate_level){
+            calculate_rate_set(RATE_LEVEL_MAX);
+        }
+    }
+    else{
+        rate_still_ms += sample_ms;
+        if((RATE_DOWN_MS <= rate_still_ms) && (RATE_LEVEL_MIN < rate_level)){
+            calculate_rate_set((rate_level_e)(rate_level - 1));
+        }
+    }
+}
+
+/**
+  * @brief  Store an angle the way the posture decision reads it: truncated
+  *         toward zero, a negative angle in two's complement, NaN as 0.
+  * @retval Angle in whole degrees.
+  */
+static uint16_t calculate_angle_u16(double deg)
+{
+    if(deg != deg){
+        return 0;
+    }
+    
+    return (uint16_t)(int16_t)deg;
+}
+
+/**
+  * @brief  Largest difference between two angle sets, the angles compared
+  *         as signed values.
+  * @retval Degrees.
+  */
+uint16_t calculate_angle_diff(const uint16_t *angle, const uint16_t *angle_ref)
+{
+    uint16_t diff = 0;
+    int32_t d = 0;
     uint8_t i = 0;
     
+    for(i=0; i<3; i++){
+        d = (int16_t)angle[i] - (int16_t)angle_ref[i];
+        if(0 > d){
+            d = -d;
+        }
+        if(diff < d){
+            diff = d;
+        }
+    }
+    
+    return diff;
+}
+
+/**
+  * @brief  Reference posture model, written from the behaviour of the first
+  *         released algorithm rather than from its code: double precision,
+  *         no integer overflow, and the decision stated on signed angles.
+  *         calculate_posture() is checked against it by the DWT bench and
+  *         tools/calculate_test_tool.c. Kept on purpose from the release:
+  *         roll comes from the integer quotient ay / ax, pi is 3.14, and a
+  *         negative pitch or roll is stored as a large uint16_t angle, so
+  *         leaning back or to the other side counts as bad posture.
+  * @param  angle: output angles as calculate_posture() stores them.
+  * @retval Posture decision.
+  */
+posture_e calculate_posture_ref(short ax, short ay, short az, uint16_t *angle)
+{
+    double x = ax;
+    double y = ay;
+    double z = az;
+    double norm = sqrt(x * x + y * y + z * z);
+    double pitch = atan2(z, sqrt(x * x + y * y)) * CALCULATE_REF_DEG;
+    double roll = -atan((0 != ax) ? (double)(ay / ax) : 0.0) * CALCULATE_REF_DEG;
+    double tilt = (0 < norm) ? acos(x / norm) * CALCULATE_REF_DEG : 0.0;
+    
+    angle[0] = calculate_angle_u16(pitch);
+    angle[1] = calculate_angle_u16(roll);
+    angle[2] = calculate_angle_u16(tilt);
+    
+    /* 倾角不到 66 度才判断, 前倾 25 度以上、后仰、侧倾都算错误姿态 */
+    if(66 > tilt){
+        if((25 <= pitch) || (-1 >= pitch) || (10 <= roll) || (-1 >= roll)){
+            return POSTURE_BAD;
+        }
+        return POSTURE_GOOD;
+    }
+    
+    return POSTURE_NONE;
+}
+
+/**
+  * @brief  Posture algorithm used by calculate_accelerometer().
+  * @param  angle: output angles, angle[0] pitch, angle[1] roll, angle[2] tilt.
+  * @retval Posture decision.
+  */
+posture_e calculate_posture(short ax, short ay, short az, uint16_t *angle)
+{
+    /* 角度算法, ax 为 0 时商按 0 计算, 和芯片除零的结果一样 */
+    angle[1] = calculate_angle_u16(-atan((0 != ax) ? ay / ax : 0) * 180 / 3.14);
+    angle[0] = calculate_angle_u16(atan(az / sqrtf(ax * ax + ay * ay)) * 180 / 3.14);
+    angle[2] = calculate_angle_u16(acos(ax / sqrtf(ax * ax + ay * ay + az * az)) * 180 / 3.14);
+    
+    if(65 >= angle[2]){
+        if((25 <= angle[0]) || (10 <= angle[1])){
+            return POSTURE_BAD;
+        }
+        return POSTURE_GOOD;
+    }
+    
+    return POSTURE_NONE;
+}
+
+void calculate_accelerometer(short ax, short ay, short az)
+{
+    uint16_t angle[3] = {0};
+    posture_e posture = POSTURE_NONE;
+    uint8_t *slot = NULL;
+    bool still = false;
+    bool lpw_req = false;
+    bool changed = false;
+    uint8_t alert = 0;
+    uint16_t sample_ms = mpu6050_timeout * TIME_TICK_MS;
+#if CALCULATE_BENCH_EN
+    uint32_t start = 0;
+#endif
+    
     if((0==last_ax) && (0==last_ay) && (0==last_az)){
         last_ax = ax;
         last_ay = ay;
         last_az = az;
     }       
     else{
-        if((1000>(last_ax>=ax?last_ax-ax:ax-last_ax)) && (1000>(last_ay>=ay?last_ay-ay:ay-last_ay))&& (1000>(last_az>=az?last_az-az:az-last_az))){
-            lpw_cnt++;
-            ES_LOG_PRINT("lpw_cnt: %u\n", lpw_cnt);
-            if(120<lpw_cnt){
+        if((STILL_THRESHOLD>(last_ax>=ax?last_ax-ax:ax-last_ax)) && (STILL_THRESHOLD>(last_ay>=ay?last_ay-ay:ay-last_ay))&& (STILL_THRESHOLD>(last_az>=az?last_az-az:az-last_az))){
+            still = true;
+            lpw_ms += sample_ms;
+            ES_LOG_PRINT("lpw_ms: %u\n", lpw_ms);
+            if(STILL_LPW_MS<lpw_ms){
+                lpw_req = true;
                 set_task(SG, LOW_POWER_MODE);
             }
         }
         else{
-            lpw_cnt = 0;
+            lpw_ms = 0;
             last_ax = ax;
             last_ay = ay;
             last_az = az;
@@ -62,55 +425,74 @@ void calculate_accelerometer(short ax, short ay, short az)
     }
     
     if(1 == system_state.system_flg.calibrate_mode_flg){
+        calculate_still_flush();
+        save_accelerometer_flush();
+        calculate_summary_flush();
+        last_posture_valid = 0;
+        
         if(1 == system_state.system_flg.calibrate_key_flg){
-            
-            memset(save_data_temp, 0, 20);
-            save_data_temp[0] = 0xaa;
-            save_data_temp[1] = 0x13;
-            save_data_temp[2] = 0xd5;
-            save_data_temp[3] = 0x04;
-            save_data_temp[4] = ax >> 8;
-            save_data_temp[5] = ax & 0xff;
-            save_data_temp[6] = ay >> 8;
-            save_data_temp[7] = ay & 0xff;
-            save_data_temp[8] = az >> 8;
-            save_data_temp[9] = az & 0xff;
-            save_data_temp[10] = utc_time.utc_y;
-            save_data_temp[11] = utc_time.utc_m;
-            save_data_temp[12] = utc_time.utc_d;
-            save_data_temp[13] = utc_time.utc_h;
-            save_data_temp[14] = utc_time.utc_f;
-            save_data_temp[15] = utc_time.utc_s;
-            
-            sum = 0;
-            for(i=0; i<19; i++){
-                sum += save_data_temp[i];
+            /* 直接写入外部flash校准区的页缓存 */
+            slot = flash_calib_slot();
+            if(NULL != slot){
+                frame_pack_sample(slot, 0x04, ax, ay, az, &utc_time.utc_y);
+                flash_calib_commit();
             }
-            save_data_temp[19] = sum;
-            
-//            if(NULL != calibrate_data_p){
-                memcpy(calibrate_data_p+calibrate_packet_cnt*20, save_data_temp, 20);
-                calibrate_packet_cnt++;
-//            }
         }
     }
     else{
-        /* 角度算法 */
-        data[1] = -atan(ay / ax) * 180 / 3.14;
-        data[0] = atan(az / sqrtf(ax * ax + ay * ay)) * 180 / 3.14;
-        data[2] = acos(ax / sqrtf(ax * ax + ay * ay + az * az)) * 180 / 3.14;
-        
-        if(65 >= data[2]){
-            if((25 <= data[0]) || (10 <= data[1])){
-                motor_start();  //超过阈值，震动提醒
-            }
-            else{
-                if(1 == system_state.system_flg.motor_start_flg){
-                    motor_stop();   //关闭提醒
+#if CALCULATE_BENCH_EN
+        start = dwt_get_cycle();
+#endif
+        if(still && (1 == last_posture_valid) && (0 == system_state.system_flg.imu_data_flg)){
+            /* 静止快速路径: 沿用上次姿态判断, 不计算角度 */
+            posture = last_posture;
+            memcpy(angle, last_angle, sizeof(last_angle));
+#if CALCULATE_BENCH_EN
+            calculate_bench(ax, ay, az, posture, angle, dwt_get_cycle() - start);
+#endif
+            if(1 == system_state.system_flg.raw_log_flg){
+                /* 只累计重复次数, 不存储 */
+                if(0 == still_run_cnt){
+                    still_run_utc = utc_time;
                 }
+                still_run_cnt++;
+                if(STILL_RUN_MAX <= still_run_cnt){
+                    calculate_still_flush();
+                }
+            }
+        }
+        else{
+            posture = calculate_posture(ax, ay, az, angle);
+#if CALCULATE_BENCH_EN
+            calculate_bench(ax, ay, az, posture, angle, dwt_get_cycle() - start);
+#endif
+            changed = (1 == last_posture_valid) && (posture != last_posture);
+            last_posture = posture;
+            last_posture_valid = 1;
+            memcpy(last_angle, angle, sizeof(last_angle));
+            
+            if(1 == system_state.system_flg.raw_log_flg){
+                calculate_still_flush();
+                save_accelerometer(ax, ay, az);
+            }
+            if(1 == system_state.system_flg.imu_data_flg){
+                send_accelerometer(ax, ay, az);
             }
         }
         
-        save_accelerometer(ax, ay, az);
+        alert = calculate_apply_posture(posture);
+        calculate_summary_add(posture, angle, still, alert, sample_ms);
+        statistic_add(posture, alert, sample_ms);
+        
+        if(!lpw_req){
+            calculate_rate_update(!still || changed, sample_ms);
+        }
+    }
+    
+    /* 进入低功耗前把未写入的数据存下 */
+    if(lpw_req){
+        calculate_still_flush();
+        save_accelerometer_flush();
+        calculate_summary_flush();
     }
 }
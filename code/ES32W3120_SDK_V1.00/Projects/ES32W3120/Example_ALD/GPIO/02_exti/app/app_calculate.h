@@ -3,8 +3,77 @@
 
 #include "global.h"
 
+#include "bsp_time.h"
+
+/* 1: 每个样本同时运行参考算法, 比较结果并统计 DWT 周期 */
+#define CALCULATE_BENCH_EN          0
+#define CALCULATE_BENCH_REPORT      100             //每 100 个样本输出一次统计
+#define CALCULATE_ANGLE_TOL         1               //和参考模型比较时允许的角度误差, 度
+
+#define STILL_THRESHOLD             1000            //静止判定阈值
+#define STILL_LPW_MS                60000           //静止超过该时间进入低功耗
+#define STILL_RUN_MAX               600             //静止标记最多累计的样本数
+
+typedef enum {
+    POSTURE_NONE = 0,               //非站立/坐姿, 不做判断
+    POSTURE_GOOD = 1,               //姿态正确
+    POSTURE_BAD  = 2,               //姿态错误, 震动提醒
+    
+    POSTURE_MAX,
+}posture_e;
+
+/* 采样率自适应: 有动作立即升到最快档, 持续静止 RATE_DOWN_MS 降一档 */
+#define RATE_LEVEL_MIN              RATE_LEVEL_SLOW  //允许的最低档
+#define RATE_LEVEL_MAX              RATE_LEVEL_FAST  //允许的最高档
+#define RATE_DOWN_MS                5000            //静止多久降一档
+
+typedef enum {
+    RATE_LEVEL_SLOW = 0,            //传感器10Hz, 1s读一次
+    RATE_LEVEL_NORMAL = 1,          //传感器50Hz, 500ms读一次
+    RATE_LEVEL_FAST = 2,            //传感器100Hz, 100ms读一次
+    
+    RATE_LEVEL_NUM,
+}rate_level_e;
+
+typedef struct {
+    uint8_t timeout;                //读取周期, 定时器中断次数
+    uint16_t odr;                   //传感器采样率 Hz
+    
+}rate_config_t;
+
+typedef struct {
+    uint32_t samples;
+    uint32_t cycles_last;
+    uint32_t cycles_max;
+    uint32_t cycles_sum;
+    
+}calculate_bench_t;
+
+/* 每分钟姿态统计, 区间结束时存为一条 DATA_OFFLINE_SUMMARY 数据 */
+typedef struct {
+    utc_time_t utc;                             //区间起始时间
+    uint32_t posture_ms[POSTURE_MAX];           //各姿态累计时间
+    int32_t angle_sum[3];                       //角度累加, 用于计算平均角度
+    uint16_t samples;
+    uint16_t active_samples;                    //非静止样本数
+    uint8_t alert_cnt;                          //震动提醒次数
+    uint8_t valid;
+    
+}calculate_summary_t;
+
+void calculate_rate_set(rate_level_e level);
+
+rate_level_e calculate_rate_get(void);
+
+void calculate_raw_log_set(uint8_t on);
+
 void calculate_accelerometer(short ax, short ay, short az);
 
-#endif
+posture_e calculate_posture(short ax, short ay, short az, uint16_t *angle);
+
+posture_e calculate_posture_ref(short ax, short ay, short az, uint16_t *angle);
 
+uint16_t calculate_angle_diff(const uint16_t *angle, const uint16_t *angle_ref);
+
+#endif
 
@@ -0,0 +1,197 @@
+#include "app_codec.h"
+#include "app_frame.h"
+
+#ifndef CODEC_HOST
+#include "bsp_common.h"
+#else
+uint16_t crc16_calc(uint16_t crc, const uint8_t *buf, uint32_t len);
+#endif
+
+/* Private Macros ------------------------------------------------------------ */
+
+/* Private Variables --------------------------------------------------------- */
+
+/* Public Variables ---------------------------------------------------------- */
+
+/* Private Constants --------------------------------------------------------- */
+
+/* Private function prototypes ----------------------------------------------- */
+
+/* Private Function ---------------------------------------------------------- */
+static uint8_t codec_put_varint(uint8_t *buf, int32_t delta)
+{
+    uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);    //zig-zag
+    uint8_t len = 0;
+    
+    while(0x80 <= value){
+        buf[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+    
+    return len;
+}
+
+static int codec_get_varint(const uint8_t *buf, uint16_t len, uint16_t *pos, int32_t *delta)
+{
+    uint32_t value = 0;
+    uint8_t shift = 0;
+    uint8_t byte = 0;
+    
+    do{
+        if((*pos >= len) || (21 <= shift)){
+            return -1;
+        }
+        byte = buf[(*pos)++];
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    }while(byte & 0x80);
+    
+    *delta = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+    
+    return 0;
+}
+
+/* Exported Variables -------------------------------------------------------- */
+
+/**
+  * @brief  Start a block with its first sample stored absolute.
+  * @param  utc: y m d h f s of the first sample.
+  * @param  period: sample period in 10 ms ticks.
+  * @param  xyz: first sample.
+  * @retval None
+  */
+void codec_block_start(codec_block_t *block, const uint8_t *utc, uint8_t period, const int16_t *xyz)
+{
+    uint8_t *head = block->buf;
+    uint8_t i = 0;
+    
+    frame_begin(head, 0xd5, CODEC_DATA_TYPE);
+    memset(&block->buf[CODEC_SLOT_LEN], 0, CODEC_BLOCK_LEN - CODEC_SLOT_LEN);
+    head[6] = period;
+    memcpy(&head[7], utc, 6);
+    for(i=0; i<3; i++){
+        head[13+i*2] = (uint16_t)xyz[i] >> 8;
+        head[14+i*2] = (uint16_t)xyz[i] & 0xff;
+        block->last[i] = xyz[i];
+    }
+    
+    block->len = CODEC_SLOT_LEN;
+    block->cnt = 1;
+}
+
+/**
+  * @brief  Append one sample as three zig-zag varint deltas.
+  * @retval 1 if stored, 0 if the block is full and must be finished first.
+  */
+uint8_t codec_block_add(codec_block_t *block, const int16_t *xyz)
+{
+    uint8_t data[CODEC_SAMPLE_BYTE_MAX];
+    uint8_t len = 0;
+    uint8_t i = 0;
+    
+    if(CODEC_SAMPLE_MAX <= block->cnt){
+        return 0;
+    }
+    
+    for(i=0; i<3; i++){
+        len += codec_put_varint(&data[len], (int32_t)xyz[i] - block->last[i]);
+    }
+    if(block->len + len + CODEC_CRC_LEN > CODEC_BLOCK_LEN){
+        return 0;
+    }
+    
+    memcpy(&block->buf[block->len], data, len);
+    block->len += len;
+    block->cnt++;
+    for(i=0; i<3; i++){
+        block->last[i] = xyz[i];
+    }
+    
+    return 1;
+}
+
+/**
+  * @brief  Fill in slot count, sample count, sum and CRC.
+  * @retval Length of the block in bytes, a multiple of CODEC_SLOT_LEN.
+  */
+uint16_t codec_block_finish(codec_block_t *block)
+{
+    uint8_t *head = block->buf;
+    uint16_t crc = 0;
+    uint8_t slot = 0;
+    
+    slot = (block->len + CODEC_CRC_LEN + CODEC_SLOT_LEN - 1) / CODEC_SLOT_LEN;
+    head[4] = slot;
+    head[5] = block->cnt;
+    frame_end(head);
+    
+    crc = crc16_calc(0xffff, head, FRAME_LEN-1);
+    crc = crc16_calc(crc, &block->buf[CODEC_SLOT_LEN], block->len - CODEC_SLOT_LEN);
+    block->buf[block->len] = crc >> 8;
+    block->buf[block->len + 1] = crc & 0xff;
+    
+    return (uint16_t)slot * CODEC_SLOT_LEN;
+}
+
+/**
+  * @brief  Decode one block and check its CRC.
+  * @param  buf: block starting with the head frame.
+  * @param  len: bytes available in buf.
+  * @param  cb: called for every sample in order, may be NULL.
+  * @retval Length of the block in bytes, -1 if it is damaged.
+  */
+int codec_block_decode(const uint8_t *buf, uint16_t len, codec_sample_cb cb, void *ctx)
+{
+    int16_t xyz[3];
+    int32_t delta = 0;
+    uint16_t block_len = 0;
+    uint16_t pos = CODEC_SLOT_LEN;
+    uint16_t crc = 0;
+    uint8_t i = 0;
+    uint16_t n = 0;
+    
+    if((CODEC_SLOT_LEN > len) || (false == frame_check(buf)) || (0xd5 != buf[2]) || (CODEC_DATA_TYPE != buf[3])){
+        return -1;
+    }
+    block_len = (uint16_t)buf[4] * CODEC_SLOT_LEN;
+    if((0 == buf[5]) || (2 > buf[4]) || (CODEC_SLOT_MAX < buf[4]) || (block_len > len)){
+        return -1;
+    }
+    
+    /* 先校验, 再输出样本 */
+    for(n=1; n<buf[5]; n++){
+        for(i=0; i<3; i++){
+            if(0 != codec_get_varint(buf, block_len, &pos, &delta)){
+                return -1;
+            }
+        }
+    }
+    if(pos + CODEC_CRC_LEN > block_len){
+        return -1;
+    }
+    crc = crc16_calc(0xffff, buf, FRAME_LEN-1);
+    crc = crc16_calc(crc, &buf[CODEC_SLOT_LEN], pos - CODEC_SLOT_LEN);
+    if(crc != (((uint16_t)buf[pos] << 8) | buf[pos + 1])){
+        return -1;
+    }
+    
+    if(NULL == cb){
+        return block_len;
+    }
+    
+    for(i=0; i<3; i++){
+        xyz[i] = (int16_t)(((uint16_t)buf[13+i*2] << 8) | buf[14+i*2]);
+    }
+    cb(ctx, 0, xyz);
+    pos = CODEC_SLOT_LEN;
+    for(n=1; n<buf[5]; n++){
+        for(i=0; i<3; i++){
+            codec_get_varint(buf, block_len, &pos, &delta);
+            xyz[i] = (int16_t)(xyz[i] + delta);
+        }
+        cb(ctx, n, xyz);
+    }
+    
+    return block_len;
+}
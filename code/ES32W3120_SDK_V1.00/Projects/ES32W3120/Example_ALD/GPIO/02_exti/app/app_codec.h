@@ -0,0 +1,46 @@
+#ifndef __APP_CODEC_H
+#define __APP_CODEC_H
+
+/* 不依赖驱动, 上位机工具 tools/sample_codec_tool.c 也编译本模块 */
+#ifdef CODEC_HOST
+#include <stdint.h>
+#include <string.h>
+#else
+#include "global.h"
+#endif
+
+/*
+ * 原始数据压缩块, 由 CODEC_SLOT_LEN 字节的槽组成, 存储和上传都按帧对齐:
+ *   头帧  [0-3] aa 13 d5 08, [4] 槽数, [5] 样本数, [6] 采样周期(10ms),
+ *         [7-12] 第一个样本的 y m d h f s, [13-18] 第一个样本 ax ay az,
+ *         [19] 0-18 字节和
+ *   后续槽 其余样本相对前一个样本的差值, 每轴 zig-zag 后按 varint 编码,
+ *         接着是 crc16 (头帧 0-18 字节 + 差值数据), 不足补 0
+ */
+#define CODEC_DATA_TYPE               0x08
+#define CODEC_SLOT_LEN                20
+#define CODEC_SLOT_MAX                10              //一个块最多 200 字节, 等于一次上传的长度
+#define CODEC_BLOCK_LEN               (CODEC_SLOT_LEN * CODEC_SLOT_MAX)
+#define CODEC_SAMPLE_MAX              255
+#define CODEC_SAMPLE_BYTE_MAX         9               //一个样本差值最长 3 轴 x 3 字节
+#define CODEC_CRC_LEN                 2
+
+typedef struct {
+    uint8_t buf[CODEC_BLOCK_LEN];
+    uint16_t len;                               //已使用长度, 包括头帧
+    uint8_t cnt;                                //样本数, 0 表示空块
+    int16_t last[3];                            //上一个样本, 计算差值用
+    
+}codec_block_t;
+
+typedef void (*codec_sample_cb)(void *ctx, uint8_t index, const int16_t *xyz);
+
+void codec_block_start(codec_block_t *block, const uint8_t *utc, uint8_t period, const int16_t *xyz);
+
+uint8_t codec_block_add(codec_block_t *block, const int16_t *xyz);
+
+uint16_t codec_block_finish(codec_block_t *block);
+
+int codec_block_decode(const uint8_t *buf, uint16_t len, codec_sample_cb cb, void *ctx);
+
+#endif
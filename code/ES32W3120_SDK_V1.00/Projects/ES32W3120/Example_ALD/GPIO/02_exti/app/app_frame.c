@@ -0,0 +1,178 @@
+#include "app_frame.h"
+
+/* Private Macros ------------------------------------------------------------ */
+
+/* Private Variables --------------------------------------------------------- */
+
+/* Public Variables ---------------------------------------------------------- */
+
+/* Private Constants --------------------------------------------------------- */
+
+/* Private function prototypes ----------------------------------------------- */
+
+/* Private Function ---------------------------------------------------------- */
+
+/* Public Function ----------------------------------------------------------- */
+
+/**
+  * @brief  Write the frame header and clear the data, the caller fills the
+  *         data fields and calls frame_end().
+  * @param  buf: Destination, FRAME_LEN bytes.
+  * @retval Pointer to the data, frame byte 4.
+  */
+uint8_t *frame_begin(uint8_t *buf, uint8_t cmd, uint8_t addr)
+{
+    buf[0] = FRAME_SOF;
+    buf[1] = FRAME_LENGTH;
+    buf[2] = cmd;
+    buf[3] = addr;
+    memset(&buf[4], 0, FRAME_DATA_LEN);
+    
+    return &buf[4];
+}
+
+/**
+  * @brief  Fill in the checksum of a frame built with frame_begin().
+  * @retval None
+  */
+void frame_end(uint8_t *buf)
+{
+    uint8_t sum = 0;
+    uint8_t i = 0;
+    
+    for(i=0; i<FRAME_LEN-1; i++){
+        sum += buf[i];
+    }
+    buf[FRAME_LEN-1] = sum;
+}
+
+/**
+  * @brief  Write a whole frame into buf, the checksum is summed while the
+  *         bytes are written.
+  * @param  data: First len data bytes, the rest is zero. NULL when len is 0.
+  * @param  len: At most FRAME_DATA_LEN.
+  * @retval None
+  */
+void frame_pack(uint8_t *buf, uint8_t cmd, uint8_t addr, const uint8_t *data, uint8_t len)
+{
+    uint8_t sum = FRAME_SOF + FRAME_LENGTH + cmd + addr;
+    uint8_t i = 0;
+    
+    buf[0] = FRAME_SOF;
+    buf[1] = FRAME_LENGTH;
+    buf[2] = cmd;
+    buf[3] = addr;
+    for(i=0; i<FRAME_DATA_LEN; i++){
+        buf[4+i] = (i < len) ? data[i] : 0;
+        sum += buf[4+i];
+    }
+    buf[FRAME_LEN-1] = sum;
+}
+
+/**
+  * @brief  Write a sample record frame (cmd 0xd5) straight into the
+  *         destination: [4-9] ax ay az big endian, [10-15] y m d h f s.
+  * @param  buf: Destination, page buffer or send buffer.
+  * @param  addr: Record type, DATA_ONLINE_IMU_DATA, DATA_OFFLINE_IMU_DATA...
+  * @param  utc: y m d h f s, e.g. &utc_time.utc_y.
+  * @retval None
+  */
+void frame_pack_sample(uint8_t *buf, uint8_t addr, uint16_t ax, uint16_t ay, uint16_t az, const uint8_t *utc)
+{
+    uint8_t sum = FRAME_SOF + FRAME_LENGTH + 0xd5 + addr;
+    uint8_t i = 0;
+    
+    buf[0] = FRAME_SOF;
+    buf[1] = FRAME_LENGTH;
+    buf[2] = 0xd5;
+    buf[3] = addr;
+    buf[4] = ax >> 8;
+    buf[5] = ax & 0xff;
+    buf[6] = ay >> 8;
+    buf[7] = ay & 0xff;
+    buf[8] = az >> 8;
+    buf[9] = az & 0xff;
+    sum += buf[4] + buf[5] + buf[6] + buf[7] + buf[8] + buf[9];
+    for(i=0; i<6; i++){
+        buf[10+i] = utc[i];
+        sum += utc[i];
+    }
+    buf[16] = 0;
+    buf[17] = 0;
+    buf[18] = 0;
+    buf[FRAME_LEN-1] = sum;
+}
+
+/**
+  * @brief  Check start byte, length and checksum of a received frame.
+  * @retval true if the frame is valid.
+  */
+bool frame_check(const uint8_t *buf)
+{
+    uint8_t sum = 0;
+    uint8_t i = 0;
+    
+    if((FRAME_SOF != buf[0]) || (FRAME_LENGTH != buf[1])){
+        return false;
+    }
+    for(i=0; i<FRAME_LEN-1; i++){
+        sum += buf[i];
+    }
+    
+    return (sum == buf[FRAME_LEN-1]) ? true : false;
+}
+
+/**
+  * @brief  Start a frame for frame_put_u8()/frame_put_u16(): write the
+  *         header, the data fields follow from frame byte 4.
+  * @param  buf: Destination, FRAME_LEN bytes.
+  * @retval None
+  */
+void frame_open(frame_packer_t *packer, uint8_t *buf, uint8_t cmd, uint8_t addr)
+{
+    buf[0] = FRAME_SOF;
+    buf[1] = FRAME_LENGTH;
+    buf[2] = cmd;
+    buf[3] = addr;
+    packer->buf = buf;
+    packer->pos = 4;
+    packer->sum = FRAME_SOF + FRAME_LENGTH + cmd + addr;
+}
+
+/**
+  * @brief  Append a one byte field, fields past the data are dropped.
+  * @retval None
+  */
+void frame_put_u8(frame_packer_t *packer, uint8_t value)
+{
+    if(FRAME_LEN-1 <= packer->pos){
+        return;
+    }
+    packer->buf[packer->pos++] = value;
+    packer->sum += value;
+}
+
+/**
+  * @brief  Append a big endian two byte field, saturated at 0xffff.
+  * @retval None
+  */
+void frame_put_u16(frame_packer_t *packer, uint32_t value)
+{
+    if(0xffff < value){
+        value = 0xffff;
+    }
+    frame_put_u8(packer, value >> 8);
+    frame_put_u8(packer, value & 0xff);
+}
+
+/**
+  * @brief  Clear the data bytes after the last field and write the checksum.
+  * @retval None
+  */
+void frame_close(frame_packer_t *packer)
+{
+    while(FRAME_LEN-1 > packer->pos){
+        packer->buf[packer->pos++] = 0;
+    }
+    packer->buf[FRAME_LEN-1] = packer->sum;
+}
@@ -0,0 +1,47 @@
+#ifndef __APP_FRAME_H
+#define __APP_FRAME_H
+
+/* 不依赖驱动, 上位机工具也编译本模块 */
+#ifdef CODEC_HOST
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#else
+#include "global.h"
+#endif
+
+/* 和小程序通信、存储用的20字节帧: aa 13 cmd addr data[15] sum, sum 为前19字节之和 */
+#define FRAME_LEN                   20
+#define FRAME_DATA_LEN              15
+#define FRAME_SOF                   0xaa
+#define FRAME_LENGTH                0x13
+
+typedef struct {
+    uint8_t start;
+    uint8_t len;
+    uint8_t cmd;
+    uint8_t address;
+    uint8_t data[FRAME_DATA_LEN];
+    uint8_t sum;
+
+}frame_t;
+
+/* 按字段顺序写帧, 写入时同时求和, 不用先清零再单独求和 */
+typedef struct {
+    uint8_t *buf;
+    uint8_t pos;                                //下一个字段的位置
+    uint8_t sum;
+
+}frame_packer_t;
+
+uint8_t *frame_begin(uint8_t *buf, uint8_t cmd, uint8_t addr);
+void frame_end(uint8_t *buf);
+void frame_pack(uint8_t *buf, uint8_t cmd, uint8_t addr, const uint8_t *data, uint8_t len);
+void frame_pack_sample(uint8_t *buf, uint8_t addr, uint16_t ax, uint16_t ay, uint16_t az, const uint8_t *utc);
+bool frame_check(const uint8_t *buf);
+void frame_open(frame_packer_t *packer, uint8_t *buf, uint8_t cmd, uint8_t addr);
+void frame_put_u8(frame_packer_t *packer, uint8_t value);
+void frame_put_u16(frame_packer_t *packer, uint32_t value);
+void frame_close(frame_packer_t *packer);
+
+#endif
@@ -0,0 +1,126 @@
+#include "bsp_time.h"
+
+#include "app_ble.h"
+#include "app_frame.h"
+#include "app_statistic.h"
+
+/* Private Macros ------------------------------------------------------------ */
+
+/* Private Variables --------------------------------------------------------- */
+
+/* Public Variables ---------------------------------------------------------- */
+statistic_day_t statistic_day = {0};
+
+/* Private Constants --------------------------------------------------------- */
+
+/* Private function prototypes ----------------------------------------------- */
+
+/* Private Function ---------------------------------------------------------- */
+
+/* Exported Variables -------------------------------------------------------- */
+extern utc_time_t utc_time;
+
+/**
+  * @brief  Start a new day when the date has changed.
+  * @retval None
+  */
+static void statistic_check_day(void)
+{
+    statistic_day_t *day = &statistic_day;
+    
+    if((1 == day->valid) && (day->utc_y == utc_time.utc_y) && (day->utc_m == utc_time.utc_m) && (day->utc_d == utc_time.utc_d)){
+        return;
+    }
+    
+    /* 过零点, 清零 */
+    memset(day, 0, sizeof(statistic_day_t));
+    day->utc_y = utc_time.utc_y;
+    day->utc_m = utc_time.utc_m;
+    day->utc_d = utc_time.utc_d;
+    day->valid = 1;
+}
+
+/**
+  * @brief  Add one classified sample to today's counters.
+  * @param  posture: posture decision of the sample.
+  * @param  alert: 1 if the sample started a new alert.
+  * @param  sample_ms: time covered by the sample.
+  * @retval None
+  */
+void statistic_add(posture_e posture, uint8_t alert, uint16_t sample_ms)
+{
+    statistic_day_t *day = &statistic_day;
+    uint8_t hour = utc_time.utc_h;
+    
+    statistic_check_day();
+    
+    day->wear_ms += sample_ms;
+    
+    if(POSTURE_GOOD == posture){
+        day->good_ms += sample_ms;
+    }
+    
+    if(POSTURE_BAD == posture){
+        day->bad_run_ms += sample_ms;
+        if(day->bad_max_ms < day->bad_run_ms){
+            day->bad_max_ms = day->bad_run_ms;
+        }
+    }
+    else{
+        day->bad_run_ms = 0;
+    }
+    
+    if((1 == alert) && (24 > hour)){
+        day->alert_cnt++;
+        if(255 > day->alert_hour[hour]){
+            day->alert_hour[hour]++;
+        }
+        if(day->alert_hour_max < day->alert_hour[hour]){
+            day->alert_hour_max = day->alert_hour[hour];
+            day->alert_hour_max_h = hour;
+        }
+    }
+}
+
+/**
+  * @brief  Build the DATA_DAILY_STATS reply.
+  *         Frame: aa 13 d5 07, [4-6] y m d, [7-8] good minutes, [9-10] wear
+  *         minutes, [11-12] longest bad stretch seconds, [13-14] alerts,
+  *         [15] alerts per worn hour, [16] alerts this hour, [17] max alerts
+  *         in one hour, [18] that hour, [19] sum.
+  * @param  buf: 20 byte output buffer.
+  * @retval None
+  */
+void statistic_get_frame(uint8_t *buf)
+{
+    statistic_day_t *day = &statistic_day;
+    frame_packer_t packer;
+    uint32_t good_min = 0;
+    uint32_t wear_min = 0;
+    uint32_t bad_max_s = 0;
+    uint32_t alert_rate = 0;
+    
+    /* 当天还没有样本时也要先清零, 避免返回前一天的数据 */
+    statistic_check_day();
+    
+    good_min = day->good_ms / 60000;
+    wear_min = day->wear_ms / 60000;
+    bad_max_s = day->bad_max_ms / 1000;
+    if(0 != wear_min){
+        alert_rate = (uint32_t)day->alert_cnt * 60 / wear_min;
+    }
+    
+    frame_open(&packer, buf, 0xd5, DATA_DAILY_STATS);
+    frame_put_u8(&packer, day->utc_y);
+    frame_put_u8(&packer, day->utc_m);
+    frame_put_u8(&packer, day->utc_d);
+    frame_put_u16(&packer, good_min);
+    frame_put_u16(&packer, wear_min);
+    frame_put_u16(&packer, bad_max_s);
+    frame_put_u16(&packer, day->alert_cnt);
+    frame_put_u8(&packer, (255 < alert_rate) ? 255 : alert_rate);
+    frame_put_u8(&packer, (24 > utc_time.utc_h) ? day->alert_hour[utc_time.utc_h] : 0);
+    frame_put_u8(&packer, day->alert_hour_max);
+    frame_put_u8(&packer, day->alert_hour_max_h);
+    frame_close(&packer);
+}
@@ -0,0 +1,31 @@
+#ifndef __APP_STATISTIC_H
+#define __APP_STATISTIC_H
+
+#include "global.h"
+
+#include "bsp_time.h"
+
+#include "app_calculate.h"
+
+/* 当天统计, 每个样本更新一次, 查询时直接组帧, 过零点清零 */
+typedef struct {
+    uint8_t utc_y;                              //统计日期
+    uint8_t utc_m;
+    uint8_t utc_d;
+    uint8_t valid;
+    uint32_t good_ms;                           //姿态正确时间
+    uint32_t wear_ms;                           //佩戴时间
+    uint32_t bad_run_ms;                        //当前连续错误姿态时间
+    uint32_t bad_max_ms;                        //最长连续错误姿态时间
+    uint16_t alert_cnt;                         //当天震动提醒次数
+    uint8_t alert_hour[24];                     //每小时震动提醒次数
+    uint8_t alert_hour_max;                     //提醒最多的小时的次数
+    uint8_t alert_hour_max_h;                   //提醒最多的小时
+    
+}statistic_day_t;
+
+void statistic_add(posture_e posture, uint8_t alert, uint16_t sample_ms);
+
+void statistic_get_frame(uint8_t *buf);
+
+#endif
@@ -1,5 +1,9 @@
+#include "ald_conf.h"
+
 #include "bsp_common.h"
 
+static crc_handle_t h_crc;
+
 void Delay(unsigned int time)
 {
     unsigned int i,j;
@@ -8,3 +12,113 @@ void Delay(unsigned int time)
         {;}
 }
 
+/**
+  * @brief  Enable the DWT cycle counter (48MHz core clock).
+  * @retval None
+  */
+void dwt_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+  * @brief  Read the DWT cycle counter.
+  * @retval Current cycle count, wraps every ~89s at 48MHz.
+  */
+uint32_t dwt_get_cycle(void)
+{
+    return DWT->CYCCNT;
+}
+
+/**
+  * @brief  CRC-16/CCITT (poly 0x1021), start with crc = 0xffff.
+  * @param  crc: CRC of the previous block, allows chunked calculation.
+  * @retval New CRC value.
+  */
+uint16_t crc16_calc(uint16_t crc, const uint8_t *buf, uint32_t len)
+{
+    uint8_t i = 0;
+    
+    while(len--){
+        crc ^= (uint16_t)(*buf++) << 8;
+        for(i=0; i<8; i++){
+            if(crc & 0x8000){
+                crc = (crc << 1) ^ 0x1021;
+            }
+            else{
+                crc <<= 1;
+            }
+        }
+    }
+    
+    return crc;
+}
+
+/**
+  * @brief  Set up the CRC peripheral as CRC-32 (reflected, seed 0xffffffff,
+  *         final xor), the same result as the zlib crc32().
+  * @retval None
+  */
+void crc32_init(void)
+{
+    memset(&h_crc, 0, sizeof(h_crc));
+    h_crc.perh = CRC;
+    h_crc.init.mode = CRC_MODE_32;
+    h_crc.init.seed = 0xffffffff;
+    h_crc.init.data_rev = ENABLE;
+    h_crc.init.data_inv = DISABLE;
+    h_crc.init.chs_rev = ENABLE;
+    h_crc.init.chs_inv = ENABLE;
+    ald_crc_init(&h_crc);
+}
+
+/**
+  * @brief  Start a new CRC. The unit has one owner at a time: a DMA
+  *         calculation still running is never reset, the caller tries again.
+  * @retval 0 if started, -1 while a DMA calculation is running.
+  */
+int crc32_start(void)
+{
+    if(1 == crc32_dma_busy()){
+        return -1;
+    }
+    CRC_RESET(&h_crc);
+    
+    return 0;
+}
+
+/**
+  * @brief  Feed bytes to the CRC started by crc32_start().
+  * @retval CRC of all bytes fed so far.
+  */
+uint32_t crc32_update(const uint8_t *buf, uint32_t len)
+{
+    return ald_crc_calculate(&h_crc, (uint8_t *)buf, len);
+}
+
+/**
+  * @brief  Feed bytes by DMA, the CPU is free until the result is written to
+  *         res. Check crc32_dma_busy() before using it.
+  * @retval 0 if started.
+  */
+int crc32_update_by_dma(const uint8_t *buf, uint16_t len, uint32_t *res)
+{
+    return (OK == ald_crc_calculate_by_dma(&h_crc, (uint8_t *)buf, res, len, CRC32_DMA_CH)) ? 0 : -1;
+}
+
+uint8_t crc32_dma_busy(void)
+{
+    return (CRC_STATE_BUSY == ald_crc_get_state(&h_crc)) ? 1 : 0;
+}
+
+/**
+  * @brief  Abort the DMA calculation, called by its owner when it gives up.
+  * @retval None
+  */
+void crc32_dma_stop(void)
+{
+    ald_crc_dma_stop(&h_crc);
+}
+
@@ -3,7 +3,29 @@
 
 #include "global.h"
 
+#define DWT_CYCLE_PER_US          48
+
+#define CRC32_DMA_CH              2         //0、1 给外部flash的SPI使用
+
 void Delay(unsigned int time);
 
+void dwt_init(void);
+
+uint32_t dwt_get_cycle(void);
+
+uint16_t crc16_calc(uint16_t crc, const uint8_t *buf, uint32_t len);
+
+void crc32_init(void);
+
+int crc32_start(void);
+
+uint32_t crc32_update(const uint8_t *buf, uint32_t len);
+
+int crc32_update_by_dma(const uint8_t *buf, uint16_t len, uint32_t *res);
+
+uint8_t crc32_dma_busy(void);
+
+void crc32_dma_stop(void);
+
 #endif
 
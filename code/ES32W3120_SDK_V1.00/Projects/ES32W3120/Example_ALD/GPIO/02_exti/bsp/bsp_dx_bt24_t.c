@@ -1,6 +1,11 @@
 #include "bsp_dx_bt24_t.h"
 #include "bsp_time.h"
 #include "bsp_system.h"
+#include "bsp_settings.h"
+
+#include "app_common.h"
+
+#include "task_common.h"
 
 /* Private Macros ------------------------------------------------------------ */
 
@@ -9,7 +14,8 @@
 /* Public Variables ---------------------------------------------------------- */
 uart_handle_t g_h_uart;
 uint8_t g_rx_buf[UART_RX_BUF_LEN] = {0};
-uint8_t g_rx_len = 0;
+uart_rx_t uart_rx;
+uart_tx_t uart_tx;
 
 /* Private Constants --------------------------------------------------------- */
 
@@ -54,6 +60,87 @@ static void uart_pin_init(void)
     return;
 }
 
+/**
+  * @brief  Start the next DMA burst from the send ring if the link is up and
+  *         nothing is being sent. Called from the send complete interrupt,
+  *         or with interrupts off.
+  * @retval None
+  */
+static void uart_tx_kick(void)
+{
+    uart_tx_t *tx = &uart_tx;
+    uint16_t len = 0;
+    
+    if((0 != tx->dma_len) || (tx->head == tx->tail)){
+        return;
+    }
+    
+    /* 模块没有连接, 发出去也到不了手机 */
+    if(0 == ald_gpio_read_pin(BLE_INT_PORT, BLE_INT_PIN)){
+        if(0 == tx->stalled){
+            tx->stalled = 1;
+            tx->stat.stall_cnt++;
+        }
+        return;
+    }
+    tx->stalled = 0;
+    
+    if(UART_TX_GAP_MS > ald_get_tick() - tx->dma_tick){
+        return;
+    }
+    
+    /* 一次只发到缓存末尾 */
+    len = (tx->head > tx->tail) ? tx->head - tx->tail : UART_TX_RING_LEN - tx->tail;
+    if(UART_TX_BURST_LEN < len){
+        len = UART_TX_BURST_LEN;
+    }
+    
+    tx->dma_len = len;
+    if(OK != ald_uart_send_by_dma(&g_h_uart, &tx->buf[tx->tail], len, UART_TX_DMA_CH)){
+        tx->dma_len = 0;
+        return;
+    }
+    tx->stat.burst_cnt++;
+}
+
+/**
+  * @brief  Set the tasks parked by uart_tx_wait() again once the ring has
+  *         the room they asked for. Called from the send complete interrupt,
+  *         or with interrupts off.
+  * @retval None
+  */
+static void uart_tx_wake(void)
+{
+    uart_tx_t *tx = &uart_tx;
+    uint8_t i = 0;
+    uint8_t j = 0;
+    
+    if((0 == tx->wait_len) || (tx->wait_len > UART_TX_RING_LEN - 1 - uart_tx_count())){
+        return;
+    }
+    
+    for(i=0; i<8; i++){
+        for(j=0; j<8; j++){
+            if(tx->wait[i] & (1 << j)){
+                set_task(i, j);
+            }
+        }
+        tx->wait[i] = 0;
+    }
+    tx->wait_len = 0;
+}
+
+/**
+  * @brief  uart_tx_kick() from the main loop.
+  * @retval None
+  */
+static void uart_tx_start(void)
+{
+    __disable_irq();
+    uart_tx_kick();
+    __enable_irq();
+}
+
 /**
   * @brief  Send message complete.
   * @param  arg: Pointer to uart_handle_t structure.
@@ -61,76 +148,195 @@ static void uart_pin_init(void)
   */
 static void uart_send_complete(uart_handle_t *arg)
 {
+    uart_tx_t *tx = &uart_tx;
+    
+    /* 初始化时的AT命令不走队列 */
+    if(0 == tx->dma_len){
+        return;
+    }
+    
+    tx->tail = (tx->tail + tx->dma_len) % UART_TX_RING_LEN;
+    tx->dma_len = 0;
+    tx->dma_tick = ald_get_tick();
+    uart_tx_wake();
+    uart_tx_kick();
+    
     return;
 }
 
 /**
-  * @brief  Receive a message complete.
+  * @brief  Set up one half of the receive ring as a ping-pong descriptor.
+  * @param  alt: 0: first half, primary descriptor. 1: second half, alternate.
+  * @param  first: 1 to start the channel.
+  * @retval None
+  */
+static void uart_rx_dma_config(uint8_t alt, uint8_t first);
+
+/**
+  * @brief  One half of the ring is full, give it back to the DMA.
+  * @retval None
+  */
+static void uart_rx_dma_cplt(void *arg)
+{
+    uart_rx_dma_config(uart_rx.half_cnt & 1, 0);
+    uart_rx.half_cnt++;
+    
+    /* ald_dma_irq_handler 每次都会关掉通道中断 */
+    SET_BIT(DMA0->IER, 1U << UART_RX_DMA_CH);
+}
+
+static void uart_rx_dma_config(uint8_t alt, uint8_t first)
+{
+    dma_config_t config;
+    
+    ald_dma_config_struct(&config);
+    config.src     = (void *)&UARTX->RXBUF;
+    config.dst     = &uart_rx.buf[alt ? UART_RX_HALF_LEN : 0];
+    config.size    = UART_RX_HALF_LEN;
+    config.src_inc = DMA_DATA_INC_NONE;
+    config.dst_inc = DMA_DATA_INC_BYTE;
+    config.primary = alt ? DISABLE : ENABLE;
+    config.burst   = ENABLE;
+    config.msel    = DMA_MSEL_UART0;
+    config.msigsel = DMA_MSIGSEL_UART_RNR;
+    config.channel = UART_RX_DMA_CH;
+    ald_dma_config_ping_pong(DMA0, &config, first, uart_rx_dma_cplt);
+}
+
+/**
+  * @brief  Number of bytes the DMA has written so far, read from the
+  *         descriptor that is running.
+  * @retval Byte count, wraps at 2^32.
+  */
+static uint32_t uart_rx_head(void)
+{
+    dma_descriptor_t *desc;
+    uint32_t half = uart_rx.half_cnt;
+    uint8_t alt = (DMA0->CHPRIALTSET >> UART_RX_DMA_CH) & 1;
+    uint16_t left = 0;
+    
+    /* 半区刚写满, 完成中断还没处理 */
+    if((half & 1) != alt){
+        half++;
+    }
+    
+    desc = (dma_descriptor_t *)(alt ? DMA0->ALTCTRLBASE : DMA0->CTRLBASE) + UART_RX_DMA_CH;
+    if(DMA_CYCLE_CTRL_NONE != desc->ctrl.cycle_ctrl){
+        left = desc->ctrl.n_minus_1 + 1;
+    }
+    
+    return half * UART_RX_HALF_LEN + UART_RX_HALF_LEN - left;
+}
+
+/**
+  * @brief  Number of received bytes not read yet. Bytes overwritten before
+  *         they were read are dropped.
+  * @retval Byte count.
+  */
+uint16_t uart_rx_count(void)
+{
+    uint32_t head = uart_rx_head();
+    
+    if(UART_RX_RING_LEN < head - uart_rx.tail){
+        uart_rx.overrun_cnt++;
+        uart_rx.tail = head;
+    }
+    
+    return head - uart_rx.tail;
+}
+
+/**
+  * @brief  Read received bytes out of the ring.
+  * @param  buf: Destination.
+  * @param  len: At most this many bytes.
+  * @retval Bytes read.
+  */
+uint16_t uart_rx_read(uint8_t *buf, uint16_t len)
+{
+    uint16_t cnt = uart_rx_count();
+    uint16_t i = 0;
+    
+    if(len > cnt){
+        len = cnt;
+    }
+    for(i=0; i<len; i++){
+        buf[i] = uart_rx.buf[(uart_rx.tail + i) % UART_RX_RING_LEN];
+    }
+    uart_rx.tail += len;
+    
+    return len;
+}
+
+/**
+  * @brief  Look at an unread byte without taking it out of the ring.
+  * @param  offset: From the oldest unread byte, below uart_rx_count().
+  * @retval The byte.
+  */
+uint8_t uart_rx_peek(uint16_t offset)
+{
+    return uart_rx.buf[(uart_rx.tail + offset) % UART_RX_RING_LEN];
+}
+
+/**
+  * @brief  Take unread bytes out of the ring without reading them.
+  * @param  len: At most uart_rx_count().
+  * @retval None
+  */
+void uart_rx_skip(uint16_t len)
+{
+    uart_rx.tail += len;
+}
+
+/**
+  * @brief  Copy the received text into g_rx_buf for the AT replies.
+  * @retval None
+  */
+static void uart_rx_line(void)
+{
+    uint16_t len = uart_rx_read(g_rx_buf, UART_RX_BUF_LEN - 1);
+    
+    g_rx_buf[len] = 0;
+}
+
+/**
+  * @brief  Receive line idle, called once per frame.
   * @param  arg: Pointer to uart_handle_t structure.
   * @retval None.
   */
 static void uart_recv_complete(uart_handle_t *arg)
 {
-//    static uint8_t s_i;
-//    uint8_t i;
-//    
-//    s_i++;
-
-//    if ((s_i > 1) && (*(g_h_uart.rx_buf - 2) == 0x0D) && (*(g_h_uart.rx_buf - 1) == 0x0A))
-//    {
-//        ald_uart_send_by_it(&g_h_uart, g_rx_buf, s_i);
-//        ES_LOG_PRINT("uart send:");
-//        for(i=0; i<s_i; i++){
-//            ES_LOG_PRINT("%x", g_rx_buf[i]);
-//        }
-//        ES_LOG_PRINT("s_i %u\n", s_i);
-//        s_i = 0;
-//        ald_uart_recv_by_it(&g_h_uart, g_rx_buf, 1);
-//        
-//    }
-//    else
-//    {
-//        if (s_i >= 20) {
-//            s_i = 0;
-//        }
-
-//        ald_uart_recv_by_it(&g_h_uart, g_rx_buf + s_i, 1);
-//    }
-
-//    return;
-
-    time_cnt.uart_timeout_cnt = 0;
-    time_flg.uart_timeout_flg = 1;
-    g_rx_len++;
-
-    if(1 == system_state.system_flg.dx_bt24_t_init_flg)
-    {
-        if (20 <= g_rx_len) {
-            g_rx_len = 0;
+    uart_rx.idle_cnt++;
+    
+    /* ALD 在超时中断里关掉了超时中断 */
+    ald_uart_interrupt_config(&g_h_uart, UART_IT_RXTO, ENABLE);
+    
+    if(0 == system_state.system_flg.dx_bt24_t_poweron_flg){
+        uart_rx_line();
+        if(NULL != strstr((const char*)g_rx_buf, "Power On")){
+            system_state.system_flg.dx_bt24_t_poweron_flg = 1;
         }
     }
+    else if(1 == system_state.system_flg.dx_bt24_t_init_flg){
+        set_task(BLUETOOTH, DATA_DECODE);
+    }
     else{
-        if (UART_RX_BUF_LEN <= g_rx_len) {
-            g_rx_len = 0;
-        }
+        uart_rx_line();
+        time_flg.at_cmd_flg = 1;
     }
-    
-    ald_uart_recv_by_it(&g_h_uart, g_rx_buf + g_rx_len, 1);
 
     return;
 }
 
-void uart_init(void)
+/**
+  * @brief  Set up UART0 at the given rate and restart the receive ring.
+  * @retval None
+  */
+static void uart_config(uint32_t baud)
 {
-    ald_mcu_irq_config(UART0_IRQn, 3, 3, ENABLE);
-
-    /* Initialize pin */
-    uart_pin_init();
-
     memset(&g_h_uart, 0x00, sizeof(uart_handle_t));
     /* Initialize uart */
     g_h_uart.perh             = UART0;
-    g_h_uart.init.baud        = 115200;
+    g_h_uart.init.baud        = baud;
     g_h_uart.init.word_length = UART_WORD_LENGTH_8B;
     g_h_uart.init.stop_bits   = UART_STOP_BITS_1;
     g_h_uart.init.parity      = UART_PARITY_NONE;
@@ -143,17 +349,103 @@ void uart_init(void)
     ald_uart_rx_fifo_config(&g_h_uart, UART_RXFIFO_1BYTE);
     ald_uart_tx_fifo_config(&g_h_uart, UART_TXFIFO_EMPTY);
 
-    g_rx_len = 0;
-    ald_uart_recv_by_it(&g_h_uart, g_rx_buf, 1);
+    /* 后半区先配好, 再从前半区开始 */
+    memset(&uart_rx, 0x00, sizeof(uart_rx_t));
+    uart_rx_dma_config(1, 0);
+    uart_rx_dma_config(0, 1);
+    ald_uart_dma_req_config(&g_h_uart, UART_DMA_REQ_RX, ENABLE);
+
+    UART_SET_TIMEOUT_VALUE(&g_h_uart, UART_RX_IDLE_BITS);
+    UART_RX_TIMEOUT_ENABLE(&g_h_uart);
+    ald_uart_interrupt_config(&g_h_uart, UART_IT_RXTO, ENABLE);
+}
+
+void uart_init(void)
+{
+    uint32_t baud = UART_BAUD_DEFAULT;
+    
+    ald_mcu_irq_config(UART0_IRQn, 3, 3, ENABLE);
+
+    /* Initialize pin */
+    uart_pin_init();
+
+    memset(&uart_tx, 0x00, sizeof(uart_tx_t));
+
+    /* 上次和模块通上的速率 */
+    settings_init();
+    if(0 != settings_get(SETTINGS_KEY_BLE_BAUD, &baud, sizeof(baud))){
+        baud = UART_BAUD_DEFAULT;
+    }
+    uart_config(baud);
     
     return;
 }
 
+uint32_t uart_get_baud(void)
+{
+    return g_h_uart.init.baud;
+}
+
+/**
+  * @brief  Send an AT command and wait for the reply in g_rx_buf.
+  * @param  cmd: Command with "\r\n".
+  * @param  reply: Text the reply must contain.
+  * @retval 0: reply received, -1: timeout or other reply.
+  */
+static int dx_bt24_t_at(const char *cmd, const char *reply)
+{
+    uint32_t tick = 0;
+    
+    g_rx_buf[0] = 0;
+    time_flg.at_cmd_flg = 0;
+    if(OK != ald_uart_send_by_it(&g_h_uart, (uint8_t *)cmd, strlen(cmd))){
+        return -1;
+    }
+    
+    tick = ald_get_tick();
+    while(1 != time_flg.at_cmd_flg){
+        if(UART_AT_TIMEOUT_MS < ald_get_tick() - tick){
+            return -1;
+        }
+    }
+    
+    return (NULL != strstr((const char*)g_rx_buf, reply)) ? 0 : -1;
+}
+
+/**
+  * @brief  The module sent no "Power On" at the saved rate: check it with AT
+  *         there, then at UART_BAUD_DEFAULT. The saved rate is only rewritten
+  *         when the module answers at the other one.
+  * @retval 0: found, the local rate is set to it; -1: no reply.
+  */
+static int dx_bt24_t_baud_find(void)
+{
+    uint32_t saved = uart_get_baud();
+    uint32_t baud = UART_BAUD_DEFAULT;
+    
+    if(0 == dx_bt24_t_at("AT\r\n", "OK")){
+        return 0;
+    }
+    if(UART_BAUD_DEFAULT != saved){
+        uart_config(baud);
+        if(0 == dx_bt24_t_at("AT\r\n", "OK")){
+            ES_LOG_PRINT("ble uart found at %u\n", baud);
+            settings_set(SETTINGS_KEY_BLE_BAUD, &baud, sizeof(baud));
+            return 0;
+        }
+        uart_config(saved);
+    }
+    
+    ES_LOG_PRINT("ble uart no reply\n");
+    
+    return -1;
+}
+
 void dx_bt24_t_init(void)
 {
     gpio_init_t x;
     exti_init_t exti;
-    char tx_buf_temp[20] = "AT+LADDR\r\n";
+    uint32_t tick = 0;
     uint8_t i = 0;
     char *p = NULL;
     uint8_t high = 0;
@@ -202,11 +494,15 @@ void dx_bt24_t_init(void)
     
     uart_init();
     
-    while(system_state.system_flg.dx_bt24_t_poweron_flg == 0);
+    /* 速率不对时收不到 "Power On", 超时后再找模块的速率 */
+    tick = ald_get_tick();
+    while((0 == system_state.system_flg.dx_bt24_t_poweron_flg) && (UART_POWERON_TIMEOUT_MS > ald_get_tick() - tick));
+    if(0 == system_state.system_flg.dx_bt24_t_poweron_flg){
+        system_state.system_flg.dx_bt24_t_poweron_flg = 1;
+        dx_bt24_t_baud_find();
+    }
     
-    time_flg.at_cmd_flg = 0;
-    ald_uart_send_by_it(&g_h_uart, (uint8_t *)tx_buf_temp, 10);
-    while(time_flg.at_cmd_flg != 1);
+    dx_bt24_t_at("AT+LADDR\r\n", "LADDR=");
     ES_LOG_PRINT("receive data: %s\n", g_rx_buf);
     
     p = strstr((const char*)g_rx_buf, "LADDR=");
@@ -244,22 +540,116 @@ void dx_bt24_t_deinit(void)
     ald_gpio_write_pin(PWR_BT_PORT, PWR_BT_PIN, 1);
 }
 
-void send_ble_data(uint8_t *tx_buf, uint8_t tx_len)
+/**
+  * @brief  Bytes waiting in the send ring, including the running burst.
+  * @retval Byte count.
+  */
+uint16_t uart_tx_count(void)
 {
-    uint8_t i = 0;
+    return (uart_tx.head + UART_TX_RING_LEN - uart_tx.tail) % UART_TX_RING_LEN;
+}
 
-    ald_uart_send_by_it(&g_h_uart, tx_buf, tx_len);
+/**
+  * @brief  Free space in the send ring. Also restarts a burst that was held
+  *         back, so a task waiting for space makes progress.
+  * @retval Byte count.
+  */
+uint16_t uart_tx_free(void)
+{
+    uart_tx_start();
+    
+    return UART_TX_RING_LEN - 1 - uart_tx_count();
+}
+
+/**
+  * @brief  Drop what is queued after a disconnect, the burst already running
+  *         is finished. Tasks waiting for room are not set again.
+  * @retval None
+  */
+void uart_tx_flush(void)
+{
+    uint16_t head = 0;
+    
+    __disable_irq();
+    head = (uart_tx.tail + uart_tx.dma_len) % UART_TX_RING_LEN;
+    uart_tx.stat.flush_cnt += (head + UART_TX_RING_LEN - uart_tx.head) % UART_TX_RING_LEN;
+    uart_tx.head = head;
+    memset(uart_tx.wait, 0, sizeof(uart_tx.wait));
+    uart_tx.wait_len = 0;
+    __enable_irq();
+}
 
-    ES_LOG_PRINT("send data: ");
-    for(i=0; i<tx_len; i++)
-    {
-        ES_LOG_PRINT("%.2x", tx_buf[i]);
+/**
+  * @brief  Clear a sub task and park it until the send ring has len bytes
+  *         free, the task then returns to the scheduler. It is set again from
+  *         the send complete interrupt or from uart_tx_idle().
+  * @retval None
+  */
+void uart_tx_wait(uint8_t main_task, uint8_t sub_task, uint16_t len)
+{
+    uart_tx_t *tx = &uart_tx;
+    
+    /* 和发送完成中断里的置起互斥, 先清再登记 */
+    __disable_irq();
+    clear_task(main_task, sub_task);
+    tx->wait[main_task] |= 1 << sub_task;
+    if(len > tx->wait_len){
+        tx->wait_len = len;
+    }
+    __enable_irq();
+}
+
+/**
+  * @brief  Called from the main loop, sends what was held back by the link
+  *         state or the burst gap, and sets the tasks waiting for room.
+  * @retval None
+  */
+void uart_tx_idle(void)
+{
+    if(uart_tx.head != uart_tx.tail){
+        uart_tx_start();
+    }
+    if(0 != uart_tx.wait_len){
+        __disable_irq();
+        uart_tx_wake();
+        __enable_irq();
+    }
+}
+
+/**
+  * @brief  Queue bytes for the BLE module and return, the DMA sends them.
+  * @retval 0: queued, -1: not enough space, nothing queued.
+  */
+int send_ble_data(uint8_t *tx_buf, uint8_t tx_len)
+{
+    uart_tx_t *tx = &uart_tx;
+    uint16_t len = 0;
+    uint16_t depth = 0;
+    
+    if(tx_len > UART_TX_RING_LEN - 1 - uart_tx_count()){
+        tx->stat.drop_cnt++;
+        ES_LOG_PRINT("ble tx full, drop %u\n", tx_len);
+        return -1;
     }
-    ES_LOG_PRINT("\n");
     
-    ald_delay_ms(100);
+    /* 分两段拷到缓存末尾和开头 */
+    len = UART_TX_RING_LEN - tx->head;
+    if(len > tx_len){
+        len = tx_len;
+    }
+    memcpy(&tx->buf[tx->head], tx_buf, len);
+    memcpy(tx->buf, tx_buf + len, tx_len - len);
+    tx->head = (tx->head + tx_len) % UART_TX_RING_LEN;
     
-    return;
+    tx->stat.byte_cnt += tx_len;
+    depth = uart_tx_count();
+    if(depth > tx->stat.depth_max){
+        tx->stat.depth_max = depth;
+    }
+    
+    uart_tx_start();
+    
+    return 0;
 }
 
 void ble_test(void)
@@ -25,15 +25,88 @@
 
 #define UART_RX_BUF_LEN           30
 
+/*
+ * 波特率: 模块出厂为 UART_BAUD_DEFAULT. 启动时用设置里保存的速率, 收到 "Power On"
+ * 就不再检查; 超时没收到时在保存的速率和默认速率上各发一次 AT, 通了才改保存的速率.
+ * 提高速率要先在模块固件上核对 AT+BAUD 的参数, 现在不协商.
+ */
+#define UART_BAUD_DEFAULT         115200
+#define UART_AT_TIMEOUT_MS        100       //等一条AT回复
+#define UART_POWERON_TIMEOUT_MS   1000      //等模块上电的 "Power On"
+
+/* 接收: DMA乒乓模式循环写入环形缓存, 接收线空闲时进中断, 一帧一次中断 */
+#define UART_RX_DMA_CH            3         //0、1 给外部flash的SPI, 2 给CRC
+#define UART_RX_RING_LEN          128
+#define UART_RX_HALF_LEN          (UART_RX_RING_LEN / 2)
+#define UART_RX_IDLE_BITS         40        //空闲约4个字节时间算一帧结束
+
+typedef struct {
+    uint8_t buf[UART_RX_RING_LEN];
+    volatile uint32_t half_cnt;                 //DMA写满的半区数
+    uint32_t tail;                              //已读出的字节数
+    uint32_t idle_cnt;                          //空闲中断次数
+    uint32_t overrun_cnt;                       //没读出就被DMA覆盖的次数
+    
+}uart_rx_t;
+
+/* 发送: 数据先进环形缓存, 由DMA在后台发出, 模块的连接状态线(BLE_INT)为低时暂停 */
+#define UART_TX_DMA_CH            4
+#define UART_TX_RING_LEN          512
+#define UART_TX_BURST_LEN         200       //一次DMA最多发送的长度
+#define UART_TX_GAP_MS            0         //两次DMA之间的最小间隔, 模块来不及转发时调大
+
+typedef struct {
+    uint32_t byte_cnt;                          //进入队列的字节数
+    uint32_t burst_cnt;                         //DMA发送次数
+    uint16_t drop_cnt;                          //队列满丢弃的次数
+    uint16_t stall_cnt;                         //有数据但连接断开的次数
+    uint16_t flush_cnt;                         //断开连接时清掉的字节数
+    uint16_t depth_max;                         //最大排队字节数
+    
+}uart_tx_stat_t;
+
+typedef struct {
+    uint8_t buf[UART_TX_RING_LEN];
+    uint16_t head;                              //写入位置
+    volatile uint16_t tail;                     //发送位置, 发送完成中断里更新
+    volatile uint16_t dma_len;                  //正在发送的长度, 0: 空闲
+    uint32_t dma_tick;                          //上次发送完成的时间
+    uint8_t stalled;
+    uint8_t wait[8];                            //等队列空间的子任务, 按主任务分组, 同 ga_Subtask
+    uint16_t wait_len;                          //等待的空间, 取最大的一个, 0: 没有
+    uart_tx_stat_t stat;
+    
+}uart_tx_t;
+
 void uart_init(void);
 
+uint32_t uart_get_baud(void);
+
+uint16_t uart_rx_count(void);
+
+uint16_t uart_rx_read(uint8_t *buf, uint16_t len);
+
+uint8_t uart_rx_peek(uint16_t offset);
+
+void uart_rx_skip(uint16_t len);
+
 void dx_bt24_t_init(void);
 
 void dx_bt24_t_quick_init(void);
 
 void dx_bt24_t_deinit(void);
 
-void send_ble_data(uint8_t *tx_buf, uint8_t tx_len);
+int send_ble_data(uint8_t *tx_buf, uint8_t tx_len);
+
+uint16_t uart_tx_count(void);
+
+uint16_t uart_tx_free(void);
+
+void uart_tx_flush(void);
+
+void uart_tx_wait(uint8_t main_task, uint8_t sub_task, uint16_t len);
+
+void uart_tx_idle(void);
 
 void ble_test(void);
 #endif
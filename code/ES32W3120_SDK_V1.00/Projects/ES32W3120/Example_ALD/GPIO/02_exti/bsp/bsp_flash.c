@@ -2,6 +2,12 @@
 #include "bsp_system.h"
 #include "bsp_time.h"
 #include "bsp_dx_bt24_t.h"
+#include "bsp_settings.h"
+
+#include "app_common.h"
+#include "app_frame.h"
+
+#include "task_common.h"
 
 #define FLASH_CS_SET() (ald_gpio_write_pin(GPIOB, GPIO_PIN_13, 1))
 #define FLASH_CS_CLR() (ald_gpio_write_pin(GPIOB, GPIO_PIN_13, 0))
@@ -10,9 +16,15 @@
 #define FLASH_WRITE_DISABLE 0x04
 #define FLASH_ERASE         0x20
 #define FLASH_PROGRAM       0x02
-#define FLASH_READ          0x03
+#define FLASH_READ_DATA     0x03
+#define FLASH_FAST_READ     0x0B
 #define FLASH_ID            0x9F
 #define FLASH_STATUS        0x05
+#define FLASH_DEEP_POWER_DOWN   0xB9
+#define FLASH_RELEASE_DPD       0xAB
+
+#define FLASH_STATUS_WIP    0x01
+#define FLASH_STATUS_WEL    0x02
 
 #define FLASH_PAGE_SIZE     (256)
 
@@ -25,20 +37,102 @@
 /* Public Variables ---------------------------------------------------------- */
 static spi_handle_t s_gs_spi;
 uint8_t g_flash_id[4] = {0};
-uint8_t accelerometer_data_temp[FLASH_WRITE_BUFF_LEN] = {0};
+uint8_t *accelerometer_data_temp[2] = {NULL, NULL};     //乒乓缓存, 一个写flash时另一个继续存数据, 从内存池租用
 static uint8_t save_pack_temp = 0;
-uint8_t accelerometer_data_send_temp[FLASH_READ_BUFF_LEN] = {0};
+static uint8_t save_buf_fill = 0;
+static uint8_t save_buf_full[2] = {0};
+flash_writer_t flash_writer = {0};
+flash_reserve_t flash_reserve = {0};
+flash_range_t flash_range = {0};
+static uint32_t save_buf_time[2] = {0};
+#if SAVE_CODEC_EN
+static codec_block_t save_block = {0};
+static uint8_t save_block_period = 0;
+#endif
+uint8_t *accelerometer_data_send_temp = NULL;           //上传读缓存, 一轮上传期间从内存池租用
 uint8_t send_page_temp = 0;
+static uint8_t send_page_bad = 0;
+flash_stat_t flash_stat = {0};
+flash_power_t flash_power = {FLASH_POWER_OFF, 0, 0};
+static uint32_t flash_jedec_id = 0;
+static uint8_t flash_read_cmd = FLASH_READ_DATA;
+#if FLASH_FAST_READ_EN
+static spi_baud_t flash_read_baud = FLASH_SPI_BAUD_FAST;
+#else
+static spi_baud_t flash_read_baud = FLASH_SPI_BAUD_NORMAL;
+#endif
+flash_wear_t flash_wear = {0};
+flash_calib_t flash_calib = {0};
+static const uint16_t flash_hist_ms[FLASH_HIST_LEN - 1] = {1, 2, 3, 4, 5, 6, 8, 10, 15, 20, 30, 40, 50, 60, 80};     //区间上限, 最后一个区间不限
+#if FLASH_DMA_EN
+static volatile uint8_t flash_dma_state = FLASH_DMA_DONE;
+#endif
 
 /* Private Constants --------------------------------------------------------- */
 
 /* Private function prototypes ----------------------------------------------- */
+static void flash_power_idle(void);
+static void flash_dma_sync(void);
 
 /* Private Function ---------------------------------------------------------- */
 
 /* Exported Variables -------------------------------------------------------- */
 extern system_state_t system_state;
 extern utc_time_t utc_time;
+extern uint8_t mpu6050_timeout;
+extern settings_stat_t settings_stat;
+
+static void flash_stat_add(flash_latency_t *latency, uint32_t cycles)
+{
+    uint32_t us = cycles / DWT_CYCLE_PER_US;
+    
+    latency->cnt++;
+    latency->us_last = us;
+    latency->us_sum += us;
+    if(us > latency->us_max){
+        latency->us_max = us;
+    }
+}
+
+static void flash_hist_add(uint32_t us)
+{
+    uint8_t i = 0;
+    
+    while((FLASH_HIST_LEN - 1 > i) && (us > (uint32_t)flash_hist_ms[i] * 1000)){
+        i++;
+    }
+    if(0xffff > flash_stat.flush_hist[i]){
+        flash_stat.flush_hist[i]++;
+    }
+}
+
+/**
+  * @brief  Flush latency percentile from the histogram.
+  * @param  pct: 1~100.
+  * @retval Upper bound of the bucket in ms, 255 for the last bucket.
+  */
+static uint8_t flash_hist_percentile(uint8_t pct)
+{
+    uint32_t total = 0;
+    uint32_t sum = 0;
+    uint8_t i = 0;
+    
+    for(i=0; i<FLASH_HIST_LEN; i++){
+        total += flash_stat.flush_hist[i];
+    }
+    if(0 == total){
+        return 0;
+    }
+    
+    for(i=0; i<FLASH_HIST_LEN - 1; i++){
+        sum += flash_stat.flush_hist[i];
+        if(sum * 100 >= total * pct){
+            return flash_hist_ms[i];
+        }
+    }
+    
+    return 255;
+}
 
 /**
   * @brief  Initializate spi flash pin
@@ -81,17 +175,13 @@ static uint32_t flash_read_id(void)
     uint8_t i;
     int r_flag = 0;
 
-    g_flash_id[0] = FLASH_ID;
-
     FLASH_CS_CLR(); /* 片选拉低，选中Flash */
 
-    for (i = 0; i < sizeof(g_flash_id); i++)
+    /* 只发命令字节, 紧接着的3个字节就是ID */
+    if (ald_spi_send_byte_fast(&s_gs_spi, FLASH_ID) != OK)
     {
-        if (ald_spi_send_byte_fast(&s_gs_spi, g_flash_id[i]) != OK)
-        {
-            FLASH_CS_SET();     /* 片选拉高，释放Flash */
-            return ERROR;
-        }
+        FLASH_CS_SET();     /* 片选拉高，释放Flash */
+        return ERROR;
     }
 
     for (i = 0; i < 3; i++)
@@ -111,14 +201,16 @@ static uint32_t flash_read_id(void)
 }
 
 /**
-  * @brief  wait until flash unbusy.
+  * @brief  Read the status register.
+  * @param  status: Output value, bit0 WIP, bit1 WEL.
   * @retval Status, see @ref ald_status_t.
   */
-static ald_status_t flash_wait_unbusy(void)
+static ald_status_t flash_read_status(uint8_t *status)
 {
-    uint8_t status;
     int r_flag = 0;
 
+    flash_dma_sync();   /* 每条命令先读状态, 后台写页的DMA在这里收尾 */
+
     FLASH_CS_CLR(); /* 片选拉低，选中Flash */
 
     if (ald_spi_send_byte_fast(&s_gs_spi, (uint8_t)FLASH_STATUS) != OK)   /* 发送读状态命令 */
@@ -127,43 +219,46 @@ static ald_status_t flash_wait_unbusy(void)
         return ERROR;
     }
 
-    do
-    {
-        status = ald_spi_recv_byte_fast(&s_gs_spi, &r_flag);
-
-        if (r_flag != OK)
-        {
-            FLASH_CS_SET();
-            return ERROR;
-        }
-    }
-    while (status & 0x01);
+    *status = ald_spi_recv_byte_fast(&s_gs_spi, &r_flag);
 
     FLASH_CS_SET();
 
+    if (r_flag != OK)
+        return ERROR;
+
     return OK;
 }
 
-static ald_status_t flash_wait_busy_timeout(uint8_t milliseconds)
+/**
+  * @brief  Poll WIP until the flash is ready or the timeout expires.
+  * @param  milliseconds: Timeout, use the datasheet max of the last operation.
+  * @retval Status, see @ref ald_status_t.
+  */
+static ald_status_t flash_wait_busy_timeout(uint32_t milliseconds)
 {
-    uint8_t count = milliseconds;
+    uint8_t status = 0;
+    uint32_t tick = ald_get_tick();
 
-    for (; count > 0; count--)
+    while (1)
     {
-        if (OK == flash_wait_unbusy())
-            break;
-
-        ald_delay_ms(1);
-    }
+        if (OK != flash_read_status(&status))
+            return ERROR;
 
-    if (count == 0)
-        return ERROR;
+        if (0 == (status & FLASH_STATUS_WIP))
+            return OK;
 
-    return OK;
+        if ((ald_get_tick() - tick) > milliseconds)
+        {
+            flash_stat.timeout_cnt++;
+            return TIMEOUT;
+        }
+    }
 }
 
 static ald_status_t flash_write_enable(void)
 {
+    uint8_t status = 0;
+
     FLASH_CS_CLR(); /* 片选拉低，选中Flash */
 
     if (OK != ald_spi_send_byte_fast(&s_gs_spi, FLASH_WRITE_ENABLE)){
@@ -173,6 +268,14 @@ static ald_status_t flash_write_enable(void)
 
     FLASH_CS_SET();      /* 片选拉高，释放Flash */
 
+    /* 确认WEL已置位 */
+    if (OK != flash_read_status(&status)){
+        return ERROR;
+    }
+    if (0 == (status & FLASH_STATUS_WEL)){
+        return ERROR;
+    }
+
     return OK;
 }
 
@@ -190,21 +293,166 @@ static ald_status_t flash_write_disable(void)
     return OK;
 }
 
+#if FLASH_DPD_EN
+static ald_status_t flash_send_cmd(uint8_t cmd)
+{
+    FLASH_CS_CLR(); /* 片选拉低，选中Flash */
+
+    if (OK != ald_spi_send_byte_fast(&s_gs_spi, cmd)){
+        FLASH_CS_SET();      /* 片选拉高，释放Flash */
+        return ERROR;
+    }
+
+    FLASH_CS_SET();      /* 片选拉高，释放Flash */
+
+    return OK;
+}
+
+static void flash_delay_us(uint32_t us)
+{
+    uint32_t start = dwt_get_cycle();
+
+    while ((dwt_get_cycle() - start) < (us * DWT_CYCLE_PER_US))
+    {
+    }
+}
+
 /**
-  * @brief  transmit an amount of data in blocking mode.
+  * @brief  Enter deep power-down, the flash then ignores every command
+  *         except release (0xAB).
+  * @retval Status, see @ref ald_status_t.
+  */
+static ald_status_t flash_dpd_enter(void)
+{
+    if (OK != flash_wait_busy_timeout(FLASH_BUSY_TIMEOUT))
+        return ERROR;
+
+    return flash_send_cmd(FLASH_DEEP_POWER_DOWN);
+}
+
+/**
+  * @brief  Release from deep power-down, wait tRES1 and check the JEDEC id:
+  *         a flash still in deep power-down does not drive MISO.
+  * @retval Status, see @ref ald_status_t.
+  */
+static ald_status_t flash_dpd_exit(void)
+{
+    if (OK != flash_send_cmd(FLASH_RELEASE_DPD))
+        return ERROR;
+
+    flash_delay_us(FLASH_TRES1_US);
+
+    if ((0 == flash_jedec_id) || (flash_jedec_id != flash_read_id()))
+        return ERROR;
+
+    return OK;
+}
+#endif
+
+#if FLASH_DMA_EN
+static void flash_dma_cplt(spi_handle_t *arg)
+{
+    flash_dma_state = FLASH_DMA_DONE;
+}
+
+static void flash_dma_err(spi_handle_t *arg)
+{
+    flash_dma_state = FLASH_DMA_FAIL;
+}
+
+/**
+  * @brief  Check the transfer once, stop it when it takes longer than
+  *         FLASH_DMA_TIMEOUT. CS is left as it is.
+  * @param  tick: ald_get_tick() when the transfer was started.
+  * @retval BUSY while running, see @ref ald_status_t.
+  */
+static ald_status_t flash_dma_check(uint32_t tick)
+{
+    if (FLASH_DMA_BUSY == flash_dma_state)
+    {
+        if ((ald_get_tick() - tick) <= FLASH_DMA_TIMEOUT)
+            return BUSY;
+
+        ald_spi_dma_stop(&s_gs_spi);    /* 关闭DMA请求, 句柄状态由ALD恢复 */
+        flash_stat.timeout_cnt++;
+        return TIMEOUT;
+    }
+
+    return (FLASH_DMA_DONE == flash_dma_state) ? OK : ERROR;
+}
+
+/**
+  * @brief  Wait for the DMA completion callback, used by reads and by the
+  *         blocking program path.
+  * @retval Status, see @ref ald_status_t.
+  */
+static ald_status_t flash_dma_wait(void)
+{
+    uint32_t tick = ald_get_tick();
+    ald_status_t status;
+
+    do
+    {
+        status = flash_dma_check(tick);
+    }
+    while (BUSY == status);
+
+    return status;
+}
+
+/**
+  * @brief  Start clocking size bytes out of buf by DMA and return, CS must
+  *         already be low and stays low until the transfer is checked.
+  * @retval Status, see @ref ald_status_t.
+  */
+static ald_status_t flash_dma_send_start(uint8_t *buf, uint16_t size)
+{
+    flash_dma_state = FLASH_DMA_BUSY;
+    if (OK != ald_spi_send_by_dma(&s_gs_spi, buf, size, FLASH_DMA_TX_CH))
+        return ERROR;
+
+    return OK;
+}
+
+/**
+  * @brief  Clock size bytes out of buf by DMA, CS must already be low.
+  * @retval Status, see @ref ald_status_t.
+  */
+static ald_status_t flash_dma_send(uint8_t *buf, uint16_t size)
+{
+    if (OK != flash_dma_send_start(buf, size))
+        return ERROR;
+
+    return flash_dma_wait();
+}
+
+/**
+  * @brief  Clock size bytes into buf by DMA, CS must already be low.
+  *         2-line master can not receive alone, buf is also the tx source:
+  *         tx is always ahead of rx, and the flash ignores MOSI while reading.
+  * @retval Status, see @ref ald_status_t.
+  */
+static ald_status_t flash_dma_recv(uint8_t *buf, uint16_t size)
+{
+    flash_dma_state = FLASH_DMA_BUSY;
+    if (OK != ald_spi_send_recv_by_dma(&s_gs_spi, buf, buf, size, FLASH_DMA_TX_CH, FLASH_DMA_RX_CH))
+        return ERROR;
+
+    return flash_dma_wait();
+}
+#endif
+
+/**
+  * @brief  Wait for the flash, set WEL and send the page program command
+  *         with the address. On success CS is left low for the data.
   * @param  addr: Specific address which to be write.
-  * @param  buf: Pointer to data buffer
-  * @param  size: Amount of data to be sent
   * @retval Status, see @ref ald_status_t.
   */
-static ald_status_t flash_page_program(uint32_t addr, char *buf, uint16_t size)
+static ald_status_t flash_page_program_cmd(uint32_t addr)
 {
     uint8_t cmd_buf[4];
     uint16_t i = 0U;
 
-    if (buf == NULL)
-        return ERROR;
-
     if(flash_wait_busy_timeout(FLASH_BUSY_TIMEOUT)){
         return BUSY;
     }
@@ -218,7 +466,6 @@ static ald_status_t flash_page_program(uint32_t addr, char *buf, uint16_t size)
     cmd_buf[2] = (addr >> 8) & 0xff;
     cmd_buf[3] = addr & 0xff;
 
-    ald_delay_ms(100);
     FLASH_CS_CLR();
 
     for (i = 0; i < sizeof(cmd_buf); i++)     /* 发送编程指令和3个字节Flash地址 */
@@ -230,6 +477,43 @@ static ald_status_t flash_page_program(uint32_t addr, char *buf, uint16_t size)
         }
     }
 
+    return OK;
+}
+
+/**
+  * @brief  Send a page program command, does not wait for WIP.
+  * @param  addr: Specific address which to be write.
+  * @param  buf: Pointer to data buffer
+  * @param  size: Amount of data to be sent
+  * @retval Status, see @ref ald_status_t.
+  */
+static ald_status_t flash_page_program_start(uint32_t addr, char *buf, uint16_t size)
+{
+    ald_status_t status;
+    uint16_t i = 0U;
+
+    if (buf == NULL)
+        return ERROR;
+
+    status = flash_page_program_cmd(addr);
+    if (OK != status)
+        return status;
+
+#if FLASH_DMA_EN
+    if (size >= FLASH_DMA_MIN_LEN)
+    {
+        if (OK != flash_dma_send((uint8_t *)buf, size))
+        {
+            FLASH_CS_SET();
+            return ERROR;
+        }
+        FLASH_CS_SET();
+        flash_stat.program_bytes += size;
+
+        return OK;
+    }
+#endif
+
     for (i = 0; i < size; i++)  /* 待写数据发送到Flash */
     {
         if (ald_spi_send_byte_fast(&s_gs_spi, buf[i]) != OK)
@@ -240,6 +524,47 @@ static ald_status_t flash_page_program(uint32_t addr, char *buf, uint16_t size)
     }
 
     FLASH_CS_SET();
+    flash_stat.program_bytes += size;
+
+    return OK;
+}
+
+#if FLASH_DMA_EN
+/**
+  * @brief  Send a page program command and start the data by DMA, returns
+  *         without waiting. CS stays low until the background writer sees
+  *         the transfer done, see FLASH_WRITER_DMA_WAIT.
+  * @retval Status, see @ref ald_status_t.
+  */
+static ald_status_t flash_page_program_dma(uint32_t addr, char *buf, uint16_t size)
+{
+    ald_status_t status = flash_page_program_cmd(addr);
+
+    if (OK != status)
+        return status;
+
+    if (OK != flash_dma_send_start((uint8_t *)buf, size))
+    {
+        FLASH_CS_SET();
+        return ERROR;
+    }
+    flash_stat.program_bytes += size;
+
+    return OK;
+}
+#endif
+
+/**
+  * @brief  Program one 256 byte page and wait until done.
+  * @retval Status, see @ref ald_status_t.
+  */
+static ald_status_t flash_page_program(uint32_t addr, char *buf, uint16_t size)
+{
+    if ((OK != flash_page_program_start(addr, buf, size)) || (OK != flash_wait_busy_timeout(FLASH_TPP_TIMEOUT)))
+    {
+        flash_wear.program_fail++;
+        return ERROR;
+    }
 
     return OK;
 }
@@ -252,7 +577,7 @@ static void spi_init(void)
 
     s_gs_spi.perh           = SPI0;               /* 使用SPI0 */
     s_gs_spi.init.mode      = SPI_MODE_MASTER;    /* SPI主机模式 */
-    s_gs_spi.init.baud      = SPI_BAUD_4;         /* 时钟48MHz/4=12MHz */
+    s_gs_spi.init.baud      = FLASH_SPI_BAUD_NORMAL;  /* 读数据时在 flash_read_mode 里切换 */
     s_gs_spi.init.data_size = SPI_DATA_SIZE_8;    /* 8位模式 */
     s_gs_spi.init.polarity  = SPI_CPOL_HIGH;      /* 空闲高电平 */
     s_gs_spi.init.phase     = SPI_CPHA_SECOND;    /* 第二个边沿接收数据 */
@@ -262,8 +587,14 @@ static void spi_init(void)
     s_gs_spi.init.crc_calc  = DISABLE;
 
     ald_spi_init(&s_gs_spi);   /* 按照参数初始化SPI外设 */
+#if FLASH_DMA_EN
+    s_gs_spi.tx_cplt_cbk    = flash_dma_cplt;
+    s_gs_spi.tx_rx_cplt_cbk = flash_dma_cplt;
+    s_gs_spi.err_cbk        = flash_dma_err;
+#endif
     
     id = flash_read_id();
+    flash_jedec_id = id;
     ES_LOG_PRINT("Manufacturer ID is %02x & Device ID is %02x %02x\n", (uint8_t)(id >> 16), (uint8_t)(id >> 8), (uint8_t)id);
     
     return;
@@ -278,37 +609,38 @@ static void spi_init(void)
   */
 ald_status_t flash_write_data(uint32_t addr, char *buf, uint16_t size)
 {
-    
-    uint16_t count = size / FLASH_PAGE_SIZE;
-    uint16_t left = size % FLASH_PAGE_SIZE;
-    uint8_t i = 0;
+    uint16_t len = 0;
 
     if (size == 0){
         return ERROR;
     }
 
-    for (i = 0; i < count; i++){
-        if (OK != flash_page_program(addr + i * FLASH_PAGE_SIZE, buf + i * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE)){
-            return ERROR;
-        }
-    }
-
-    if (left)
+    /* 按256字节编程页边界拆分, 地址不必对齐 */
+    while (size)
     {
-        if (OK != flash_page_program(addr + i * FLASH_PAGE_SIZE, buf + i * FLASH_PAGE_SIZE, left)){
+        len = FLASH_PAGE_SIZE - (addr % FLASH_PAGE_SIZE);
+        if (len > size){
+            len = size;
+        }
+        
+        if (OK != flash_page_program(addr, buf, len)){
             return ERROR;
         }
+        
+        addr += len;
+        buf += len;
+        size -= len;
     }
 
     return OK;
 }
 
 /**
-  * @brief  flash sector erase function
+  * @brief  Send a sector erase command, does not wait for WIP.
   * @param  addr: Specific address which sector to be erase.
   * @retval Status.
   */
-ald_status_t flash_sector_erase(uint32_t addr)
+static ald_status_t flash_sector_erase_start(uint32_t addr)
 {
     uint8_t cmd_buf[4];
     uint8_t i = 0U;
@@ -326,7 +658,6 @@ ald_status_t flash_sector_erase(uint32_t addr)
     cmd_buf[2] = (addr >> 8) & 0xff;
     cmd_buf[3] = addr & 0xff;
 
-    ald_delay_ms(100);
     FLASH_CS_CLR();
 
     for (i = 0; i < sizeof(cmd_buf); i++)     /* 发送扇区擦除指令和3个字节的Flash地址 */
@@ -340,20 +671,69 @@ ald_status_t flash_sector_erase(uint32_t addr)
 
     FLASH_CS_SET();
 
+    if (addr < FLASH_DATA_START * FLASH_PAGE_LEN)
+        flash_wear.ack_erase++;
+    else if (addr >= FLASH_CALIB_START * FLASH_PAGE_LEN)
+        flash_wear.calib_erase++;
+    else
+        flash_wear.data_erase++;
+
     return OK;
 }
 
 /**
-  * @brief  Receive an amount of data in blocking mode.
+  * @brief  flash sector erase function
+  * @param  addr: Specific address which sector to be erase.
+  * @retval Status.
+  */
+ald_status_t flash_sector_erase(uint32_t addr)
+{
+    uint32_t start = dwt_get_cycle();
+    ald_status_t status;
+
+    status = flash_sector_erase_start(addr);
+    if (OK != status)
+    {
+        flash_wear.erase_fail++;
+        return status;
+    }
+
+    status = flash_wait_busy_timeout(FLASH_TSE_TIMEOUT);
+    flash_stat_add(&flash_stat.erase, dwt_get_cycle() - start);
+    if (OK != status)
+        flash_wear.erase_fail++;
+
+    return status;
+}
+
+/**
+  * @brief  Release the flash after a read and go back to the clock of the
+  *         other commands.
+  * @retval status, passed through.
+  */
+static ald_status_t flash_read_end(ald_status_t status)
+{
+    FLASH_CS_SET();     /* 片选拉高，释放Flash */
+
+    if (FLASH_SPI_BAUD_NORMAL != flash_read_baud)
+        ald_spi_speed_config(&s_gs_spi, FLASH_SPI_BAUD_NORMAL);
+
+    return status;
+}
+
+/**
+  * @brief  Receive an amount of data in blocking mode, at flash_read_baud.
   * @param  addr: address of flash where want to read.
   * @param  buf: Pointer to data buffer
   * @param  size: Amount of data to be received
+  * @param  dma: 1 to move the payload by DMA.
   * @retval Status, see @ref ald_status_t.
   */
-ald_status_t flash_read(uint32_t addr, char *buf, uint16_t size)
+static ald_status_t flash_read_mode(uint32_t addr, char *buf, uint16_t size, uint8_t dma)
 {
-    uint8_t cmd_buf[4];
-    uint8_t i = 0U;
+    uint8_t cmd_buf[5];
+    uint8_t cmd_len = 4;
+    uint16_t i = 0U;
     int r_flag = 0;
 
     if (buf == NULL)
@@ -363,56 +743,1576 @@ ald_status_t flash_read(uint32_t addr, char *buf, uint16_t size)
         return BUSY;
     }
     
-    cmd_buf[0] = FLASH_READ;
+    cmd_buf[0] = flash_read_cmd;
     cmd_buf[1] = (addr >> 16) & 0xff;
     cmd_buf[2] = (addr >> 8) & 0xff;
     cmd_buf[3] = addr & 0xff;
+    cmd_buf[4] = 0xff;
+    if (FLASH_FAST_READ == flash_read_cmd)
+        cmd_len = 5;    /* 快速读地址后有1个空字节 */
+
+    if (FLASH_SPI_BAUD_NORMAL != flash_read_baud)
+        ald_spi_speed_config(&s_gs_spi, flash_read_baud);  /* 总线空闲, 只有读数据用高速时钟 */
 
-    FLASH_CS_CLR();     /* ????,??Flash */
+    FLASH_CS_CLR();     /* 片选拉低，选中Flash */
 
-    for (i = 0; i < sizeof(cmd_buf); i++)   /* ????????????Flash?? */
+    for (i = 0; i < cmd_len; i++)   /* 发送读指令和3个字节Flash地址 */
     {
         if (ald_spi_send_byte_fast(&s_gs_spi, cmd_buf[i]) != OK)
-        {
-            FLASH_CS_SET();     /* ????,??Flash */
-            return ERROR;
-        }
+            return flash_read_end(ERROR);
     }
 
-    for (i = 0; i < size; i++)  /* ????????????Flash?? */
+#if FLASH_DMA_EN
+    if (dma)
+        return flash_read_end(flash_dma_recv((uint8_t *)buf, size));
+#endif
+
+    for (i = 0; i < size; i++)  /* 读取数据 */
     {
         buf[i] = ald_spi_recv_byte_fast(&s_gs_spi, &r_flag);
 
         if (r_flag != OK)
-        {
-            FLASH_CS_SET();
-            return ERROR;
+            return flash_read_end(ERROR);
+    }
+
+    return flash_read_end(OK);
+}
+
+ald_status_t flash_read(uint32_t addr, char *buf, uint16_t size)
+{
+    return flash_read_mode(addr, buf, size, (FLASH_DMA_EN && (size >= FLASH_DMA_MIN_LEN)) ? 1 : 0);
+}
+
+static uint16_t flash_next_page(uint16_t page)
+{
+    if(FLASH_DATA_END <= page){
+        return FLASH_DATA_START;
+    }
+    
+    return page + 1;
+}
+
+/**
+  * @brief  First page of the sector after the one holding page.
+  */
+static uint16_t flash_next_sector(uint16_t page)
+{
+    page = page - (page % FLASH_PAGE_PER_SECTOR) + FLASH_PAGE_PER_SECTOR;
+    if(FLASH_DATA_END < page){
+        return FLASH_DATA_START;
+    }
+    
+    return page;
+}
+
+/**
+  * @brief  Move the read cursor out of a sector that is about to be erased.
+  *         send == current means the ring is empty, see flash_current_next().
+  * @param  page: First page of the sector.
+  * @retval None
+  */
+static void flash_send_skip(uint16_t page)
+{
+    flash_data_t *flash_data = &system_state.flash_data;
+    
+    /* 擦除的扇区里还有未上传的数据, 读游标移到下一个扇区 */
+    if((flash_data->flash_data_send_page != flash_data->flash_data_current_page) && (flash_data->flash_data_send_page >= page) && (flash_data->flash_data_send_page < page + FLASH_PAGE_PER_SECTOR)){
+        flash_data->flash_data_send_page = flash_next_sector(page);
+    }
+}
+
+/**
+  * @brief  Move the write cursor past a written or failed page. The ring is
+  *         full when the writer laps onto the read cursor: that sector is
+  *         erased by the next append, so the read cursor moves out of it
+  *         now and send == current keeps meaning empty.
+  * @param  page: The page just written.
+  * @retval None
+  */
+static void flash_current_next(uint16_t page)
+{
+    flash_data_t *flash_data = &system_state.flash_data;
+    
+    flash_data->flash_data_current_page = flash_next_page(page);
+    if(flash_data->flash_data_current_page == flash_data->flash_data_send_page){
+        flash_data->flash_data_send_page = flash_next_sector(flash_data->flash_data_send_page);
+        ES_LOG_PRINT("flash log full, send page:%u\n", flash_data->flash_data_send_page);
+    }
+}
+
+/**
+  * @brief  Take the CRC unit for a blocking calculation. The writer's payload
+  *         CRC may still run by DMA, it is never reset: wait for it to end.
+  * @retval 0 if started, -1 when the unit stays busy for FLASH_CRC_TIMEOUT.
+  */
+static int flash_crc_start(void)
+{
+    uint32_t tick = ald_get_tick();
+    
+    while(0 != crc32_start()){
+        if((ald_get_tick() - tick) > FLASH_CRC_TIMEOUT){
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+  * @brief  Read a page header and check it against the payload CRC.
+  * @param  page: Page index.
+  * @param  magic: FLASH_PAGE_MAGIC or FLASH_CALIB_MAGIC.
+  * @param  head: Output header.
+  * @retval 0 if the page is complete, -1 if erased, torn or corrupt.
+  */
+static int flash_page_verify(uint16_t page, uint16_t magic, flash_page_head_t *head)
+{
+    uint8_t buf[FLASH_READ_BUFF_LEN];
+    uint32_t addr = (uint32_t)page * FLASH_PAGE_LEN;
+    uint32_t crc = 0;
+    uint16_t len = 0;
+    uint16_t left = 0;
+    
+    if(OK != flash_read(addr, (char *)head, FLASH_PAGE_HEAD_LEN)){
+        return -1;
+    }
+    if((magic != head->magic) || (FLASH_PAGE_LEN - FLASH_PAGE_HEAD_LEN < head->len)){
+        return -1;
+    }
+    
+    if(0 != flash_crc_start()){
+        return -1;
+    }
+    crc = crc32_update((uint8_t *)&head->len, FLASH_PAGE_CRC_HEAD_LEN);
+    addr += FLASH_PAGE_HEAD_LEN;
+    left = head->len;
+    while(left){
+        len = (FLASH_READ_BUFF_LEN < left) ? FLASH_READ_BUFF_LEN : left;
+        if(OK != flash_read(addr, (char *)buf, len)){
+            return -1;
+        }
+        crc = crc32_update(buf, len);
+        addr += len;
+        left -= len;
+    }
+    
+    return (crc == head->crc) ? 0 : -1;
+}
+
+static int flash_page_check(uint16_t page, flash_page_head_t *head)
+{
+    return flash_page_verify(page, FLASH_PAGE_MAGIC, head);
+}
+
+/**
+  * @brief  Check that the start of a page is still erased.
+  * @retval 1 if blank.
+  */
+static uint8_t flash_page_blank(uint16_t page)
+{
+    uint8_t buf[FLASH_PAGE_HEAD_LEN + 16];
+    uint8_t i = 0;
+    
+    if(OK != flash_read((uint32_t)page * FLASH_PAGE_LEN, (char *)buf, sizeof(buf))){
+        return 0;
+    }
+    for(i=0; i<sizeof(buf); i++){
+        if(0xff != buf[i]){
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+/**
+  * @brief  Check that the page and the rest of its sector are still blank.
+  * @retval 1 if blank, also when page is the first of a sector.
+  */
+static uint8_t flash_sector_tail_blank(uint16_t page)
+{
+    if(0 == (page % FLASH_PAGE_PER_SECTOR)){
+        return 1;
+    }
+    
+    do{
+        if(0 == flash_page_blank(page)){
+            return 0;
+        }
+        page++;
+    }while(0 != (page % FLASH_PAGE_PER_SECTOR));
+    
+    return 1;
+}
+
+/**
+  * @brief  Page buffer of the log, leased from the pool on first use.
+  * @param  buf: 0 or 1.
+  * @retval NULL if the pool has no free block.
+  */
+static uint8_t *flash_log_buf(uint8_t buf)
+{
+    if(NULL == accelerometer_data_temp[buf]){
+        accelerometer_data_temp[buf] = pool_alloc(POOL_ARENA_LOG, FLASH_WRITE_BUFF_LEN);
+    }
+    
+    return accelerometer_data_temp[buf];
+}
+
+/**
+  * @brief  Start the next queued page: erase ahead on sector start, then
+  *         program the payload and last the header that makes it valid.
+  *         The writer stays idle while the CRC unit is busy, the next step
+  *         tries again.
+  * @retval None
+  */
+static void flash_writer_start(void)
+{
+    flash_writer_t *writer = &flash_writer;
+    flash_data_t *flash_data = &system_state.flash_data;
+    flash_page_head_t *head = &writer->head;
+    uint8_t *buf = accelerometer_data_temp[writer->buf];
+    uint16_t page = flash_data->flash_data_current_page;
+    
+    if(0 != crc32_start()){
+        return;
+    }
+    writer->start = dwt_get_cycle();
+    writer->page = page;
+    writer->offset = 0;
+    
+    memset(head, 0xff, sizeof(flash_page_head_t));
+    head->magic = FLASH_PAGE_MAGIC;
+    head->len = FLASH_WRITE_BUFF_LEN;
+    head->seq = flash_data->flash_data_seq;
+    head->time = save_buf_time[writer->buf];
+    
+    /* 页头字段由CPU写入, 数据用DMA送进CRC模块, 写页头前取结果 */
+    crc32_update((uint8_t *)&head->len, FLASH_PAGE_CRC_HEAD_LEN);
+    if(0 != crc32_update_by_dma(buf, FLASH_WRITE_BUFF_LEN, &writer->crc)){
+        writer->crc = crc32_update(buf, FLASH_WRITE_BUFF_LEN);
+    }
+    
+    writer->state = FLASH_WRITER_PROGRAM;
+    if(0 == (page % FLASH_PAGE_PER_SECTOR)){
+        if((0 != flash_reserve.cnt) && (flash_reserve.page == page)){
+            /* 空闲时已擦除 */
+            flash_reserve.cnt--;
+        }
+        else{
+            flash_reserve.cnt = 0;
+            flash_stat.erase_wait_cnt++;
+            flash_send_skip(page);
+            writer->state = FLASH_WRITER_ERASE;
+        }
+        flash_reserve.page = flash_next_sector(page);
+    }
+}
+
+/**
+  * @brief  The page could not be written, leave it torn (no header) and
+  *         drop the buffer, boot recovery skips such pages.
+  * @retval None
+  */
+static void flash_writer_fail(void)
+{
+    flash_writer_t *writer = &flash_writer;
+    flash_data_t *flash_data = &system_state.flash_data;
+    
+    flash_stat.fail_cnt++;
+    if((FLASH_WRITER_ERASE == writer->state) || (FLASH_WRITER_ERASE_WAIT == writer->state) || (FLASH_WRITER_RESERVE == writer->next)){
+        flash_wear.erase_fail++;
+    }
+    else{
+        flash_wear.program_fail++;
+    }
+    
+    if(FLASH_WRITER_RESERVE == writer->next){
+        /* 预擦除失败, 写到这个扇区时再擦除 */
+        ES_LOG_PRINT("flash pre-erase fail, page:%u\n", writer->page);
+        writer->state = FLASH_WRITER_IDLE;
+        return;
+    }
+    
+    ES_LOG_PRINT("flash writer fail, page:%u\n", writer->page);
+    
+    /* 这一页不写了, 还在算的页数据CRC一起放弃, 交出CRC模块 */
+    if(1 == crc32_dma_busy()){
+        crc32_dma_stop();
+    }
+    
+    /* 扇区第一页写失败时擦除可能没有完成, 整个扇区跳过, 从下一个扇区开始写 */
+    if(0 == (writer->page % FLASH_PAGE_PER_SECTOR)){
+        if(flash_data->flash_data_send_page == writer->page){
+            /* 没有未上传的数据, 读游标一起移走 */
+            flash_data->flash_data_send_page = flash_next_sector(writer->page);
+            flash_data->flash_data_current_page = flash_data->flash_data_send_page;
+        }
+        else{
+            flash_current_next(writer->page + FLASH_PAGE_PER_SECTOR - 1);
+        }
+    }
+    else{
+        flash_current_next(writer->page);
+    }
+    save_buf_full[writer->buf] = 0;
+    writer->buf ^= 1;
+    writer->state = FLASH_WRITER_IDLE;
+}
+
+/**
+  * @brief  Wait state: poll WIP once, move on when the flash is ready.
+  * @retval 1 if still busy.
+  */
+static uint8_t flash_writer_wait(uint32_t timeout)
+{
+    flash_writer_t *writer = &flash_writer;
+    uint8_t status = 0;
+    
+    if(OK != flash_read_status(&status)){
+        flash_writer_fail();
+        return 1;
+    }
+    if(status & FLASH_STATUS_WIP){
+        if((ald_get_tick() - writer->tick) > timeout){
+            flash_stat.timeout_cnt++;
+            flash_writer_fail();
+        }
+        return 1;
+    }
+    
+    writer->state = writer->next;
+    return 0;
+}
+
+#if FLASH_DMA_EN
+/**
+  * @brief  Wait state: check the payload DMA once, release CS when it is
+  *         done and wait for the program.
+  * @retval 1 if the transfer is still running.
+  */
+static uint8_t flash_writer_dma_wait(void)
+{
+    flash_writer_t *writer = &flash_writer;
+    ald_status_t status = flash_dma_check(writer->tick);
+    
+    if(BUSY == status){
+        return 1;
+    }
+    FLASH_CS_SET();
+    if(OK != status){
+        flash_writer_fail();
+        return 0;
+    }
+    writer->tick = ald_get_tick();
+    writer->state = FLASH_WRITER_PROGRAM_WAIT;
+    return 0;
+}
+#endif
+
+/**
+  * @brief  Another command needs the bus: finish the payload DMA the writer
+  *         left running, at most one 256 byte transfer.
+  * @retval None
+  */
+static void flash_dma_sync(void)
+{
+#if FLASH_DMA_EN
+    while((FLASH_WRITER_DMA_WAIT == flash_writer.state) && (1 == flash_writer_dma_wait())){
+    }
+#endif
+}
+
+/**
+  * @brief  Run one step of the background page writer. Each step sends at
+  *         most one flash command, the payload goes out by DMA while the
+  *         scheduler runs, so a sample read is never held back by more than
+  *         the command bytes.
+  * @retval 1 while there is work left, 0 when both buffers are written.
+  */
+int flash_writer_run(void)
+{
+    flash_writer_t *writer = &flash_writer;
+    flash_data_t *flash_data = &system_state.flash_data;
+    uint32_t addr = (uint32_t)writer->page * FLASH_PAGE_LEN;
+    uint16_t len = 0;
+    
+    switch(writer->state){
+        case FLASH_WRITER_IDLE:
+            if(0 == save_buf_full[writer->buf]){
+                return 0;
+            }
+            flash_writer_start();
+            break;
+        
+        case FLASH_WRITER_ERASE:
+            writer->next = FLASH_WRITER_PROGRAM;
+            if(OK != flash_sector_erase_start(addr)){
+                flash_writer_fail();
+                break;
+            }
+            writer->tick = ald_get_tick();
+            writer->erase_start = dwt_get_cycle();
+            writer->state = FLASH_WRITER_ERASE_WAIT;
+            break;
+        
+        case FLASH_WRITER_ERASE_WAIT:
+            if(0 == flash_writer_wait(FLASH_TSE_TIMEOUT)){
+                flash_stat_add(&flash_stat.erase, dwt_get_cycle() - writer->erase_start);
+            }
+            break;
+        
+        case FLASH_WRITER_PROGRAM:
+            /* 按256字节编程页边界拆分 */
+            addr += FLASH_PAGE_HEAD_LEN + writer->offset;
+            len = FLASH_PAGE_SIZE - (addr % FLASH_PAGE_SIZE);
+            if(len > FLASH_WRITE_BUFF_LEN - writer->offset){
+                len = FLASH_WRITE_BUFF_LEN - writer->offset;
+            }
+#if FLASH_DMA_EN
+            if(OK != flash_page_program_dma(addr, (char *)accelerometer_data_temp[writer->buf] + writer->offset, len)){
+                flash_writer_fail();
+                break;
+            }
+            writer->state = FLASH_WRITER_DMA_WAIT;
+#else
+            if(OK != flash_page_program_start(addr, (char *)accelerometer_data_temp[writer->buf] + writer->offset, len)){
+                flash_writer_fail();
+                break;
+            }
+            writer->state = FLASH_WRITER_PROGRAM_WAIT;
+#endif
+            writer->offset += len;
+            writer->tick = ald_get_tick();
+            writer->next = (FLASH_WRITE_BUFF_LEN <= writer->offset) ? FLASH_WRITER_HEAD : FLASH_WRITER_PROGRAM;
+            break;
+        
+#if FLASH_DMA_EN
+        case FLASH_WRITER_DMA_WAIT:
+            flash_writer_dma_wait();
+            break;
+#endif
+        
+        case FLASH_WRITER_HEAD:
+            /* writer->tick 是最后一段数据开始编程的时间, 编程完成后最多再等 FLASH_CRC_TIMEOUT */
+            if(1 == crc32_dma_busy()){
+                if((ald_get_tick() - writer->tick) > FLASH_CRC_TIMEOUT + FLASH_TPP_TIMEOUT){
+                    flash_stat.timeout_cnt++;
+                    flash_writer_fail();
+                }
+                break;
+            }
+            writer->head.crc = writer->crc;
+            if(OK != flash_page_program_start(addr, (char *)&writer->head, FLASH_PAGE_HEAD_LEN)){
+                flash_writer_fail();
+                break;
+            }
+            writer->tick = ald_get_tick();
+            writer->next = FLASH_WRITER_DONE;
+            writer->state = FLASH_WRITER_PROGRAM_WAIT;
+            break;
+        
+        case FLASH_WRITER_PROGRAM_WAIT:
+            flash_writer_wait(FLASH_TPP_TIMEOUT);
+            break;
+        
+        case FLASH_WRITER_DONE:
+            flash_data->flash_data_seq++;
+            flash_current_next(writer->page);
+            save_buf_full[writer->buf] = 0;
+            writer->buf ^= 1;
+            writer->state = FLASH_WRITER_IDLE;
+            
+            flash_stat_add(&flash_stat.flush, dwt_get_cycle() - writer->start);
+            flash_hist_add(flash_stat.flush.us_last);
+            flash_stat.payload_bytes += FLASH_WRITE_BUFF_LEN;
+            ES_LOG_PRINT("flash flush %u us, max %u us, erase max %u us\n", flash_stat.flush.us_last, flash_stat.flush.us_max, flash_stat.erase.us_max);
+            break;
+        
+        case FLASH_WRITER_RESERVE:
+            flash_reserve.cnt++;
+            writer->state = FLASH_WRITER_IDLE;
+            break;
+        
+        default:
+            writer->state = FLASH_WRITER_IDLE;
+            break;
+    }
+    
+    return 1;
+}
+
+/**
+  * @brief  Called when the scheduler has nothing to do: finish pending flash
+  *         work, or erase the next sector ahead of the write cursor so that
+  *         page writes never wait on an erase.
+  * @retval None
+  */
+void flash_writer_idle(void)
+{
+    flash_writer_t *writer = &flash_writer;
+    uint16_t page = flash_reserve.page;
+    uint8_t i = 0;
+    
+    if(1 != system_state.system_flg.flash_init_flg){
+        flash_power_idle();
+        return;
+    }
+    if(FLASH_WRITER_IDLE != writer->state){
+        flash_writer_run();
+        return;
+    }
+    if((FLASH_ERASE_AHEAD <= flash_reserve.cnt) || (1 == flash_calib.active)){
+        return;
+    }
+    
+    for(i=0; i<flash_reserve.cnt; i++){
+        page = flash_next_sector(page);
+    }
+    
+    flash_send_skip(page);
+    writer->page = page;
+    writer->next = FLASH_WRITER_RESERVE;
+    if(OK != flash_sector_erase_start((uint32_t)page * FLASH_PAGE_LEN)){
+        flash_writer_fail();
+        return;
+    }
+    writer->tick = ald_get_tick();
+    writer->erase_start = dwt_get_cycle();
+    writer->state = FLASH_WRITER_ERASE_WAIT;
+}
+
+/**
+  * @brief  Write out all full buffers before the flash is powered down.
+  * @retval None
+  */
+void flash_writer_sync(void)
+{
+    while(0 != flash_writer_run()){
+    }
+}
+
+static int flash_ack_check(uint16_t slot, flash_ack_t *ack)
+{
+    if(OK != flash_read(FLASH_ACK_ADDR + slot * sizeof(flash_ack_t), (char *)ack, sizeof(flash_ack_t))){
+        return -1;
+    }
+    if(ack->crc != crc16_calc(0xffff, (uint8_t *)ack, sizeof(flash_ack_t) - sizeof(ack->crc))){
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+  * @brief  Oldest stored page: the first valid page after the write sector
+  *         and the pre-erased sectors ahead of it. The write sector itself
+  *         is erased by the next append.
+  * @retval Page index, the write cursor when the ring is empty.
+  */
+static uint16_t flash_log_oldest(void)
+{
+    flash_page_head_t head;
+    uint16_t page = system_state.flash_data.flash_data_current_page;
+    uint8_t i = 0;
+    
+    for(i=0; i<=FLASH_ERASE_AHEAD; i++){
+        page = flash_next_sector(page);
+        if(0 == flash_page_check(page, &head)){
+            return page;
+        }
+    }
+    if(0 == flash_page_check(FLASH_DATA_START, &head)){
+        return FLASH_DATA_START;
+    }
+    
+    return system_state.flash_data.flash_data_current_page;
+}
+
+/**
+  * @brief  Check that a whole sector reads back erased.
+  * @retval 1 if blank.
+  */
+static uint8_t flash_sector_blank(uint16_t page)
+{
+    uint8_t buf[128];
+    uint32_t addr = (uint32_t)page * FLASH_PAGE_LEN;
+    uint32_t end = addr + FLASH_SECTOR_LEN;
+    uint8_t i = 0;
+    
+    for(; addr<end; addr+=sizeof(buf)){
+        if(OK != flash_read(addr, (char *)buf, sizeof(buf))){
+            return 0;
+        }
+        for(i=0; i<sizeof(buf); i++){
+            if(0xff != buf[i]){
+                return 0;
+            }
+        }
+    }
+    
+    return 1;
+}
+
+/**
+  * @brief  Count the erased sectors ahead of the write cursor at boot, an
+  *         interrupted pre-erase is not counted and is erased again.
+  * @retval None
+  */
+static void flash_reserve_check(void)
+{
+    uint16_t page = system_state.flash_data.flash_data_current_page;
+    
+    if(0 != (page % FLASH_PAGE_PER_SECTOR)){
+        page = flash_next_sector(page);
+    }
+    
+    flash_reserve.page = page;
+    flash_reserve.cnt = 0;
+    while((FLASH_ERASE_AHEAD > flash_reserve.cnt) && (1 == flash_sector_blank(page))){
+        flash_reserve.cnt++;
+        page = flash_next_sector(page);
+    }
+}
+
+/**
+  * @brief  Check whether a sector belongs to the current lap of the log: its
+  *         first page is valid with a sequence number from base_seq on. A
+  *         sector skipped after a failed first page has no such page, then
+  *         the sector after it decides.
+  * @param  sector: Sector index in the data area.
+  * @retval 1 if in the log.
+  */
+static uint8_t flash_sector_in_log(uint16_t sector, uint32_t base_seq)
+{
+    flash_page_head_t head;
+    uint8_t i = 0;
+    
+    for(i=0; i<2; i++){
+        if(FLASH_DATA_END / FLASH_PAGE_PER_SECTOR < sector + i){
+            return 0;
+        }
+        if((0 == flash_page_check((sector + i) * FLASH_PAGE_PER_SECTOR, &head)) && (head.seq >= base_seq)){
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+  * @brief  Convert the unsent pages of the old layout once, when the log has
+  *         no page yet. The old firmware kept flash_legacy_t at address 0 and
+  *         page p at page p + FLASH_DATA_START without a header. The pages
+  *         are copied oldest first to the start of the log, each copy lands
+  *         FLASH_DATA_START pages or more below its source, so a sector erase
+  *         never reaches a page not yet copied. Sector 0 is erased last, a
+  *         power loss before that keeps the pages already converted.
+  *         Not converted: old pages from FLASH_LEGACY_LOST on, the shorter
+  *         part of a range that wraps (the two parts overlap the log start),
+  *         and the oldest pages beyond the size of the log less the sector
+  *         of the write cursor.
+  * @retval Number of pages converted.
+  */
+static uint16_t flash_log_migrate(void)
+{
+    flash_legacy_t legacy;
+    flash_page_head_t head;
+    flash_ack_t ack;
+    uint8_t buf[FLASH_READ_BUFF_LEN];
+    uint32_t src = 0;
+    uint32_t dst = 0;
+    uint16_t first = 0;
+    uint16_t last = 0;
+    uint16_t cnt = 0;
+    uint16_t offset = 0;
+    
+    if(OK != flash_read(FLASH_ACK_ADDR, (char *)&legacy, sizeof(flash_legacy_t))){
+        return 0;
+    }
+    if((0xaa != legacy.data_flag) || (0 == flash_ack_check(0, &ack)) ||
+       (FLASH_DATA_START > legacy.send_page) || (FLASH_LEGACY_END < legacy.send_page) ||
+       (FLASH_DATA_START > legacy.current_page) || (FLASH_LEGACY_END < legacy.current_page)){
+        return 0;
+    }
+    
+    first = legacy.send_page;
+    last = legacy.current_page;
+    if(first > last){
+        if(FLASH_LEGACY_LOST - first >= last - FLASH_DATA_START){
+            last = FLASH_LEGACY_LOST;
+        }
+        else{
+            first = FLASH_DATA_START;
+        }
+    }
+    if(FLASH_LEGACY_LOST < last){
+        last = FLASH_LEGACY_LOST;
+    }
+    if(first >= last){
+        last = first;
+    }
+    else if(FLASH_DATA_END + 1 - FLASH_DATA_START - FLASH_PAGE_PER_SECTOR < last - first){
+        /* 写游标所在的扇区不能有数据 */
+        first = last - (FLASH_DATA_END + 1 - FLASH_DATA_START - FLASH_PAGE_PER_SECTOR);
+    }
+    ES_LOG_PRINT("flash legacy send page:%u, current page:%u, convert %u pages\n", legacy.send_page, legacy.current_page, last - first);
+    
+    for(cnt=0; first+cnt<last; cnt++){
+        src = (uint32_t)(first + cnt + FLASH_DATA_START) * FLASH_PAGE_LEN;
+        dst = (uint32_t)(FLASH_DATA_START + cnt) * FLASH_PAGE_LEN;
+        if((0 == (FLASH_DATA_START + cnt) % FLASH_PAGE_PER_SECTOR) && (OK != flash_sector_erase(dst))){
+            break;
+        }
+        if(OK != flash_read(src, (char *)buf, FLASH_READ_BUFF_LEN)){
+            break;
+        }
+    
+        /* 页时间取第一帧的时间, 旧数据帧 [10-14] 为 y m d h f */
+        memset(&head, 0xff, sizeof(flash_page_head_t));
+        head.magic = FLASH_PAGE_MAGIC;
+        head.len = FLASH_WRITE_BUFF_LEN;
+        head.seq = cnt + 1;
+        head.time = FLASH_PAGE_TIME_NONE;
+        if((0xaa == buf[0]) && (0 != buf[11])){
+            head.time = utc_get_minute(buf[10], buf[11], buf[12], buf[13], buf[14]);
+        }
+        if(0 != flash_crc_start()){
+            break;
+        }
+        crc32_update((uint8_t *)&head.len, FLASH_PAGE_CRC_HEAD_LEN);
+    
+        for(offset=0; offset<FLASH_WRITE_BUFF_LEN; offset+=FLASH_READ_BUFF_LEN){
+            if((0 != offset) && (OK != flash_read(src + offset, (char *)buf, FLASH_READ_BUFF_LEN))){
+                break;
+            }
+            head.crc = crc32_update(buf, FLASH_READ_BUFF_LEN);
+            if(OK != flash_write_data(dst + FLASH_PAGE_HEAD_LEN + offset, (char *)buf, FLASH_READ_BUFF_LEN)){
+                break;
+            }
+        }
+        if((FLASH_WRITE_BUFF_LEN > offset) || (OK != flash_write_data(dst, (char *)&head, FLASH_PAGE_HEAD_LEN))){
+            break;
+        }
+        flash_stat.payload_bytes += FLASH_WRITE_BUFF_LEN;
+    }
+    
+    flash_sector_erase(FLASH_ACK_ADDR);
+    ES_LOG_PRINT("flash legacy converted %u pages\n", cnt);
+    
+    return cnt;
+}
+
+/**
+  * @brief  Rebuild the read/write cursors from the page headers and the
+  *         last upload ack record, both found by binary search.
+  * @retval None
+  */
+static void flash_log_rebuild(void)
+{
+    flash_data_t *flash_data = &system_state.flash_data;
+    flash_page_head_t head;
+    flash_ack_t ack;
+    uint16_t base = FLASH_DATA_START;
+    uint16_t low = 0;
+    uint16_t high = 0;
+    uint16_t mid = 0;
+    uint32_t base_seq = 0;
+    int ack_ok = -1;
+    
+    flash_data->data_flag = 0xaa;
+    
+    /* 写游标: 从第一个有效扇区起序号递增的最后一个有效页,
+       绕回后前面的扇区可能刚被擦除或预擦除 */
+    for(low=0; low<=FLASH_ERASE_AHEAD+1; low++){
+        if(0 == flash_page_check(base, &head)){
+            break;
+        }
+        base += FLASH_PAGE_PER_SECTOR;
+    }
+    if(FLASH_ERASE_AHEAD+1 < low){
+        base = 0;
+        
+        /* 还没有数据页: 旧版本升级后第一次启动, 转换未上传的旧数据 */
+        if((0 != flash_log_migrate()) && (0 == flash_page_check(FLASH_DATA_START, &head))){
+            base = FLASH_DATA_START;
+        }
+    }
+    
+    if(0 == base){
+        flash_data->flash_data_current_page = FLASH_DATA_START;
+        flash_data->flash_data_seq = 1;
+    }
+    else{
+        /* 按扇区二分查找: 扇区总是从第一页开始写, 掉电截断只在扇区内留下空白页,
+           第一页写失败的扇区整个跳过, 所以属于本圈的扇区是连续的 */
+        base_seq = head.seq;
+        low = base / FLASH_PAGE_PER_SECTOR;
+        high = FLASH_DATA_END / FLASH_PAGE_PER_SECTOR;
+        while(low < high){
+            mid = low + (high - low + 1) / 2;
+            if(1 == flash_sector_in_log(mid, base_seq)){
+                low = mid;
+            }
+            else{
+                high = mid - 1;
+            }
+        }
+        
+        /* 扇区内序号最大的有效页, 最后一个扇区是自己的第一页有效才会被选中 */
+        low *= FLASH_PAGE_PER_SECTOR;
+        flash_page_check(low, &head);
+        base_seq = head.seq;
+        for(mid=low+1; 0!=(mid%FLASH_PAGE_PER_SECTOR); mid++){
+            if((0 == flash_page_check(mid, &head)) && (head.seq > base_seq)){
+                base_seq = head.seq;
+                low = mid;
+            }
+        }
+        flash_data->flash_data_seq = base_seq + 1;
+        flash_data->flash_data_current_page = flash_next_page(low);
+        
+        /* 掉电时后面的页可能只写了部分数据, 截断到下一个扇区, 写入前会先擦除 */
+        if(0 == flash_sector_tail_blank(flash_data->flash_data_current_page)){
+            flash_data->flash_data_current_page += FLASH_PAGE_PER_SECTOR - (flash_data->flash_data_current_page % FLASH_PAGE_PER_SECTOR);
+            if(FLASH_DATA_END < flash_data->flash_data_current_page){
+                flash_data->flash_data_current_page = FLASH_DATA_START;
+            }
+        }
+    }
+    
+    /* 确认记录: 已写的记录在前, 空白在后, 找第一个空白位置 */
+    low = 0;
+    high = FLASH_ACK_MAX;
+    while(low < high){
+        mid = (low + high) / 2;
+        if(OK != flash_read(FLASH_ACK_ADDR + mid * sizeof(flash_ack_t), (char *)&ack, sizeof(flash_ack_t))){
+            break;
+        }
+        if((0xffffffff == ack.seq) && (0xffff == ack.page) && (0xffff == ack.crc)){
+            high = mid;
+        }
+        else{
+            low = mid + 1;
+        }
+    }
+    flash_data->flash_ack_slot = low;
+    
+    /* 最后一条记录可能掉电写坏, 再往前找一条 */
+    if(0 < low){
+        ack_ok = flash_ack_check(low - 1, &ack);
+        if((0 != ack_ok) && (1 < low)){
+            ack_ok = flash_ack_check(low - 2, &ack);
+        }
+    }
+    
+    if(0 != ack_ok){
+        flash_data->flash_data_send_page = flash_log_oldest();
+    }
+    else if((FLASH_DATA_START <= ack.page) && (FLASH_DATA_END >= ack.page) && (ack.page != flash_data->flash_data_current_page) &&
+            (0 == flash_page_check(ack.page, &head)) && (head.seq == ack.seq)){
+        flash_data->flash_data_send_page = ack.page;
+    }
+    else if(ack.seq >= flash_data->flash_data_seq){
+        flash_data->flash_data_send_page = flash_data->flash_data_current_page;
+    }
+    else{
+        /* 确认的页已被覆盖, 或在写游标上: 上一圈的数据, 环形存储已满 */
+        flash_data->flash_data_send_page = flash_log_oldest();
+    }
+    
+    flash_reserve_check();
+    
+    ES_LOG_PRINT("flash log current page:%u, send page:%u, seq:%u, ack slot:%u, erased ahead:%u\n", flash_data->flash_data_current_page, flash_data->flash_data_send_page, flash_data->flash_data_seq, flash_data->flash_ack_slot, flash_reserve.cnt);
+}
+
+/**
+  * @brief  Number of pages from page up to (not including) end on the ring.
+  */
+static uint16_t flash_page_count(uint16_t page, uint16_t end)
+{
+    if(page <= end){
+        return end - page;
+    }
+    
+    return FLASH_DATA_END + 1 - page + end - FLASH_DATA_START;
+}
+
+static uint16_t flash_page_add(uint16_t page, uint16_t cnt)
+{
+    page += cnt;
+    if(FLASH_DATA_END < page){
+        page -= FLASH_DATA_END + 1 - FLASH_DATA_START;
+    }
+    
+    return page;
+}
+
+/**
+  * @brief  Collect the endurance and health counters for STATE_FLASH_HEALTH.
+  *         The ring is written in order, so every data sector is erased once
+  *         per lap: the lap count from the page sequence is a lower bound
+  *         when the saved erase total lags behind after a power loss.
+  * @retval None
+  */
+void flash_health_get(flash_health_t *health)
+{
+    flash_data_t *flash_data = &system_state.flash_data;
+    uint32_t pages = FLASH_DATA_END + 1 - FLASH_DATA_START;
+    uint32_t sectors = pages / FLASH_PAGE_PER_SECTOR;
+    uint32_t erase = (flash_wear.data_erase + sectors - 1) / sectors;
+    uint32_t laps = (flash_data->flash_data_seq - 1 + pages - 1) / pages;
+    
+    if(erase < laps){
+        erase = laps;
+    }
+    
+    health->sector_erase = (0xffff < erase) ? 0xffff : erase;
+    health->ack_erase = flash_wear.ack_erase;
+    health->write_amp = (0 == flash_stat.payload_bytes) ? 0 : (uint16_t)((uint64_t)flash_stat.program_bytes * 100 / flash_stat.payload_bytes);
+    health->flush_p50 = flash_hist_percentile(50);
+    health->flush_p90 = flash_hist_percentile(90);
+    health->flush_p99 = flash_hist_percentile(99);
+    health->program_fail = flash_wear.program_fail;
+    health->erase_fail = flash_wear.erase_fail;
+    health->buffered = flash_page_count(flash_data->flash_data_send_page, flash_data->flash_data_current_page);
+}
+
+/**
+  * @brief  Load the saved wear counters, counts since boot are added.
+  * @retval None
+  */
+static void flash_wear_load(void)
+{
+    static uint8_t loaded = 0;
+    flash_wear_t wear;
+    
+    if(1 == loaded){
+        return;
+    }
+    loaded = 1;
+    settings_init();
+    if(0 != settings_get(SETTINGS_KEY_FLASH_WEAR, &wear, sizeof(wear))){
+        return;
+    }
+    flash_wear.data_erase += wear.data_erase;
+    flash_wear.ack_erase += wear.ack_erase;
+    flash_wear.program_fail += wear.program_fail;
+    flash_wear.erase_fail += wear.erase_fail;
+    flash_wear.calib_erase += wear.calib_erase;
+}
+
+/**
+  * @brief  Start time of a page, from the header only.
+  * @retval Packed time, FLASH_PAGE_TIME_NONE if the page has no header or
+  *         was written before the clock was set.
+  */
+static uint32_t flash_page_time(uint16_t page)
+{
+    flash_page_head_t head;
+    
+    if(OK != flash_read((uint32_t)page * FLASH_PAGE_LEN, (char *)&head, FLASH_PAGE_HEAD_LEN)){
+        return 0;
+    }
+    if(FLASH_PAGE_MAGIC != head.magic){
+        return FLASH_PAGE_TIME_NONE;
+    }
+    
+    return head.time;
+}
+
+/**
+  * @brief  First page with a time, from the index-th page after oldest up to
+  *         the last-th. Torn pages and pages without a time are skipped.
+  * @param  time: Time of the page found.
+  * @retval Index of the page, last + 1 if there is none.
+  */
+static uint16_t flash_range_timed(uint16_t oldest, uint16_t index, uint16_t last, uint32_t *time)
+{
+    for(; index<=last; index++){
+        *time = flash_page_time(flash_page_add(oldest, index));
+        if(FLASH_PAGE_TIME_NONE != *time){
+            break;
+        }
+    }
+    
+    return index;
+}
+
+/**
+  * @brief  Select the stored pages covering [start, end] for upload. The
+  *         times of the pages that have one grow with the ring, so the last
+  *         such page starting at or before start is found by binary search
+  *         from the oldest page. Each probe moves on to the next page with a
+  *         time: torn pages and pages stored before the clock was set carry
+  *         none and would break the ordering.
+  * @param  start: utc_get_minute() of the first wanted minute.
+  * @param  end: utc_get_minute() of the last wanted minute, 0 for no limit.
+  * @retval 0 if there is data to upload.
+  */
+int flash_range_start(uint32_t start, uint32_t end)
+{
+    uint16_t oldest = flash_log_oldest();
+    uint16_t current = system_state.flash_data.flash_data_current_page;
+    uint16_t low = 0;
+    uint16_t high = flash_page_count(oldest, current);
+    uint16_t mid = 0;
+    uint16_t next = 0;
+    uint32_t time = 0;
+    
+    flash_range.active = 0;
+    if(0 == high){
+        return -1;
+    }
+    
+    high--;
+    while(low < high){
+        mid = low + (high - low + 1) / 2;
+        next = flash_range_timed(oldest, mid, high, &time);
+        if((next <= high) && (time <= start)){
+            low = next;
+        }
+        else{
+            high = mid - 1;
+        }
+    }
+    
+    flash_range.page = flash_page_add(oldest, low);
+    flash_range.end = end;
+    flash_range.active = 1;
+    ES_LOG_PRINT("flash range page:%u, oldest:%u, current:%u\n", flash_range.page, oldest, current);
+    
+    return (1 == flash_range_ready()) ? 0 : -1;
+}
+
+/**
+  * @brief  Check that the range has another round of pages to upload, and
+  *         end the range upload when it has not.
+  * @retval 1 if ready.
+  */
+uint8_t flash_range_ready(void)
+{
+    uint32_t time = 0;
+    
+    if(1 != flash_range.active){
+        return 0;
+    }
+    
+    /* 和正常上传一样一次传两页, 不传正在写的页 */
+    if(2 <= flash_page_count(flash_range.page, system_state.flash_data.flash_data_current_page)){
+        time = flash_page_time(flash_range.page);
+        if((0 == flash_range.end) || (time <= flash_range.end)){
+            return 1;
+        }
+    }
+    
+    flash_range.active = 0;
+    
+    return 0;
+}
+
+/**
+  * @brief  A round of the range upload is sent, move on two pages.
+  * @retval None
+  */
+void flash_range_next(void)
+{
+    flash_range.page = flash_page_add(flash_range.page, 2);
+}
+
+/**
+  * @brief  Page cnt pages after page in the calibration region, wraps around.
+  */
+static uint16_t flash_calib_page(uint16_t page, uint16_t cnt)
+{
+    return FLASH_CALIB_START + (page - FLASH_CALIB_START + cnt) % (FLASH_CALIB_END + 1 - FLASH_CALIB_START);
+}
+
+/**
+  * @brief  Read a calibration page header, the payload CRC is checked on upload.
+  * @retval 0 if the header is a calibration page header.
+  */
+static int flash_calib_head(uint16_t page, flash_page_head_t *head)
+{
+    if(OK != flash_read((uint32_t)page * FLASH_PAGE_LEN, (char *)head, FLASH_PAGE_HEAD_LEN)){
+        return -1;
+    }
+    if((FLASH_CALIB_MAGIC != head->magic) || (0 == head->len) || (FLASH_WRITE_BUFF_LEN < head->len)){
+        return -1;
+    }
+    
+    return 0;
+}
+
+static void flash_calib_remove(uint8_t index)
+{
+    flash_calib_t *calib = &flash_calib;
+    
+    memmove(&calib->session[index], &calib->session[index + 1], (calib->cnt - index - 1) * sizeof(flash_calib_session_t));
+    calib->cnt--;
+}
+
+/**
+  * @brief  Drop the sessions that have pages in the sector about to be erased.
+  * @param  page: First page of the sector.
+  * @retval None
+  */
+static void flash_calib_drop(uint16_t page)
+{
+    flash_calib_t *calib = &flash_calib;
+    flash_calib_session_t *session = NULL;
+    uint16_t region = FLASH_CALIB_END + 1 - FLASH_CALIB_START;
+    uint16_t pages = 0;
+    uint16_t offset = 0;
+    uint8_t i = calib->cnt;
+    
+    while(i--){
+        session = &calib->session[i];
+        pages = (session->frames + FLASH_CALIB_PAGE_FRAMES - 1) / FLASH_CALIB_PAGE_FRAMES;
+        offset = (page + region - session->page) % region;
+        /* 段从扇区开头写起, 扇区开头在段内即有重叠 */
+        if((0 == offset) || (offset < pages)){
+            flash_calib_remove(i);
+        }
+    }
+}
+
+static ald_status_t flash_calib_erase(uint16_t page, uint8_t wait)
+{
+    ald_status_t status;
+    
+    flash_calib_drop(page);
+    flash_calib.erased = FLASH_CALIB_NONE;
+    if(wait){
+        status = flash_sector_erase((uint32_t)page * FLASH_PAGE_LEN);
+    }
+    else{
+        status = flash_sector_erase_start((uint32_t)page * FLASH_PAGE_LEN);
+        if(OK != status){
+            flash_wear.erase_fail++;
+        }
+    }
+    if(OK == status){
+        flash_calib.erased = page;
+    }
+    
+    return status;
+}
+
+/**
+  * @brief  Build the session index from the page headers: a session starts
+  *         with page 0 at a sector start and runs while the page numbers
+  *         follow on. The newest FLASH_CALIB_SESSION_MAX sessions are kept.
+  * @retval None
+  */
+static void flash_calib_scan(void)
+{
+    flash_calib_t *calib = &flash_calib;
+    flash_calib_session_t *last = NULL;
+    flash_calib_session_t found;
+    flash_page_head_t head;
+    uint16_t page = 0;
+    uint16_t next = 0;
+    uint16_t seq = 0;
+    uint16_t pages = 0;
+    uint8_t i = 0;
+    
+    calib->scanned = 1;
+    calib->cnt = 0;
+    calib->id = 0;
+    calib->page = FLASH_CALIB_START;
+    calib->erased = FLASH_CALIB_NONE;
+    
+    for(page=FLASH_CALIB_START; page<=FLASH_CALIB_END; page+=FLASH_PAGE_PER_SECTOR){
+        if((0 != flash_calib_head(page, &head)) || (0 != (head.seq & 0xffff))){
+            continue;
+        }
+        found.id = head.seq >> 16;
+        found.page = page;
+        found.time = head.time;
+        found.frames = head.len / FLASH_CALIB_FRAME_LEN;
+        
+        /* 只有最后一页不满 */
+        next = page;
+        seq = 0;
+        while(FLASH_WRITE_BUFF_LEN == head.len){
+            next = flash_calib_page(next, 1);
+            seq++;
+            if((next == page) || (0 != flash_calib_head(next, &head)) || (head.seq != (((uint32_t)found.id << 16) | seq))){
+                break;
+            }
+            found.frames += head.len / FLASH_CALIB_FRAME_LEN;
+        }
+        
+        /* 按段号从早到晚插入 */
+        i = calib->cnt;
+        while((0 < i) && (0 > (int16_t)(found.id - calib->session[i - 1].id))){
+            i--;
+        }
+        if(FLASH_CALIB_SESSION_MAX == calib->cnt){
+            if(0 == i){
+                continue;
+            }
+            flash_calib_remove(0);
+            i--;
+        }
+        memmove(&calib->session[i + 1], &calib->session[i], (calib->cnt - i) * sizeof(flash_calib_session_t));
+        calib->session[i] = found;
+        calib->cnt++;
+    }
+    
+    if(0 == calib->cnt){
+        return;
+    }
+    
+    /* 最新一段之后的扇区开头 */
+    last = &calib->session[calib->cnt - 1];
+    pages = (last->frames + FLASH_CALIB_PAGE_FRAMES - 1) / FLASH_CALIB_PAGE_FRAMES;
+    pages = (pages + FLASH_PAGE_PER_SECTOR - 1) / FLASH_PAGE_PER_SECTOR * FLASH_PAGE_PER_SECTOR;
+    calib->id = last->id + 1;
+    calib->page = flash_calib_page(last->page, pages);
+    ES_LOG_PRINT("calibrate sessions %u, next page %u\n", calib->cnt, calib->page);
+}
+
+/**
+  * @brief  Write the buffered frames as the next page of the session, data
+  *         first and the header last. Entering a new sector starts its erase
+  *         without waiting, the next page is due a second later.
+  * @retval None
+  */
+static void flash_calib_flush(void)
+{
+    flash_calib_t *calib = &flash_calib;
+    flash_calib_session_t *session = &calib->session[calib->cnt - 1];
+    flash_page_head_t head;
+    uint32_t addr = (uint32_t)calib->page * FLASH_PAGE_LEN;
+    
+    if(0 == calib->len){
+        return;
+    }
+    
+    memset(&head, 0xff, sizeof(flash_page_head_t));
+    head.magic = FLASH_CALIB_MAGIC;
+    head.len = calib->len;
+    head.seq = ((uint32_t)session->id << 16) | calib->seq;
+    head.time = session->time;
+    if(0 == flash_crc_start()){
+        crc32_update((uint8_t *)&head.len, FLASH_PAGE_CRC_HEAD_LEN);
+        head.crc = crc32_update(calib->buf, calib->len);
+    }
+    /* 拿不到CRC模块时页头CRC保持全1, 上传时校验失败跳过这一页 */
+    
+    if((OK != flash_write_data(addr + FLASH_PAGE_HEAD_LEN, (char *)calib->buf, calib->len)) ||
+       (OK != flash_write_data(addr, (char *)&head, FLASH_PAGE_HEAD_LEN))){
+        /* 帧号和页的对应关系不变, 上传时CRC错误跳过这一页 */
+        flash_stat.fail_cnt++;
+    }
+    
+    session->frames += calib->len / FLASH_CALIB_FRAME_LEN;
+    calib->len = 0;
+    calib->seq++;
+    calib->page = flash_calib_page(calib->page, 1);
+    if(0 != (calib->page % FLASH_PAGE_PER_SECTOR)){
+        return;
+    }
+    if(calib->page == session->page){
+        calib->full = 1;
+        return;
+    }
+    flash_calib_erase(calib->page, 0);
+}
+
+/**
+  * @brief  Start a calibration session at the next sector start of the
+  *         calibration region, sessions written over are dropped.
+  * @retval 0 on success, -1 if the flash is down or the erase failed.
+  */
+int flash_calib_start(void)
+{
+    flash_calib_t *calib = &flash_calib;
+    flash_calib_session_t *session = NULL;
+    uint8_t idle = save_buf_fill ^ 1;
+    
+    flash_calib_stop();
+    if(1 != system_state.system_flg.flash_init_flg){
+        return -1;
+    }
+    if(0 == calib->scanned){
+        flash_calib_scan();
+    }
+    
+    /* 写完排队的数据页, 采集期间不和后台写入交错. 校准时记录暂停, 空闲的乒乓缓存借给校准 */
+    flash_writer_sync();
+    if((0 == save_buf_full[idle]) && (NULL != accelerometer_data_temp[idle])){
+        pool_free(accelerometer_data_temp[idle]);
+        accelerometer_data_temp[idle] = NULL;
+    }
+    calib->buf = pool_alloc(POOL_ARENA_CALIBRATE, FLASH_WRITE_BUFF_LEN);
+    if(NULL == calib->buf){
+        return -1;
+    }
+    if((calib->erased != calib->page) && (OK != flash_calib_erase(calib->page, 1))){
+        pool_arena_release(POOL_ARENA_CALIBRATE);
+        calib->buf = NULL;
+        return -1;
+    }
+    
+    if(FLASH_CALIB_SESSION_MAX == calib->cnt){
+        flash_calib_remove(0);
+    }
+    session = &calib->session[calib->cnt++];
+    session->id = calib->id++;
+    session->page = calib->page;
+    session->frames = 0;
+    session->time = utc_get_minute(utc_time.utc_y, utc_time.utc_m, utc_time.utc_d, utc_time.utc_h, utc_time.utc_f);
+    
+    calib->erased = FLASH_CALIB_NONE;
+    calib->seq = 0;
+    calib->len = 0;
+    calib->full = 0;
+    calib->drop_cnt = 0;
+    calib->active = 1;
+    
+    return 0;
+}
+
+/**
+  * @brief  Get the place of the next calibration frame in the page buffer,
+  *         the caller writes it there and calls flash_calib_commit().
+  * @retval Pointer into the page buffer, NULL when not capturing or full.
+  */
+uint8_t *flash_calib_slot(void)
+{
+    flash_calib_t *calib = &flash_calib;
+    
+    if(1 != calib->active){
+        return NULL;
+    }
+    if(1 == calib->full){
+        calib->drop_cnt++;
+        return NULL;
+    }
+    
+    return &calib->buf[calib->len];
+}
+
+/**
+  * @brief  Take the frame written at flash_calib_slot(), a page is written
+  *         when full.
+  * @retval None
+  */
+void flash_calib_commit(void)
+{
+    flash_calib_t *calib = &flash_calib;
+    
+    calib->len += FLASH_CALIB_FRAME_LEN;
+    if(FLASH_WRITE_BUFF_LEN <= calib->len){
+        flash_calib_flush();
+    }
+}
+
+/**
+  * @brief  Append one 20 byte calibration frame, a page is written when full.
+  * @param  frame: Pointer to the frame.
+  * @retval None
+  */
+void flash_calib_save(uint8_t *frame)
+{
+    uint8_t *slot = flash_calib_slot();
+    
+    if(NULL == slot){
+        return;
+    }
+    
+    memcpy(slot, frame, FLASH_CALIB_FRAME_LEN);
+    flash_calib_commit();
+}
+
+/**
+  * @brief  Write the last partial page and close the session, the next one
+  *         starts at the following sector.
+  * @retval None
+  */
+void flash_calib_stop(void)
+{
+    flash_calib_t *calib = &flash_calib;
+    
+    if(1 != calib->active){
+        return;
+    }
+    calib->active = 0;
+    
+    flash_calib_flush();
+    flash_wait_busy_timeout(FLASH_TSE_TIMEOUT);
+    pool_arena_release(POOL_ARENA_CALIBRATE);
+    calib->buf = NULL;
+    
+    if(0 != (calib->page % FLASH_PAGE_PER_SECTOR)){
+        calib->page = flash_calib_page(calib->page - calib->page % FLASH_PAGE_PER_SECTOR, FLASH_PAGE_PER_SECTOR);
+    }
+    if(0 == calib->session[calib->cnt - 1].frames){
+        /* 没有采样, 扇区仍是擦除状态 */
+        flash_calib_remove(calib->cnt - 1);
+        calib->id--;
+        calib->erased = calib->page;
+    }
+    ES_LOG_PRINT("calibrate stop, sessions %u, dropped %u\n", calib->cnt, calib->drop_cnt);
+}
+
+/**
+  * @brief  Choose the session to upload.
+  * @param  index: 0 for the newest session, 1 for the one before...
+  * @retval Frames in the session, -1 if there is no such session.
+  */
+int flash_calib_select(uint8_t index)
+{
+    flash_calib_t *calib = &flash_calib;
+    
+    if(1 != system_state.system_flg.flash_init_flg){
+        return -1;
+    }
+    if(0 == calib->scanned){
+        flash_calib_scan();
+    }
+    if(index >= calib->cnt){
+        return -1;
+    }
+    
+    calib->upload = calib->cnt - 1 - index;
+    
+    return calib->session[calib->upload].frames;
+}
+
+/**
+  * @brief  Read frames of the selected session, a page that fails the CRC
+  *         check is skipped.
+  * @param  frame: Next frame to read, moved past the frames read.
+  * @param  buf: Output buffer for cnt frames.
+  * @param  cnt: Frames wanted.
+  * @retval Frames read, 0 at the end of the session.
+  */
+uint8_t flash_calib_read(uint16_t *frame, uint8_t *buf, uint8_t cnt)
+{
+    flash_calib_t *calib = &flash_calib;
+    flash_calib_session_t *session = &calib->session[calib->upload];
+    flash_page_head_t head;
+    uint16_t page = 0;
+    uint16_t offset = 0;
+    
+    if((calib->upload >= calib->cnt) || (1 != system_state.system_flg.flash_init_flg)){
+        return 0;
+    }
+    
+    while(*frame < session->frames){
+        page = flash_calib_page(session->page, *frame / FLASH_CALIB_PAGE_FRAMES);
+        offset = *frame % FLASH_CALIB_PAGE_FRAMES;
+        if((0 == offset) && ((0 != flash_page_verify(page, FLASH_CALIB_MAGIC, &head)) ||
+                             (head.seq != (((uint32_t)session->id << 16) | (*frame / FLASH_CALIB_PAGE_FRAMES))))){
+            flash_stat.corrupt_cnt++;
+            *frame += FLASH_CALIB_PAGE_FRAMES;
+            continue;
+        }
+        
+        if(cnt > FLASH_CALIB_PAGE_FRAMES - offset){
+            cnt = FLASH_CALIB_PAGE_FRAMES - offset;
+        }
+        if(cnt > session->frames - *frame){
+            cnt = session->frames - *frame;
         }
+        if(OK != flash_read((uint32_t)page * FLASH_PAGE_LEN + FLASH_PAGE_HEAD_LEN + offset * FLASH_CALIB_FRAME_LEN, (char *)buf, cnt * FLASH_CALIB_FRAME_LEN)){
+            return 0;
+        }
+        *frame += cnt;
+        
+        return cnt;
     }
+    
+    return 0;
+}
 
-    FLASH_CS_SET();
+#if FLASH_BENCH_EN
+/**
+  * @brief  Read the first data page FLASH_BENCH_LOOP times, log the throughput.
+  * @param  dma: 1 to move the payload by DMA.
+  * @retval KB/s.
+  */
+static uint32_t flash_bench_read(uint8_t dma)
+{
+    uint32_t start = 0;
+    uint32_t cycles = 0;
+    uint16_t i = 0;
+    
+    start = dwt_get_cycle();
+    for(i=0; i<FLASH_BENCH_LOOP; i++){
+        flash_read_mode(FLASH_DATA_START * FLASH_PAGE_LEN, (char *)flash_log_buf(0), FLASH_WRITE_BUFF_LEN, dma);
+    }
+    cycles = dwt_get_cycle() - start;
+    
+    return (uint32_t)((uint64_t)FLASH_WRITE_BUFF_LEN * FLASH_BENCH_LOOP * 48000 / 1024 / cycles);
+}
 
-    return OK;
+/**
+  * @brief  Compare the read clocks, by polling and by DMA: 0x03 at 12MHz
+  *         (line rate 1500 KB/s) and at 24MHz (3000 KB/s). The gain is the
+  *         clock, 0x0B at 24MHz is timed too and only adds the dummy byte.
+  * @retval None
+  */
+static void flash_bench(void)
+{
+    spi_baud_t baud = flash_read_baud;
+    
+    flash_read_baud = FLASH_SPI_BAUD_NORMAL;
+    ES_LOG_PRINT("flash read 12MHz 0x03 poll: %u KB/s\n", flash_bench_read(0));
+#if FLASH_DMA_EN
+    ES_LOG_PRINT("flash read 12MHz 0x03 dma: %u KB/s\n", flash_bench_read(1));
+#endif
+    
+    flash_read_baud = FLASH_SPI_BAUD_FAST;
+    ES_LOG_PRINT("flash read 24MHz 0x03 poll: %u KB/s\n", flash_bench_read(0));
+#if FLASH_DMA_EN
+    ES_LOG_PRINT("flash read 24MHz 0x03 dma: %u KB/s\n", flash_bench_read(1));
+#endif
+    
+    flash_read_cmd = FLASH_FAST_READ;
+    ES_LOG_PRINT("flash read 24MHz 0x0b dma: %u KB/s\n", flash_bench_read(FLASH_DMA_EN));
+    flash_read_cmd = FLASH_READ_DATA;
+    
+    flash_read_baud = baud;
 }
+#endif
 
 void init_system_info(system_state_t *system_state)
 {
     /* 从片内 flash 中读取相关数据 */
     system_info_t system_info = {0};
+    uint8_t correct[7];
+    uint8_t raw_log = 0;
     
+    settings_init();
+    
+    /* 旧版本整页保存的数据, 没有设置记录时使用 */
     memcpy((void *)(&system_info), (void *)IAP_DATA_ADDRESS, 128);  /* read 0x10000 */
+    if(0xaa != system_info.data_flag){
+        memset(&system_info, 0, sizeof(system_info));
+        system_info.shake_fre = 0x01;
+    }
     
-//    __disable_irq();
-
-//    if (IAP_FASTPROGRAM(IAP_DATA_ADDRESS, (uint8_t *)&system_info, 128, AUTO_ERASE_TRUE, IAP_FREQUENCE_48M) != RESET){
-//        ES_LOG_PRINT("read data success\n");
-        ES_LOG_PRINT("flag: %x, shake_fre: %u, wxid[0]: %u, wxid[1]: %u, wxid[2]: %u, wxid[3]: %u, correct_flag: %u, correct_ax: %d, correct_ay: %d, correct_az: %d\n",\
-            system_info.data_flag, system_info.shake_fre, system_info.wxid[0], system_info.wxid[1], system_info.wxid[2], system_info.wxid[3], system_info.mpu6050_correct_flag, system_info.correct_ax, system_info.correct_ay, system_info.correct_az);
-//    }
-//    else{
-//        ES_LOG_PRINT("read data fail\n");
-//    }
-//    __enable_irq();
+    if(0 == settings_get(SETTINGS_KEY_SHAKE_FRE, &system_info.shake_fre, 1)){
+        system_info.data_flag = 0xaa;
+    }
+    if(0 == settings_get(SETTINGS_KEY_WXID, system_info.wxid, 4)){
+        system_info.data_flag = 0xaa;
+    }
+    if(0 == settings_get(SETTINGS_KEY_CORRECT, correct, sizeof(correct))){
+        system_info.data_flag = 0xaa;
+        system_info.mpu6050_correct_flag = correct[0];
+        memcpy(&system_info.correct_ax, &correct[1], 2);
+        memcpy(&system_info.correct_ay, &correct[3], 2);
+        memcpy(&system_info.correct_az, &correct[5], 2);
+    }
+    
+    ES_LOG_PRINT("flag: %x, shake_fre: %u, wxid[0]: %u, wxid[1]: %u, wxid[2]: %u, wxid[3]: %u, correct_flag: %u, correct_ax: %d, correct_ay: %d, correct_az: %d\n",\
+        system_info.data_flag, system_info.shake_fre, system_info.wxid[0], system_info.wxid[1], system_info.wxid[2], system_info.wxid[3], system_info.mpu6050_correct_flag, system_info.correct_ax, system_info.correct_ay, system_info.correct_az);
     
     if(0xaa == system_info.data_flag){
         system_state->shake_fre = system_info.shake_fre;
@@ -442,49 +2342,42 @@ void init_system_info(system_state_t *system_state)
         system_state->correct_ay = 0;
         system_state->correct_az = 0;
     }
+    
+    /* 调试开关, 旧版本没有 */
+    settings_get(SETTINGS_KEY_RAW_LOG, &raw_log, 1);
+    system_state->system_flg.raw_log_flg = (0 != raw_log) ? 1 : 0;
 }
 
+/**
+  * @brief  Save the settings as key records, only changed keys are
+  *         appended, see bsp_settings.h.
+  * @retval 0 on success, -1 to retry.
+  */
 int save_system_info(void)
 {
+    uint8_t correct[7];
+    uint8_t raw_log = system_state.system_flg.raw_log_flg;
     int res = 0;
-    /* 保存数据至片内 flash */
-    system_info_t system_info = {0};
     
-    system_info.data_flag = 0xaa;
-    system_info.shake_fre = system_state.shake_fre;
-    system_info.wxid[0] = system_state.wxid[0];
-    system_info.wxid[1] = system_state.wxid[1];
-    system_info.wxid[2] = system_state.wxid[2];
-    system_info.wxid[3] = system_state.wxid[3];
-    system_info.mpu6050_correct_flag = system_state.mpu6050_correct_flag;
-    system_info.correct_ax = system_state.correct_ax;
-    system_info.correct_ay = system_state.correct_ay;
-    system_info.correct_az = system_state.correct_az;
+    correct[0] = system_state.mpu6050_correct_flag;
+    memcpy(&correct[1], &system_state.correct_ax, 2);
+    memcpy(&correct[3], &system_state.correct_ay, 2);
+    memcpy(&correct[5], &system_state.correct_az, 2);
     
-    __disable_irq();
-
-    do
-    {
-        /* Double words write testing */
-        if (IAP_PAGEERASE(IAP_DATA_ADDRESS, IAP_FREQUENCE_48M) == RESET){    /* Erase page 64 */
-            ES_LOG_PRINT("IAP_PAGEERASE fail\n");
-            res = -1;
-            break;
-        }
-        
-        /* Write data_buf to 0x20000 */
-        if (IAP_FASTPROGRAM(IAP_DATA_ADDRESS, (uint8_t *)&system_info, 128, AUTO_ERASE_TRUE, IAP_FREQUENCE_48M) == RESET){
-            ES_LOG_PRINT("IAP_FASTPROGRAM fail\n");
-            res = -1;
-            break;
-        }
-        else{
-            ES_LOG_PRINT("IAP_FASTPROGRAM success\n");
-        }
-        
-    }while (0);
+    if(0 != settings_set(SETTINGS_KEY_SHAKE_FRE, &system_state.shake_fre, 1)){
+        res = -1;
+    }
+    if(0 != settings_set(SETTINGS_KEY_WXID, system_state.wxid, 4)){
+        res = -1;
+    }
+    if(0 != settings_set(SETTINGS_KEY_CORRECT, correct, sizeof(correct))){
+        res = -1;
+    }
+    if(0 != settings_set(SETTINGS_KEY_RAW_LOG, &raw_log, 1)){
+        res = -1;
+    }
     
-    __enable_irq();
+    ES_LOG_PRINT("save system info %s, irq off %u us, max %u us\n", (0 == res) ? "success" : "fail", settings_stat.irq_us_last, settings_stat.irq_us_max);
     
     return res;
 }
@@ -492,7 +2385,6 @@ int save_system_info(void)
 void flash_init(void)
 {
     gpio_init_t x;
-    ald_status_t status;
 //    char s_flash_txbuf[32] = "essemi mcu spi flash example!";     /* 长度必须小于一页(256字节) */
 //    char s_flash_rxbuf[32];
     
@@ -512,143 +2404,342 @@ void flash_init(void)
     
     spi_init();
 
-//    flash_sector_erase(0);
-    status = flash_read(0, (char *)(&system_state.flash_data), sizeof(flash_data_t));
-    if (status == OK){
-        ES_LOG_PRINT("read OK!flash data page:%u, send data page:%u\n", system_state.flash_data.flash_data_current_page, system_state.flash_data.flash_data_send_page);
-    }
-    
-    if(0xaa != system_state.flash_data.data_flag){
-        system_state.flash_data.data_flag = 0xaa;
-        system_state.flash_data.flash_data_current_page = 4;
-        system_state.flash_data.flash_data_send_page = 4;
-    }
+#if FLASH_BENCH_EN
+    flash_bench();
+#endif
+    crc32_init();
+    flash_log_rebuild();
+    flash_wear_load();
     
     system_state.system_flg.flash_init_flg = 1;
 }
 
+/**
+  * @brief  Wake the flash after low power mode. From deep power-down only
+  *         tRES1 is needed and the cursors in RAM are still valid; after a
+  *         power cut the flash is powered up and the log is rebuilt.
+  * @retval None
+  */
 void flash_quick_init(void)
 {
-    ald_status_t status;
+    flash_power_t *power = &flash_power;
+    uint32_t start = dwt_get_cycle();
+    uint32_t sleep_ms = ald_get_tick() - power->sleep_tick;
     
-    ald_gpio_write_pin(PWR_FLASH_PORT, PWR_FLASH_PIN, 0);
-    ald_delay_ms(20);
-
-    status = flash_read(0, (char *)(&system_state.flash_data), sizeof(flash_data_t));
-    if (status == OK){
-        ES_LOG_PRINT("read OK!flash data page:%u, send data page:%u\n", system_state.flash_data.flash_data_current_page, system_state.flash_data.flash_data_send_page);
+    /* 休眠时间滑动平均, 新值占1/4 */
+    if(0 == power->sleep_avg_ms){
+        power->sleep_avg_ms = sleep_ms;
     }
-    if(0xaa != system_state.flash_data.data_flag){
-        system_state.flash_data.data_flag = 0xaa;
-        system_state.flash_data.flash_data_current_page = 4;
-        system_state.flash_data.flash_data_send_page = 4;
+    else{
+        power->sleep_avg_ms = (power->sleep_avg_ms * 3 + sleep_ms) / 4;
     }
     
-    if(0xaa != system_state.flash_data.data_flag){
-        system_state.flash_data.data_flag = 0xaa;
-        system_state.flash_data.flash_data_current_page = 4;
-        system_state.flash_data.flash_data_send_page = 4;
+#if FLASH_DPD_EN
+    if(FLASH_POWER_DPD == power->state){
+        if(OK == flash_dpd_exit()){
+            power->state = FLASH_POWER_ON;
+            flash_stat_add(&flash_stat.wake_dpd, dwt_get_cycle() - start);
+            system_state.system_flg.flash_init_flg = 1;
+            ES_LOG_PRINT("flash dpd wake %u us, slept %u ms\n", flash_stat.wake_dpd.us_last, sleep_ms);
+            return;
+        }
+        
+        /* 没有退出深度掉电, 断电重新上电 */
+        ald_gpio_write_pin(PWR_FLASH_PORT, PWR_FLASH_PIN, 1);
+        flash_stat.power_cut_cnt++;
+        ald_delay_ms(1);
     }
+#endif
+    
+    ald_gpio_write_pin(PWR_FLASH_PORT, PWR_FLASH_PIN, 0);
+    ald_delay_ms(FLASH_POWER_UP_MS);
+
+    crc32_init();
+    flash_log_rebuild();
+    power->state = FLASH_POWER_ON;
+    flash_stat_add(&flash_stat.wake_power, dwt_get_cycle() - start);
     
     system_state.system_flg.flash_init_flg = 1;
+    ES_LOG_PRINT("flash power wake %u us, slept %u ms\n", flash_stat.wake_power.us_last, sleep_ms);
 }
 
-
+/**
+  * @brief  Put the flash to sleep for low power mode: deep power-down when
+  *         the expected sleep is short, otherwise cut the power.
+  *         The write buffers must be synced before, see flash_writer_sync().
+  * @retval None
+  */
 void flash_deinit(void)
 {
+    flash_power_t *power = &flash_power;
+    
+    flash_calib_stop();
     system_state.system_flg.flash_init_flg = 0;
+    power->sleep_tick = ald_get_tick();
+    
+    /* 没有变化时不写记录 */
+    settings_set(SETTINGS_KEY_FLASH_WEAR, &flash_wear, sizeof(flash_wear_t));
+    
+#if FLASH_DPD_EN
+    if((FLASH_POWER_ON == power->state) && (FLASH_DPD_MAX_MS > power->sleep_avg_ms)){
+        if(OK == flash_dpd_enter()){
+            power->state = FLASH_POWER_DPD;
+            flash_stat.dpd_cnt++;
+            return;
+        }
+    }
+#endif
+    
     ald_gpio_write_pin(PWR_FLASH_PORT, PWR_FLASH_PIN, 1);
+    power->state = FLASH_POWER_OFF;
+    flash_stat.power_cut_cnt++;
 }
 
-void save_accelerometer(uint16_t ax, uint16_t ay, uint16_t az)
+/**
+  * @brief  Called from the idle hook while the flash is down: cut the power
+  *         when deep power-down has lasted longer than FLASH_DPD_MAX_MS, a
+  *         wrong guess costs at most that long in deep power-down current.
+  * @retval None
+  */
+static void flash_power_idle(void)
 {
-    uint8_t save_data_temp[20];
-    uint8_t sum = 0;
-    uint8_t i = 0;
-//    uint16_t j = 0;
-    ald_status_t status;
+    flash_power_t *power = &flash_power;
     
-    memset(save_data_temp, 0, 20);
-    save_data_temp[0] = 0xaa;
-    save_data_temp[1] = 0x13;
-    save_data_temp[2] = 0xd5;
-    save_data_temp[3] = 0x03;
-    save_data_temp[4] = ax >> 8;
-    save_data_temp[5] = ax & 0xff;
-    save_data_temp[6] = ay >> 8;
-    save_data_temp[7] = ay & 0xff;
-    save_data_temp[8] = az >> 8;
-    save_data_temp[9] = az & 0xff;
-    save_data_temp[10] = utc_time.utc_y;
-    save_data_temp[11] = utc_time.utc_m;
-    save_data_temp[12] = utc_time.utc_d;
-    save_data_temp[13] = utc_time.utc_h;
-    save_data_temp[14] = utc_time.utc_f;
-    save_data_temp[15] = utc_time.utc_s;
-
-    sum = 0;
-    for(i=0; i<19; i++){
-        sum += save_data_temp[i];
-    }
-    save_data_temp[19] = sum;
+    if(FLASH_POWER_DPD != power->state){
+        return;
+    }
+    if(FLASH_DPD_MAX_MS >= (ald_get_tick() - power->sleep_tick)){
+        return;
+    }
     
-    /* 保存至外部flash */
-    memcpy(accelerometer_data_temp+20*save_pack_temp, save_data_temp, 20);
+    ald_gpio_write_pin(PWR_FLASH_PORT, PWR_FLASH_PIN, 1);
+    power->state = FLASH_POWER_OFF;
+    flash_stat.power_cut_cnt++;
+}
+
+/**
+  * @brief  Get the place of the next 20 byte frame in the page buffer, the
+  *         caller writes the frame there and calls save_frame_commit().
+  * @retval Pointer into the page buffer, NULL when the frame must be dropped.
+  */
+uint8_t *save_frame_slot(void)
+{
+    /* 两个缓存都在等待写入, 丢弃 */
+    if(1 == save_buf_full[save_buf_fill]){
+        flash_stat.drop_cnt++;
+        return NULL;
+    }
+    
+    /* 缓存借给校准还没有归还 */
+    if(NULL == flash_log_buf(save_buf_fill)){
+        flash_stat.drop_cnt++;
+        return NULL;
+    }
+    
+    /* 复位后手机下发时间前 utc_time 全0, 这样的页不参加按时间查找 */
+    if(0 == save_pack_temp){
+        save_buf_time[save_buf_fill] = FLASH_PAGE_TIME_NONE;
+        if(0 != utc_time.utc_m){
+            save_buf_time[save_buf_fill] = utc_get_minute(utc_time.utc_y, utc_time.utc_m, utc_time.utc_d, utc_time.utc_h, utc_time.utc_f);
+        }
+    }
+    
+    return accelerometer_data_temp[save_buf_fill]+20*save_pack_temp;
+}
+
+/**
+  * @brief  Take the frame written at save_frame_slot(), flush the page when full.
+  * @retval None
+  */
+void save_frame_commit(void)
+{
     save_pack_temp++;
     if(50 <= save_pack_temp)
     {
-        if(0 == (system_state.flash_data.flash_data_current_page%4)){
-            status = flash_sector_erase((FLASH_DATA_START+system_state.flash_data.flash_data_current_page)*FLASH_PAGE_LEN);
-        }
-        status = flash_write_data((FLASH_DATA_START+system_state.flash_data.flash_data_current_page)*FLASH_PAGE_LEN, (char *)accelerometer_data_temp, FLASH_WRITE_BUFF_LEN);
-        if (status == OK){
-            ES_LOG_PRINT("write accelerometer flash data OK, addr%u\n", (FLASH_DATA_START+system_state.flash_data.flash_data_current_page)*FLASH_PAGE_LEN);
-            
-            if(system_state.flash_data.flash_data_current_page+1 == system_state.flash_data.flash_data_send_page){
-                if(FLASH_DATA_END == system_state.flash_data.flash_data_send_page){
-                    system_state.flash_data.flash_data_send_page = FLASH_DATA_START;
-                }
-                else{
-                    system_state.flash_data.flash_data_send_page++;
-                }
-            }
-            system_state.flash_data.flash_data_current_page++;
-            if(FLASH_DATA_END < system_state.flash_data.flash_data_current_page){
-                system_state.flash_data.flash_data_current_page = FLASH_DATA_START;
-            }
-            save_pack_temp = 0;
-            
-            status = flash_sector_erase(0);
-            status = flash_write_data(0, (char *)(&system_state.flash_data), sizeof(flash_data_t));
-            if (status == OK){
-                ES_LOG_PRINT("write flash data OK!\n");
-            }
+        save_pack_temp = 0;
+        save_buf_full[save_buf_fill] = 1;
+        save_buf_fill ^= 1;
+        if(1 == save_buf_full[save_buf_fill]){
+            flash_stat.both_full_cnt++;
         }
+        set_task(MEM_WRITE, FLASH_WRITE_PAGE);
+    }
+}
+
+/**
+  * @brief  Append one 20 byte frame to the page buffer, flush the page when full.
+  * @param  frame: Pointer to the frame.
+  * @retval None
+  */
+void save_frame(uint8_t *frame)
+{
+    uint8_t *slot = save_frame_slot();
+    
+    if(NULL == slot){
+        return;
     }
     
-    if(1 == system_state.system_flg.imu_data_flg){
-        save_data_temp[3] = 0x01;
-        sum = 0;
-        for(i=0; i<19; i++){
-            sum += save_data_temp[i];
+    /* 保存至外部flash */
+    memcpy(slot, frame, 20);
+    save_frame_commit();
+}
+
+#if SAVE_CODEC_EN
+/**
+  * @brief  Store one raw sample into the pending compressed block. A new
+  *         block is started when it is full or the sample rate changed.
+  * @retval None
+  */
+void save_accelerometer(uint16_t ax, uint16_t ay, uint16_t az)
+{
+    codec_block_t *block = &save_block;
+    int16_t xyz[3];
+    uint8_t utc[6];
+    
+    xyz[0] = (int16_t)ax;
+    xyz[1] = (int16_t)ay;
+    xyz[2] = (int16_t)az;
+    
+    if(0 != block->cnt){
+        if((save_block_period == mpu6050_timeout) && (1 == codec_block_add(block, xyz))){
+            return;
         }
-        save_data_temp[19] = sum;
-        send_ble_data(save_data_temp, 20);
+        save_accelerometer_flush();
+    }
+    
+    utc[0] = utc_time.utc_y;
+    utc[1] = utc_time.utc_m;
+    utc[2] = utc_time.utc_d;
+    utc[3] = utc_time.utc_h;
+    utc[4] = utc_time.utc_f;
+    utc[5] = utc_time.utc_s;
+    save_block_period = mpu6050_timeout;
+    codec_block_start(block, utc, save_block_period, xyz);
+}
+
+/**
+  * @brief  Close the pending compressed block and queue it for flash.
+  * @retval None
+  */
+void save_accelerometer_flush(void)
+{
+    codec_block_t *block = &save_block;
+    uint16_t len = 0;
+    uint16_t i = 0;
+    
+    if(0 == block->cnt){
+        return;
+    }
+    
+    len = codec_block_finish(block);
+    for(i=0; i<len; i+=CODEC_SLOT_LEN){
+        save_frame(&block->buf[i]);
+    }
+    block->cnt = 0;
+}
+#else
+void save_accelerometer(uint16_t ax, uint16_t ay, uint16_t az)
+{
+    uint8_t *slot = save_frame_slot();
+    
+    if(NULL == slot){
+        return;
     }
+    
+    /* 直接写入页缓存 */
+    frame_pack_sample(slot, 0x03, ax, ay, az, &utc_time.utc_y);
+    save_frame_commit();
+}
+
+void save_accelerometer_flush(void)
+{
+}
+#endif
+
+/**
+  * @brief  Send one sample to the app while real time monitoring is on.
+  * @retval None
+  */
+void send_accelerometer(uint16_t ax, uint16_t ay, uint16_t az)
+{
+    uint8_t send_data_temp[20];
+    
+    frame_pack_sample(send_data_temp, 0x01, ax, ay, az, &utc_time.utc_y);
+    
+    send_ble_data(send_data_temp, 20);
+}
+
+/**
+  * @brief  Store a run-length marker: the previous sample repeated cnt times.
+  * @param  cnt: Number of unchanged samples.
+  * @param  utc: Time of the first unchanged sample.
+  * @retval None
+  */
+void save_still_marker(uint16_t cnt, utc_time_t *utc)
+{
+    uint8_t save_data_temp[20];
+    frame_packer_t packer;
+    
+    /* 先存前面的样本, 保持时间顺序 */
+    save_accelerometer_flush();
+    
+    /* [4-5] 次数, [6-9] 不用, [10-15] y m d h f s */
+    frame_open(&packer, save_data_temp, 0xd5, 0x05);
+    frame_put_u16(&packer, cnt);
+    frame_put_u16(&packer, 0);
+    frame_put_u16(&packer, 0);
+    frame_put_u8(&packer, utc->utc_y);
+    frame_put_u8(&packer, utc->utc_m);
+    frame_put_u8(&packer, utc->utc_d);
+    frame_put_u8(&packer, utc->utc_h);
+    frame_put_u8(&packer, utc->utc_f);
+    frame_put_u8(&packer, utc->utc_s);
+    frame_close(&packer);
+    
+    save_frame(save_data_temp);
 }
 
 int read_accelerometer_data(void)
 {
+    flash_page_head_t head;
     ald_status_t status;
+    uint16_t page = system_state.flash_data.flash_data_send_page;
+    uint32_t addr = 0;
+    
+    /* 一轮上传结束后在 FLASH_DATA_SEND 中归还 */
+    if(NULL == accelerometer_data_send_temp){
+        accelerometer_data_send_temp = pool_alloc(POOL_ARENA_UPLOAD, FLASH_READ_BUFF_LEN);
+        if(NULL == accelerometer_data_send_temp){
+            return -1;
+        }
+    }
+    
+    if(1 == flash_range.active){
+        page = flash_range.page;
+    }
     
+    /* 一次上传两页, 每页分5次读取 */
     if(4 < send_page_temp){
-        status = flash_read((FLASH_DATA_START+system_state.flash_data.flash_data_send_page+1)*FLASH_PAGE_LEN+(send_page_temp-5)*FLASH_READ_BUFF_LEN, (char *)(accelerometer_data_send_temp), FLASH_READ_BUFF_LEN);
-        ES_LOG_PRINT("addr:%u, page_temp:%u\n", (FLASH_DATA_START+system_state.flash_data.flash_data_send_page+1)*FLASH_PAGE_LEN+(send_page_temp-9)*FLASH_READ_BUFF_LEN, send_page_temp);
+        page = flash_next_page(page);
     }
-    else{
-        status = flash_read((FLASH_DATA_START+system_state.flash_data.flash_data_send_page)*FLASH_PAGE_LEN+send_page_temp*FLASH_READ_BUFF_LEN, (char *)(accelerometer_data_send_temp), FLASH_READ_BUFF_LEN);
-        ES_LOG_PRINT("addr:%u, page_temp:%u\n", (FLASH_DATA_START+system_state.flash_data.flash_data_send_page)*FLASH_PAGE_LEN+send_page_temp*FLASH_READ_BUFF_LEN, send_page_temp);
+    
+    /* 每页第一次读取时校验整页, CRC错误的页上传全0, 不当作数据 */
+    if(0 == (send_page_temp % 5)){
+        send_page_bad = (0 != flash_page_check(page, &head)) ? 1 : 0;
+        if(1 == send_page_bad){
+            flash_stat.corrupt_cnt++;
+            ES_LOG_PRINT("page %u crc err\n", page);
+        }
+    }
+    if(1 == send_page_bad){
+        memset(accelerometer_data_send_temp, 0, FLASH_READ_BUFF_LEN);
+        send_page_temp++;
+        return 0;
     }
+    
+    addr = (uint32_t)page * FLASH_PAGE_LEN + FLASH_PAGE_HEAD_LEN + (send_page_temp % 5) * FLASH_READ_BUFF_LEN;
+    status = flash_read(addr, (char *)(accelerometer_data_send_temp), FLASH_READ_BUFF_LEN);
+    ES_LOG_PRINT("addr:%u, page_temp:%u\n", addr, send_page_temp);
     if (status == OK){
         ES_LOG_PRINT("read flash data OK\n");
 
@@ -659,14 +2750,54 @@ int read_accelerometer_data(void)
     return -1;
 }
 
+/**
+  * @brief  The link is gone: drop the upload in progress. The read buffer
+  *         goes back to the pool and a round that was sent but not acked is
+  *         sent again, range and calibration uploads must be asked for again.
+  * @retval None
+  */
+void flash_upload_abort(void)
+{
+    send_page_temp = 0;
+    pool_arena_release(POOL_ARENA_UPLOAD);
+    accelerometer_data_send_temp = NULL;
+    system_state.system_flg.send_flash_data_flg = 0;
+    flash_range.active = 0;
+    flash_calib.upload = FLASH_CALIB_SESSION_MAX;
+}
+
+/**
+  * @brief  Append an upload ack record for the current read cursor.
+  *         Sector 0 is only erased once it is full of records.
+  * @retval 0 on success, -1 to retry.
+  */
 int save_flash_page_data(void)
 {
+    flash_data_t *flash_data = &system_state.flash_data;
+    flash_page_head_t head;
+    flash_ack_t ack;
     ald_status_t status;
     
-    status = flash_sector_erase(0);
-    status = flash_write_data(0, (char *)(&system_state.flash_data), sizeof(flash_data_t));
+    ack.page = flash_data->flash_data_send_page;
+    if((flash_data->flash_data_send_page != flash_data->flash_data_current_page) && (0 == flash_page_check(ack.page, &head))){
+        ack.seq = head.seq;
+    }
+    else{
+        ack.seq = flash_data->flash_data_seq;
+    }
+    ack.crc = crc16_calc(0xffff, (uint8_t *)&ack, sizeof(flash_ack_t) - sizeof(ack.crc));
+    
+    if(FLASH_ACK_MAX <= flash_data->flash_ack_slot){
+        if(OK != flash_sector_erase(FLASH_ACK_ADDR)){
+            return -1;
+        }
+        flash_data->flash_ack_slot = 0;
+    }
+    
+    status = flash_write_data(FLASH_ACK_ADDR + flash_data->flash_ack_slot * sizeof(flash_ack_t), (char *)&ack, sizeof(flash_ack_t));
+    flash_data->flash_ack_slot++;
     if (status == OK){
-        ES_LOG_PRINT("write flash data OK!\n");
+        ES_LOG_PRINT("write flash ack OK, page:%u, seq:%u\n", ack.page, ack.seq);
         return 0;
     }
     
@@ -5,7 +5,11 @@
 #include "md_conf.h"
 
 #include "bsp_system.h"
+#include "bsp_time.h"
 #include "bsp_common.h"
+#include "bsp_pool.h"
+
+#include "app_codec.h"
 
 //-----------各IO定义--------------------------
 
@@ -22,6 +26,42 @@
 #define PWR_FLASH_PIN                         GPIO_PIN_15
 
 #define FLASH_BUSY_TIMEOUT                    (50)
+#define FLASH_TPP_TIMEOUT                     (5)     //页编程最大时间 ms
+#define FLASH_TSE_TIMEOUT                     (400)   //扇区擦除最大时间 ms
+#define FLASH_CRC_TIMEOUT                     (2)     //页数据DMA算CRC的最长等待 ms
+
+/* 低功耗时flash进入深度掉电(0xB9)还是断电: 预计休眠时间小于 FLASH_DPD_MAX_MS 用深度掉电,
+   唤醒只需 tRES1, 不用重新上电和重建索引; 深度掉电超过 FLASH_DPD_MAX_MS 后改为断电 */
+#define FLASH_DPD_EN                          1
+#define FLASH_DPD_MAX_MS                      (10 * 60 * 1000)
+#define FLASH_TRES1_US                        (30)    //退出深度掉电最大时间 us
+#define FLASH_POWER_UP_MS                     (20)    //上电到可以操作的时间 ms
+
+/* 数据段用DMA传输, 小于 FLASH_DMA_MIN_LEN 的用查询方式
+ * 后台写页启动DMA后返回调度器, 读和启动/扫描时的写入等待DMA完成 */
+#define FLASH_DMA_EN                          1
+#define FLASH_DMA_TX_CH                       0
+#define FLASH_DMA_RX_CH                       1
+#define FLASH_DMA_MIN_LEN                     16
+#define FLASH_DMA_TIMEOUT                     (10)    //ms
+
+#define FLASH_DMA_BUSY                        0
+#define FLASH_DMA_DONE                        1
+#define FLASH_DMA_FAIL                        2
+
+/* 1: 原始样本按 app_codec.h 的压缩块存储, 0: 每个样本一帧(0x03) */
+#define SAVE_CODEC_EN                         1
+
+/* 1: 读数据时SPI时钟切到 FLASH_SPI_BAUD_FAST, 读完切回; 编程、擦除和读状态始终用 FLASH_SPI_BAUD_NORMAL
+   提速来自时钟: GD25Q16 普通读(0x03)的最高时钟远高于24MHz, 快速读(0x0B)只多一个空字节, 只在测速时对比
+   flash接在SPI0的单线管脚上, 不能用QSPI的双线/四线读 */
+#define FLASH_FAST_READ_EN                    1
+#define FLASH_SPI_BAUD_NORMAL                 SPI_BAUD_4      //48MHz/4=12MHz, 所有命令
+#define FLASH_SPI_BAUD_FAST                   SPI_BAUD_2      //48MHz/2=24MHz, 只用于读数据
+
+/* 1: 初始化时测试读取速度, 12MHz和24MHz各用查询方式和DMA方式读 FLASH_BENCH_LOOP 次 */
+#define FLASH_BENCH_EN                        0
+#define FLASH_BENCH_LOOP                      20
 
 #define FLASH_DATA_PAGE                       0
 #define FLASH_PAGE_LEN                        1024
@@ -29,8 +69,197 @@
 
 #define FLASH_READ_BUFF_LEN                   200
 
+/* 扇区0: 上传确认记录, 追加写入; 页4~1919: 数据页环形存储, 每页带页头;
+   页1920~2047: 姿态校准采样, 每次校准一段, 从扇区开头写起, 写满后覆盖最早的一段 */
+#define FLASH_SECTOR_LEN                      4096
+#define FLASH_PAGE_PER_SECTOR                 (FLASH_SECTOR_LEN/FLASH_PAGE_LEN)
 #define FLASH_DATA_START                      4
-#define FLASH_DATA_END                        2047
+#define FLASH_DATA_END                        1919
+#define FLASH_CALIB_START                     1920
+#define FLASH_CALIB_END                       2047
+
+#define FLASH_PAGE_MAGIC                      0x5aa5
+#define FLASH_PAGE_TIME_NONE                  0       //页头时间: 存这一页时还没有对时, 按时间上传时跳过
+#define FLASH_CALIB_MAGIC                     0xc5a5  //校准页页头, seq 高16位为段号, 低16位为段内页号
+#define FLASH_CALIB_FRAME_LEN                 20
+#define FLASH_CALIB_PAGE_FRAMES               (FLASH_WRITE_BUFF_LEN/FLASH_CALIB_FRAME_LEN)
+#define FLASH_CALIB_SESSION_MAX               8       //索引保存的最近校准段数
+#define FLASH_CALIB_NONE                      0xffff
+#define FLASH_ERASE_AHEAD                     2       //空闲时在写游标前预擦除的扇区数
+#define FLASH_PAGE_HEAD_LEN                   sizeof(flash_page_head_t)
+#define FLASH_PAGE_CRC_HEAD_LEN               (2 + 4 + 4)     //CRC包括的页头字段 len、seq、time
+
+#define FLASH_HIST_LEN                        16      //写页耗时分布的区间数
+
+#define FLASH_ACK_ADDR                        0
+#define FLASH_ACK_MAX                         (FLASH_SECTOR_LEN/sizeof(flash_ack_t))
+
+/* 旧版本: 扇区0开头存 flash_legacy_t, 第p页(4~2047)的数据存在 p+4 页, 没有页头 */
+#define FLASH_LEGACY_END                      2047
+#define FLASH_LEGACY_LOST                     2044    //从这一页起地址超出芯片, 回绕到扇区0, 数据已被覆盖
+
+/* 数据页页头, 先写数据再写页头, 页头有效则整页有效 */
+typedef struct {
+    uint16_t magic;
+    uint16_t len;                               //数据长度
+    uint32_t seq;                               //页序号, 每写一页加1
+    uint32_t time;                              //开始存这一页数据的时间, utc_get_minute(), 没有对时为 FLASH_PAGE_TIME_NONE
+    uint32_t crc;                               //len、seq、time和数据的CRC32, 硬件计算
+    
+} flash_page_head_t;
+
+/* 耗时统计, 单位 us */
+typedef struct {
+    uint32_t cnt;
+    uint32_t us_last;
+    uint32_t us_max;
+    uint32_t us_sum;
+    
+} flash_latency_t;
+
+typedef struct {
+    flash_latency_t flush;                      //写一个数据页(含擦除)
+    flash_latency_t erase;                      //扇区擦除
+    uint32_t timeout_cnt;                       //等待超时次数
+    uint32_t fail_cnt;                          //写入失败丢弃的页数
+    uint32_t both_full_cnt;                     //两个缓存同时等待写入的次数
+    uint32_t drop_cnt;                          //缓存满丢弃的数据条数
+    uint32_t erase_wait_cnt;                    //写页时没有预擦除扇区, 需要等待擦除的次数
+    uint32_t corrupt_cnt;                       //上传时CRC错误没有上传的页数
+    flash_latency_t wake_dpd;                   //深度掉电唤醒到可以写入
+    flash_latency_t wake_power;                 //断电唤醒到可以写入(含重建索引)
+    uint32_t dpd_cnt;                           //进入深度掉电次数
+    uint32_t power_cut_cnt;                     //断电次数(含深度掉电超时后断电)
+    uint32_t program_bytes;                     //编程写入的字节数, 包括页头和确认记录
+    uint32_t payload_bytes;                     //写入的数据页数据长度
+    uint16_t flush_hist[FLASH_HIST_LEN];        //写页耗时分布, 区间见 flash_hist_ms
+    
+} flash_stat_t;
+
+/* 寿命统计, 低功耗时保存到片内flash设置记录, 掉电会丢失上次保存后的计数 */
+typedef struct {
+    uint32_t data_erase;                        //数据扇区擦除次数合计
+    uint16_t ack_erase;                         //确认记录扇区擦除次数
+    uint16_t program_fail;                      //编程失败次数
+    uint16_t erase_fail;                        //擦除失败次数
+    uint16_t calib_erase;                       //校准扇区擦除次数
+    
+} flash_wear_t;
+
+/* READ_STATE_CMD STATE_FLASH_HEALTH 的内容 */
+typedef struct {
+    uint16_t sector_erase;                      //数据扇区擦除次数, 环形顺序写入, 各扇区基本相同
+    uint16_t ack_erase;
+    uint16_t write_amp;                         //写放大 x100, 编程字节数/数据字节数
+    uint8_t flush_p50;                          //写页耗时百分位, ms
+    uint8_t flush_p90;
+    uint8_t flush_p99;
+    uint16_t program_fail;
+    uint16_t erase_fail;
+    uint16_t buffered;                          //未上传的页数
+    
+} flash_health_t;
+
+typedef enum {
+    FLASH_POWER_ON = 0,
+    FLASH_POWER_DPD,                            //深度掉电, 保持供电, 游标有效
+    FLASH_POWER_OFF,                            //断电
+    
+}flash_power_e;
+
+/* 低功耗策略: 按以往休眠时间预计本次休眠时间 */
+typedef struct {
+    flash_power_e state;
+    uint32_t sleep_tick;                        //进入低功耗的时间 ms
+    uint32_t sleep_avg_ms;                      //休眠时间的滑动平均
+    
+}flash_power_t;
+
+typedef enum {
+    FLASH_WRITER_IDLE = 0,
+    FLASH_WRITER_ERASE,
+    FLASH_WRITER_ERASE_WAIT,
+    FLASH_WRITER_PROGRAM,
+    FLASH_WRITER_HEAD,
+    FLASH_WRITER_PROGRAM_WAIT,
+    FLASH_WRITER_DONE,
+    FLASH_WRITER_RESERVE,                       //预擦除完成
+    FLASH_WRITER_DMA_WAIT,                      //数据段DMA传输中, CS保持低
+    
+}flash_writer_e;
+
+/* 写游标前已擦除的扇区 */
+typedef struct {
+    uint16_t page;                              //下一个写入扇区的第一页
+    uint8_t cnt;                                //从 page 开始连续已擦除的扇区数
+    
+}flash_reserve_t;
+
+/* 后台写页状态机, 每次调用只发一条flash命令 */
+typedef struct {
+    flash_writer_e state;
+    flash_writer_e next;                        //等待结束后的状态
+    uint8_t buf;                                //正在写的缓存
+    uint16_t page;
+    uint16_t offset;                            //已编程的数据长度
+    uint32_t tick;                              //命令开始时间 ms
+    uint32_t start;                             //写页开始 DWT
+    uint32_t erase_start;
+    uint32_t crc;                               //DMA计算的数据CRC
+    flash_page_head_t head;
+    
+}flash_writer_t;
+
+/* 按时间范围上传, 不影响读游标和确认记录 */
+typedef struct {
+    uint8_t active;
+    uint16_t page;                              //下一轮上传的第一页
+    uint32_t end;                               //结束时间, 0 表示到最新
+    
+}flash_range_t;
+
+/* 一段校准采样, 页在校准区内连续(可回绕) */
+typedef struct {
+    uint16_t id;                                //段号, 每次校准加1
+    uint16_t page;                              //第一页, 扇区开头
+    uint16_t frames;                            //已写入flash的采样帧数
+    uint32_t time;                              //开始时间, utc_get_minute()
+    
+}flash_calib_session_t;
+
+/* 校准采样写入状态和段索引, 索引第一次使用时扫描校准区页头建立 */
+typedef struct {
+    uint8_t scanned;
+    uint8_t active;                             //正在采集
+    uint8_t full;                               //本段写满整个校准区, 之后的采样丢弃
+    uint8_t cnt;                                //索引中的段数
+    uint8_t upload;                             //正在上传的段, 索引下标
+    uint16_t id;                                //下一段的段号
+    uint16_t page;                              //下一个写入页
+    uint16_t erased;                            //已擦除的扇区第一页, FLASH_CALIB_NONE 表示没有
+    uint16_t seq;                               //本段下一页的段内页号
+    uint16_t len;                               //页缓存中的数据长度
+    uint16_t drop_cnt;                          //写满后丢弃的帧数
+    flash_calib_session_t session[FLASH_CALIB_SESSION_MAX];     //按时间从早到晚
+    uint8_t *buf;                               //页缓存, 采集期间从内存池租用
+    
+}flash_calib_t;
+
+/* 上传确认记录: 该页之前的数据已上传 */
+typedef struct {
+    uint32_t seq;                               //下一个未上传页的序号
+    uint16_t page;                              //下一个未上传页
+    uint16_t crc;                               //seq和page的CRC16
+    
+} flash_ack_t;
+
+/* 旧版本的索引, 第一次启动时转换未上传的页 */
+typedef struct {
+    uint8_t data_flag;                          //0xaa
+    uint16_t current_page;
+    uint16_t send_page;
+    
+} flash_legacy_t;
 
 typedef struct {
     uint8_t data_flag;
@@ -54,8 +283,20 @@ void init_system_info(system_state_t *system_state);
 
 int save_system_info(void);
 
+uint8_t *save_frame_slot(void);
+
+void save_frame_commit(void);
+
+void save_frame(uint8_t *frame);
+
 void save_accelerometer(uint16_t ax, uint16_t ay, uint16_t az);
 
+void save_accelerometer_flush(void);
+
+void send_accelerometer(uint16_t ax, uint16_t ay, uint16_t az);
+
+void save_still_marker(uint16_t cnt, utc_time_t *utc);
+
 ald_status_t flash_write_data(uint32_t addr, char *buf, uint16_t size);
 
 ald_status_t flash_sector_erase(uint32_t addr);
@@ -64,7 +305,37 @@ ald_status_t flash_read(uint32_t addr, char *buf, uint16_t size);
 
 int read_accelerometer_data(void);
 
+void flash_upload_abort(void);
+
 int save_flash_page_data(void);
+
+int flash_writer_run(void);
+
+void flash_writer_sync(void);
+
+void flash_writer_idle(void);
+
+void flash_health_get(flash_health_t *health);
+
+int flash_range_start(uint32_t start, uint32_t end);
+
+uint8_t flash_range_ready(void);
+
+void flash_range_next(void);
+
+int flash_calib_start(void);
+
+uint8_t *flash_calib_slot(void);
+
+void flash_calib_commit(void);
+
+void flash_calib_save(uint8_t *frame);
+
+void flash_calib_stop(void);
+
+int flash_calib_select(uint8_t index);
+
+uint8_t flash_calib_read(uint16_t *frame, uint8_t *buf, uint8_t cnt);
 #endif
 
 
@@ -209,7 +209,12 @@ static void mpu_set_lpf(uint16_t lpf)
     return;
 }
 
-static void mpu_set_rate(uint16_t rate)
+/**
+  * @brief  Set sample rate and the matching DLPF bandwidth (rate/2).
+  * @param  rate: Sample rate in Hz, 4~1000.
+  * @retval None
+  */
+void mpu_set_rate(uint16_t rate)
 {
     uint8_t data;
     if(rate>1000){
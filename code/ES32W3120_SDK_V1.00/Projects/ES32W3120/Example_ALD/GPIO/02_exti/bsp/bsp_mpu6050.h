@@ -18,6 +18,8 @@
 
 void mpu_get_accelerometer(short *ax, short *ay, short *az);
 
+void mpu_set_rate(uint16_t rate);
+
 void mpu6050_init(void);
 
 void mpu6050_quick_init(void);
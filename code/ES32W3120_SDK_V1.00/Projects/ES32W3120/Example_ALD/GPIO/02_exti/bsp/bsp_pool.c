@@ -0,0 +1,123 @@
+#include "bsp_pool.h"
+
+/* Private Macros ------------------------------------------------------------ */
+
+/* Private Variables --------------------------------------------------------- */
+/* 按字对齐, 块会用DMA送SPI和CRC */
+static uint32_t pool_large[POOL_LARGE_NUM][(POOL_LARGE_LEN + 3) / 4];
+static uint32_t pool_small[POOL_SMALL_NUM][(POOL_SMALL_LEN + 3) / 4];
+static uint8_t pool_large_owner[POOL_LARGE_NUM] = {0};    //租用的 arena + 1, POOL_FREE 为空闲
+static uint8_t pool_small_owner[POOL_SMALL_NUM] = {0};
+
+/* Public Variables ---------------------------------------------------------- */
+pool_stat_t pool_stat = {0};
+
+/* Private Constants --------------------------------------------------------- */
+
+/* Private function prototypes ----------------------------------------------- */
+
+/* Private Function ---------------------------------------------------------- */
+
+/* Exported Variables -------------------------------------------------------- */
+
+static void pool_count(pool_arena_e arena, int8_t delta, uint8_t large)
+{
+    pool_arena_stat_t *stat = &pool_stat.arena[arena];
+    
+    stat->used += delta;
+    if(stat->high < stat->used){
+        stat->high = stat->used;
+    }
+    
+    if(large){
+        pool_stat.large_used += delta;
+        if(pool_stat.large_high < pool_stat.large_used){
+            pool_stat.large_high = pool_stat.large_used;
+        }
+    }
+    else{
+        pool_stat.small_used += delta;
+        if(pool_stat.small_high < pool_stat.small_used){
+            pool_stat.small_high = pool_stat.small_used;
+        }
+    }
+}
+
+/**
+  * @brief  Lease a block. Small requests take a small block and fall back to
+  *         a large one, so an idle large block is never wasted.
+  * @param  arena: Function that holds the block.
+  * @param  size: Bytes needed, at most POOL_LARGE_LEN.
+  * @retval Word aligned block, NULL if none is free.
+  */
+void *pool_alloc(pool_arena_e arena, uint16_t size)
+{
+    uint8_t i = 0;
+    
+    if(POOL_SMALL_LEN >= size){
+        for(i=0; i<POOL_SMALL_NUM; i++){
+            if(POOL_FREE == pool_small_owner[i]){
+                pool_small_owner[i] = arena + 1;
+                pool_count(arena, 1, 0);
+                return pool_small[i];
+            }
+        }
+    }
+    if(POOL_LARGE_LEN >= size){
+        for(i=0; i<POOL_LARGE_NUM; i++){
+            if(POOL_FREE == pool_large_owner[i]){
+                pool_large_owner[i] = arena + 1;
+                pool_count(arena, 1, 1);
+                return pool_large[i];
+            }
+        }
+    }
+    
+    pool_stat.arena[arena].fail_cnt++;
+    
+    return NULL;
+}
+
+/**
+  * @brief  Give a block back, NULL is ignored.
+  * @retval None
+  */
+void pool_free(void *block)
+{
+    uint8_t i = 0;
+    
+    for(i=0; i<POOL_SMALL_NUM; i++){
+        if((block == pool_small[i]) && (POOL_FREE != pool_small_owner[i])){
+            pool_count((pool_arena_e)(pool_small_owner[i] - 1), -1, 0);
+            pool_small_owner[i] = POOL_FREE;
+            return;
+        }
+    }
+    for(i=0; i<POOL_LARGE_NUM; i++){
+        if((block == pool_large[i]) && (POOL_FREE != pool_large_owner[i])){
+            pool_count((pool_arena_e)(pool_large_owner[i] - 1), -1, 1);
+            pool_large_owner[i] = POOL_FREE;
+            return;
+        }
+    }
+}
+
+/**
+  * @brief  Give back every block the arena holds, when its mode ends.
+  * @retval None
+  */
+void pool_arena_release(pool_arena_e arena)
+{
+    uint8_t i = 0;
+    
+    for(i=0; i<POOL_SMALL_NUM; i++){
+        if(arena + 1 == pool_small_owner[i]){
+            pool_free(pool_small[i]);
+        }
+    }
+    for(i=0; i<POOL_LARGE_NUM; i++){
+        if(arena + 1 == pool_large_owner[i]){
+            pool_free(pool_large[i]);
+        }
+    }
+}
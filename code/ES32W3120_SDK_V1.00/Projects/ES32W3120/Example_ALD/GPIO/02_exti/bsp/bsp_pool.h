@@ -0,0 +1,53 @@
+#ifndef __BSP_POOL_H
+#define __BSP_POOL_H
+
+#include "ald_conf.h"
+#include "md_conf.h"
+
+#include "global.h"
+
+/*
+ * 固定块内存池, 代替各功能各自占用的静态缓存. 大块给flash页缓存, 小块给上传读缓存.
+ * 块按功能(arena)租用, 记录每个功能的占用和最高占用. 只在任务中调用, 不在中断中调用.
+ *   记录: 数据页乒乓缓存, 两个大块, 进入校准时空闲的一个借给校准
+ *   校准: 校准页缓存, 一个大块, 结束校准时归还
+ *   上传: 存储数据和校准数据的上传读缓存, 小块
+ */
+#define POOL_LARGE_LEN                        1000    //FLASH_WRITE_BUFF_LEN
+#define POOL_LARGE_NUM                        2
+#define POOL_SMALL_LEN                        200     //FLASH_READ_BUFF_LEN
+#define POOL_SMALL_NUM                        2
+
+#define POOL_FREE                             0
+
+typedef enum {
+    POOL_ARENA_LOG = 0,
+    POOL_ARENA_CALIBRATE,
+    POOL_ARENA_UPLOAD,
+    POOL_ARENA_NUM,
+    
+}pool_arena_e;
+
+typedef struct {
+    uint8_t used;                               //占用的块数
+    uint8_t high;                               //最高占用
+    uint16_t fail_cnt;                          //没有空闲块的次数
+    
+}pool_arena_stat_t;
+
+typedef struct {
+    pool_arena_stat_t arena[POOL_ARENA_NUM];
+    uint8_t large_used;
+    uint8_t large_high;
+    uint8_t small_used;
+    uint8_t small_high;
+    
+}pool_stat_t;
+
+void *pool_alloc(pool_arena_e arena, uint16_t size);
+
+void pool_free(void *block);
+
+void pool_arena_release(pool_arena_e arena);
+
+#endif
@@ -0,0 +1,336 @@
+#include "bsp_settings.h"
+#include "bsp_common.h"
+#include "bsp_flash.h"
+
+/* Private Macros ------------------------------------------------------------ */
+
+/* Private Variables --------------------------------------------------------- */
+static uint32_t settings_page = 0;              //当前页地址, 0 表示还没有设置记录
+static uint16_t settings_slot = 0;              //下一条空记录
+static uint32_t settings_gen = 0;
+
+/* Public Variables ---------------------------------------------------------- */
+settings_stat_t settings_stat = {0};
+
+/* Private Constants --------------------------------------------------------- */
+
+/* Private function prototypes ----------------------------------------------- */
+
+/* Private Function ---------------------------------------------------------- */
+
+/* Exported Variables -------------------------------------------------------- */
+
+static void settings_irq_time(uint32_t cycles)
+{
+    settings_stat.irq_us_last = cycles / DWT_CYCLE_PER_US;
+    if(settings_stat.irq_us_max < settings_stat.irq_us_last){
+        settings_stat.irq_us_max = settings_stat.irq_us_last;
+    }
+}
+
+/**
+  * @brief  Program words two at a time, interrupts are only off for one
+  *         double word.
+  * @param  addr: 8 byte aligned flash address.
+  * @param  buf: words to write.
+  * @param  cnt: number of words, even.
+  * @retval 0 on success.
+  */
+static int settings_program(uint32_t addr, const uint32_t *buf, uint8_t cnt)
+{
+    uint32_t start = 0;
+    uint32_t ret = 0;
+    uint8_t i = 0;
+    
+    for(i=0; i<cnt; i+=2){
+        start = dwt_get_cycle();
+        __disable_irq();
+        ret = IAP_DWORDPROGRAM(addr + i * 4, buf[i], buf[i + 1], IAP_FREQUENCE_48M);
+        __enable_irq();
+        settings_irq_time(dwt_get_cycle() - start);
+        
+        if(RESET == ret){
+            settings_stat.fail_cnt++;
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+static int settings_erase(uint32_t addr)
+{
+    uint32_t start = dwt_get_cycle();
+    uint32_t ret = 0;
+    
+    __disable_irq();
+    ret = IAP_PAGEERASE(addr, IAP_FREQUENCE_48M);
+    __enable_irq();
+    settings_irq_time(dwt_get_cycle() - start);
+    
+    if(RESET == ret){
+        settings_stat.fail_cnt++;
+        return -1;
+    }
+    
+    return 0;
+}
+
+static uint8_t settings_record_blank(const settings_record_t *record)
+{
+    const uint32_t *word = (const uint32_t *)record;
+    uint8_t i = 0;
+    
+    for(i=0; i<SETTINGS_RECORD_LEN/4; i++){
+        if(0xffffffff != word[i]){
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static uint16_t settings_record_crc(const settings_record_t *record)
+{
+    uint16_t crc = crc16_calc(0xffff, &record->key, 2);
+    
+    return crc16_calc(crc, record->value, record->len);
+}
+
+static uint8_t settings_record_valid(const settings_record_t *record)
+{
+    if((0 == record->key) || (SETTINGS_KEY_NUM <= record->key) || (SETTINGS_VALUE_LEN < record->len)){
+        return 0;
+    }
+    
+    return (record->crc == settings_record_crc(record)) ? 1 : 0;
+}
+
+/**
+  * @brief  Latest valid record of a key in a page, later records win and
+  *         torn records are skipped.
+  * @retval Record in flash, NULL if the key was never written.
+  */
+static const settings_record_t *settings_find(uint32_t page, uint8_t key)
+{
+    const settings_record_t *record = (const settings_record_t *)page;
+    const settings_record_t *found = NULL;
+    uint16_t i = 0;
+    
+    for(i=1; i<SETTINGS_RECORD_MAX; i++){
+        if(1 == settings_record_blank(&record[i])){
+            break;
+        }
+        if((key == record[i].key) && (1 == settings_record_valid(&record[i]))){
+            found = &record[i];
+        }
+    }
+    
+    return found;
+}
+
+/**
+  * @brief  Build a record and program it into a free slot.
+  * @retval 0 on success.
+  */
+static int settings_write(uint32_t addr, uint8_t key, const void *value, uint8_t len)
+{
+    uint32_t buf[SETTINGS_RECORD_LEN / 4];
+    settings_record_t *record = (settings_record_t *)buf;
+    
+    memset(buf, 0xff, sizeof(buf));
+    record->key = key;
+    record->len = len;
+    memcpy(record->value, value, len);
+    record->crc = settings_record_crc(record);
+    
+    return settings_program(addr, buf, SETTINGS_RECORD_LEN / 4);
+}
+
+/**
+  * @brief  Turn the whole-page system_info_t of the old firmware in page A
+  *         into key records of a new page, the same records as
+  *         save_system_info() writes.
+  * @param  page: New page, erased.
+  * @param  slot: First free record, advanced past the copied records.
+  * @retval 0 on success.
+  */
+static int settings_legacy_copy(uint32_t page, uint16_t *slot)
+{
+    system_info_t system_info;
+    uint8_t correct[7];
+    
+    memcpy(&system_info, (const void *)SETTINGS_PAGE_A, sizeof(system_info));
+    if(0xaa != system_info.data_flag){
+        return 0;
+    }
+    
+    correct[0] = system_info.mpu6050_correct_flag;
+    memcpy(&correct[1], &system_info.correct_ax, 2);
+    memcpy(&correct[3], &system_info.correct_ay, 2);
+    memcpy(&correct[5], &system_info.correct_az, 2);
+    
+    if(0 != settings_write(page + (*slot)++ * SETTINGS_RECORD_LEN, SETTINGS_KEY_SHAKE_FRE, &system_info.shake_fre, 1)){
+        return -1;
+    }
+    if(0 != settings_write(page + (*slot)++ * SETTINGS_RECORD_LEN, SETTINGS_KEY_WXID, system_info.wxid, 4)){
+        return -1;
+    }
+    if(0 != settings_write(page + (*slot)++ * SETTINGS_RECORD_LEN, SETTINGS_KEY_CORRECT, correct, sizeof(correct))){
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+  * @brief  Copy the latest value of every key into the other page, then
+  *         write its header. Until the header is written the old page stays
+  *         current, so a power loss during the copy loses nothing. The first
+  *         log starts on page B: page A still holds the old firmware's
+  *         system_info_t, which is copied over as records and only erased by
+  *         a later compaction.
+  * @retval 0 on success.
+  */
+static int settings_gc(void)
+{
+    const settings_record_t *record = NULL;
+    settings_head_t head;
+    uint32_t page = (SETTINGS_PAGE_B == settings_page) ? SETTINGS_PAGE_A : SETTINGS_PAGE_B;
+    uint16_t slot = 1;
+    uint8_t key = 0;
+    
+    settings_stat.gc_cnt++;
+    
+    if(0 != settings_erase(page)){
+        return -1;
+    }
+    
+    if(0 == settings_page){
+        if(0 != settings_legacy_copy(page, &slot)){
+            return -1;
+        }
+    }
+    else{
+        for(key=1; key<SETTINGS_KEY_NUM; key++){
+            record = settings_find(settings_page, key);
+            if(NULL == record){
+                continue;
+            }
+            if(0 != settings_program(page + slot * SETTINGS_RECORD_LEN, (const uint32_t *)record, SETTINGS_RECORD_LEN / 4)){
+                return -1;
+            }
+            slot++;
+        }
+    }
+    
+    memset(&head, 0xff, sizeof(head));
+    head.magic = SETTINGS_MAGIC;
+    head.gen = settings_gen + 1;
+    if(0 != settings_program(page, (const uint32_t *)&head, 2)){
+        return -1;
+    }
+    
+    ES_LOG_PRINT("settings gc to %x, gen:%u, records:%u\n", page, head.gen, slot - 1);
+    
+    settings_page = page;
+    settings_slot = slot;
+    settings_gen = head.gen;
+    
+    return 0;
+}
+
+/**
+  * @brief  Pick the page with the newest header and find its first free
+  *         record.
+  * @retval None
+  */
+void settings_init(void)
+{
+    const settings_head_t *head_a = (const settings_head_t *)SETTINGS_PAGE_A;
+    const settings_head_t *head_b = (const settings_head_t *)SETTINGS_PAGE_B;
+    const settings_record_t *record = NULL;
+    
+    settings_page = 0;
+    settings_slot = 0;
+    settings_gen = 0;
+    
+    if(SETTINGS_MAGIC == head_a->magic){
+        settings_page = SETTINGS_PAGE_A;
+        settings_gen = head_a->gen;
+    }
+    if((SETTINGS_MAGIC == head_b->magic) && ((0 == settings_page) || (head_b->gen > settings_gen))){
+        settings_page = SETTINGS_PAGE_B;
+        settings_gen = head_b->gen;
+    }
+    if(0 == settings_page){
+        return;
+    }
+    
+    record = (const settings_record_t *)settings_page;
+    for(settings_slot=1; settings_slot<SETTINGS_RECORD_MAX; settings_slot++){
+        if(1 == settings_record_blank(&record[settings_slot])){
+            break;
+        }
+    }
+    
+    ES_LOG_PRINT("settings page %x, gen:%u, slot:%u\n", settings_page, settings_gen, settings_slot);
+}
+
+/**
+  * @brief  Read the latest value of a key.
+  * @retval 0 if found with the expected length.
+  */
+int settings_get(uint8_t key, void *value, uint8_t len)
+{
+    const settings_record_t *record = NULL;
+    
+    if(0 == settings_page){
+        return -1;
+    }
+    
+    record = settings_find(settings_page, key);
+    if((NULL == record) || (len != record->len)){
+        return -1;
+    }
+    
+    memcpy(value, record->value, len);
+    
+    return 0;
+}
+
+/**
+  * @brief  Append a record if the value changed, compacting into the other
+  *         page when the current one is full.
+  * @retval 0 on success.
+  */
+int settings_set(uint8_t key, const void *value, uint8_t len)
+{
+    const settings_record_t *found = NULL;
+    
+    if((0 == key) || (SETTINGS_KEY_NUM <= key) || (SETTINGS_VALUE_LEN < len)){
+        return -1;
+    }
+    
+    if(0 != settings_page){
+        found = settings_find(settings_page, key);
+        if((NULL != found) && (len == found->len) && (0 == memcmp(found->value, value, len))){
+            return 0;
+        }
+    }
+    
+    if((0 == settings_page) || (SETTINGS_RECORD_MAX <= settings_slot)){
+        if(0 != settings_gc()){
+            return -1;
+        }
+    }
+    
+    /* 写坏的记录也不再是空白, 下次写到后面 */
+    settings_slot++;
+    if(0 != settings_write(settings_page + (settings_slot - 1) * SETTINGS_RECORD_LEN, key, value, len)){
+        return -1;
+    }
+    settings_stat.write_cnt++;
+    
+    return 0;
+}
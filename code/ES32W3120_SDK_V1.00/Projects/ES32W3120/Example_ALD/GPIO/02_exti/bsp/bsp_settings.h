@@ -0,0 +1,65 @@
+#ifndef __BSP_SETTINGS_H
+#define __BSP_SETTINGS_H
+
+#include "ald_conf.h"
+#include "md_conf.h"
+
+#include "global.h"
+
+/*
+ * 片内flash两页轮流使用的设置记录, 修改设置只追加一条记录, 不擦除.
+ * 第0条为页头, 页写满时把每个key的最新值复制到另一页, 最后写页头.
+ */
+#define SETTINGS_PAGE_A                       0x10000
+#define SETTINGS_PAGE_B                       0x10400
+#define SETTINGS_PAGE_LEN                     1024
+#define SETTINGS_RECORD_LEN                   sizeof(settings_record_t)
+#define SETTINGS_RECORD_MAX                   (SETTINGS_PAGE_LEN/SETTINGS_RECORD_LEN)
+#define SETTINGS_VALUE_LEN                    12
+#define SETTINGS_MAGIC                        0x3153564b      //"KVS1"
+
+typedef enum {
+    SETTINGS_KEY_SHAKE_FRE = 1,                 //震动提醒频率
+    SETTINGS_KEY_WXID,                          //wxid[4]
+    SETTINGS_KEY_CORRECT,                       //校准标志 + ax ay az
+    SETTINGS_KEY_FLASH_WEAR,                    //外部flash擦除和失败次数, flash_wear_t
+    SETTINGS_KEY_BLE_BAUD,                      //和蓝牙模块通上的波特率, uint32_t
+    SETTINGS_KEY_RAW_LOG,                       //原始数据记录开关, uint8_t
+    SETTINGS_KEY_NUM,
+    
+}settings_key_e;
+
+/* 一条记录, 按两个双字编程, 第二个双字没写完时CRC不对 */
+typedef struct {
+    uint8_t key;
+    uint8_t len;
+    uint16_t crc;                               //key、len和value的CRC16
+    uint8_t value[SETTINGS_VALUE_LEN];
+    
+}settings_record_t;
+
+/* 页头, 占第0条记录的位置 */
+typedef struct {
+    uint32_t magic;
+    uint32_t gen;                               //每次整理加1, 大的为当前页
+    uint32_t reserve[2];
+    
+}settings_head_t;
+
+/* 关中断时间, 单位 us */
+typedef struct {
+    uint32_t irq_us_last;
+    uint32_t irq_us_max;                        //写记录只关一次双字编程, 整理时包括一次页擦除
+    uint32_t write_cnt;
+    uint32_t gc_cnt;
+    uint32_t fail_cnt;
+    
+}settings_stat_t;
+
+void settings_init(void);
+
+int settings_get(uint8_t key, void *value, uint8_t len);
+
+int settings_set(uint8_t key, const void *value, uint8_t len);
+
+#endif
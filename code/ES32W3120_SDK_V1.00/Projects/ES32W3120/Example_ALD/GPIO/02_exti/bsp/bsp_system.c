@@ -38,6 +38,8 @@ void init_system(void)
     
     time_init();
     
+    dwt_init();
+    
     /* 开启一些广播模式下的初始任务 */
     start_init_task();
     
@@ -31,7 +31,8 @@ typedef struct {
     uint16_t send_flash_data_flg   :1;
     
     uint16_t device_init_flg       :1;
-    uint16_t reserve_flag          :3;
+    uint16_t raw_log_flg           :1;
+    uint16_t reserve_flag          :2;
     
 }system_flg_t;
 
@@ -39,6 +40,8 @@ typedef struct {
     uint8_t data_flag;
     uint16_t flash_data_current_page;
     uint16_t flash_data_send_page;
+    uint32_t flash_data_seq;            //下一个数据页的序号
+    uint16_t flash_ack_slot;            //下一个确认记录的位置
     
 } flash_data_t;
 
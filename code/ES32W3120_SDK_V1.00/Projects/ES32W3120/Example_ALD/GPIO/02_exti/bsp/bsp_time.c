@@ -31,10 +31,8 @@ uint8_t mpu6050_timeout = MPU6050_NORMAL_TIMEOUT;
 
 /* Exported Variables -------------------------------------------------------- */
 extern adc_handle_t g_h_adc;
-extern uint8_t g_rx_len;
 extern system_state_t system_state;
 extern uint8_t key_click_flg;
-extern uint8_t g_rx_buf[UART_RX_BUF_LEN];
 
 /**
   * @brief  ald timer period elapsed callback
@@ -109,30 +107,6 @@ void ald_timer_period_elapsed_callback(struct timer_handle_s *arg)
 //        ald_adc_normal_start_by_it(&g_h_adc);
     }
     
-//    串口数据读取
-    if(1 == time_flg.uart_timeout_flg){
-        time_cnt.uart_timeout_cnt++;
-        if(2 <= time_cnt.uart_timeout_cnt){
-            time_cnt.uart_timeout_cnt = 0;
-            time_flg.uart_timeout_flg = 0;
-            g_rx_len = 0;
-            if(0 == system_state.system_flg.dx_bt24_t_poweron_flg){
-                if(NULL != strstr((const char*)g_rx_buf, "Power On")){
-                    system_state.system_flg.dx_bt24_t_poweron_flg = 1;
-                }
-            }
-            else{
-                if(1 == system_state.system_flg.dx_bt24_t_init_flg){
-                    set_task(BLUETOOTH, DATA_DECODE);
-                }
-                else{
-                    time_flg.at_cmd_flg = 1;
-                }
-            }
-            
-        }
-    }
-    
 //    6050数据读取和电池电量读取
     if((E_ADV_MODE == system_state.system_mode) || (E_CONNECT_MODE == system_state.system_mode)){
         if(1 == system_state.system_flg.mpu6050_init_flg){
@@ -268,4 +242,13 @@ void time_init(void)
     return;
 }
 
+/**
+  * @brief  Pack a time to minute resolution so that later times compare
+  *         greater: y[26:20] m[19:16] d[15:11] h[10:6] f[5:0].
+  * @retval Packed time.
+  */
+uint32_t utc_get_minute(uint8_t utc_y, uint8_t utc_m, uint8_t utc_d, uint8_t utc_h, uint8_t utc_f)
+{
+    return ((uint32_t)(utc_y & 0x7f) << 20) | ((uint32_t)(utc_m & 0x0f) << 16) | ((uint32_t)(utc_d & 0x1f) << 11) | ((uint32_t)(utc_h & 0x1f) << 6) | (utc_f & 0x3f);
+}
 
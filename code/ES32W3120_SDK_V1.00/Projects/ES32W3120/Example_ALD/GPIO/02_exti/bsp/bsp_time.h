@@ -5,6 +5,8 @@
 
 #include "bsp_common.h"
 
+#define TIME_TICK_MS               10              //定时器中断周期
+
 #define MPU6050_NORMAL_TIMEOUT     50
 #define MPU6050_CALIBRATE_TIMEOUT  2
 
@@ -18,7 +20,6 @@
 
 typedef struct {
     uint32_t time_1s_cnt;
-    uint32_t uart_timeout_cnt;
     uint8_t mpu6050_data_cnt;
     uint16_t adc_check_cnt;
     uint8_t led_twinkle_cnt;
@@ -31,7 +32,7 @@ typedef struct {
 }timer_cnt_t;
 
 typedef struct {
-    uint8_t uart_timeout_flg  :1;
+    uint8_t reserve           :1;
     uint8_t led_twinkle_flg   :1;
     uint8_t at_cmd_flg        :1;
     uint8_t calibrate_flg     :1;
@@ -56,6 +57,8 @@ typedef struct {
 
 void time_init(void);
 
+uint32_t utc_get_minute(uint8_t utc_y, uint8_t utc_m, uint8_t utc_d, uint8_t utc_h, uint8_t utc_f);
+
 #endif
 
 
@@ -4,9 +4,11 @@
 #include "bsp_dx_bt24_t.h"
 #include "bsp_time.h"
 #include "bsp_system.h"
+#include "bsp_flash.h"
 
 #include "app_ble.h"
 #include "app_common.h"
+#include "app_frame.h"
 #include "app_calculate.h"
 
 #include "task_bluetooth.h"
@@ -27,24 +29,19 @@ uint16_t calibrate_send_packet_cnt = 0;
 /* Private Function ---------------------------------------------------------- */
 
 /* Exported Variables -------------------------------------------------------- */
-extern uint8_t g_rx_buf[UART_RX_BUF_LEN];
-extern uint8_t ble_rx_buf[UART_RX_BUF_LEN];
 extern timer_cnt_t time_cnt;
 extern timer_flg_t time_flg;
-extern uint8_t g_rx_len;
 extern system_state_t system_state;
 extern uint8_t mpu6050_timeout;
-//extern uint8_t *calibrate_data_p;
-extern uint8_t calibrate_data_p[15000];
-extern uint16_t calibrate_packet_cnt;
 
 
 uint8_t bluetooth_task(uint8_t prio)
 {
     uint8_t m_SYS_SubTask_prio=0;
-    uint8_t i = 0;
-    uint8_t ble_send_temp[200];
-    uint8_t sum = 0;
+    uint8_t ble_send_temp[20];
+    frame_packer_t packer;
+    uint8_t *chunk = NULL;
+    uint8_t cnt = 0;
 //    uint8_t tx_temp[20];
     
     ES_LOG_PRINT("bluetooth_task\n");
@@ -56,53 +53,42 @@ uint8_t bluetooth_task(uint8_t prio)
         {
             case DATA_DECODE:
             {
-                ES_LOG_PRINT("receive data: ");
-                for(i=0; i<20; i++)
-                {
-                    ES_LOG_PRINT("%.2x", g_rx_buf[i]);
-                }
-                ES_LOG_PRINT("\n");
-//                ES_LOG_PRINT("receive data: %s\n", g_rx_buf);
-//                send_ble_data(g_rx_buf, 20);
-                memcpy(ble_rx_buf, g_rx_buf, UART_RX_BUF_LEN);
-                memset(g_rx_buf, 0, UART_RX_BUF_LEN);
-                ble_data_decode();
+                /* 一次空闲中断可能收到几帧, 不足一帧的留到下次 */
+                ble_data_parse();
             }
                 break;
             
             case SEND_CALIBRATE_DATA:
             {
-//                if(NULL != calibrate_data_p){
-                    if(10 < (calibrate_packet_cnt - calibrate_send_packet_cnt)){
-                        memset(ble_send_temp, 0, 200);
-                        memcpy(ble_send_temp, calibrate_data_p+20*calibrate_send_packet_cnt, 200);
-                        send_ble_data(ble_send_temp, 200);
-                        calibrate_send_packet_cnt += 10;
-                        
-                        return false;
-                    }
-                    else{
-                        memset(ble_send_temp, 0, 200);
-                        memcpy(ble_send_temp, calibrate_data_p+20*calibrate_send_packet_cnt, 20*(calibrate_packet_cnt - calibrate_send_packet_cnt));
-                        send_ble_data(ble_send_temp, 20*(calibrate_packet_cnt - calibrate_send_packet_cnt));
-                        calibrate_send_packet_cnt = calibrate_packet_cnt;
-                        
-                        memset(ble_send_temp, 0, 20);
-                        ble_send_temp[0] = 0xaa;
-                        ble_send_temp[1] = 0x13;
-                        ble_send_temp[2] = 0xc2;
-                        ble_send_temp[3] = 0x03;
-                        ble_send_temp[4] = 0x01;
-                        
-                        sum = 0;
-                        for(i=0; i<19; i++){
-                            sum += ble_send_temp[i];
-                        }
-                        ble_send_temp[19] = sum;
-                        
-                        send_ble_data(ble_send_temp, 20);
-                    }
-//                }
+                /* 发送队列放得下一次的10帧再读, 放不下时让出, 有空间后重新置起 */
+                if(200 > uart_tx_free()){
+                    uart_tx_wait(BLUETOOTH, SEND_CALIBRATE_DATA, 200);
+                    return true;
+                }
+                
+                /* 从外部flash校准区读出, 每次10帧, 读缓存从内存池租用, 借不到时空闲再试 */
+                chunk = pool_alloc(POOL_ARENA_UPLOAD, 200);
+                if(NULL == chunk){
+                    uart_tx_wait(BLUETOOTH, SEND_CALIBRATE_DATA, 200);
+                    return true;
+                }
+                cnt = flash_calib_read(&calibrate_send_packet_cnt, chunk, 10);
+                if(0 != cnt){
+                    send_ble_data(chunk, 20*cnt);
+                    pool_free(chunk);
+                    
+                    /* 下一块等发送完成或空闲时再发, 不占住调度 */
+                    uart_tx_wait(BLUETOOTH, SEND_CALIBRATE_DATA, 200);
+                    return true;
+                }
+                pool_free(chunk);
+                
+                /* 上传完成 */
+                frame_open(&packer, ble_send_temp, 0xc2, 0x03);
+                frame_put_u8(&packer, 0x01);
+                frame_close(&packer);
+                
+                send_ble_data(ble_send_temp, 20);
             }
                 break;
             
@@ -48,6 +48,7 @@
 #define MEM_WRITE                     6                             //flash存储任务6
 #define WRITE_SYSTEM_INFO             0                             //保存系统信息至内部 flash
 #define FLASH_DELETE                  1                             //删除外部 flash 中的数据
+#define FLASH_WRITE_PAGE              2                             //后台写数据页至外部 flash
 
 #define OTHER                         7                             //其他任务7
 #define FLASH_DATA_SEND               1                             //上传flash中的数据至上位机
@@ -2,8 +2,10 @@
 #include "bsp_dx_bt24_t.h"
 #include "bsp_time.h"
 #include "bsp_system.h"
+#include "bsp_flash.h"
 
 #include "app_common.h"
+#include "app_frame.h"
 #include "app_ble.h"
 #include "app_calculate.h"
 
@@ -25,9 +27,6 @@
 /* Exported Variables -------------------------------------------------------- */
 extern utc_time_t utc_time;
 extern system_state_t system_state;
-//extern uint8_t *calibrate_data_p;
-extern uint8_t calibrate_data_p[15000];
-extern uint16_t calibrate_packet_cnt;
 extern timer_cnt_t time_cnt;
 extern timer_flg_t time_flg;
 extern uint16_t calibrate_send_packet_cnt;
@@ -38,9 +37,8 @@ uint8_t measure_task(uint8_t prio)
     short ax = 0;
     short ay = 0;
     short az = 0;
-    uint8_t i = 0;
     uint8_t ble_send_temp[20];
-    uint8_t sum = 0;
+    frame_packer_t packer;
     
 //    ES_LOG_PRINT("measure_task\n");
     
@@ -51,27 +49,16 @@ uint8_t measure_task(uint8_t prio)
         {
             case CALIBRATE_START:
             {
-                calibrate_packet_cnt = 0;
-//                if(NULL == calibrate_data_p){
-//                    calibrate_data_p = (uint8_t *)malloc(15 * 50 * 20);
-//                }
+                if(0 != flash_calib_start()){
+                    ES_LOG_PRINT("calibrate session start fail\n");
+                }
 
                 time_cnt.calibrate_timeout_cnt = 0;
                 time_flg.calibrate_flg = 1;
                 
                 system_state.system_flg.calibrate_key_flg = 1;
 
-                memset(ble_send_temp, 0, 20);
-                ble_send_temp[0] = 0xaa;
-                ble_send_temp[1] = 0x13;
-                ble_send_temp[2] = 0xc2;
-                ble_send_temp[3] = 0x02;
-                
-                sum = 0;
-                for(i=0; i<19; i++){
-                    sum += ble_send_temp[i];
-                }
-                ble_send_temp[19] = sum;
+                frame_pack(ble_send_temp, 0xc2, 0x02, NULL, 0);
                 
                 send_ble_data(ble_send_temp, 20);
             }
@@ -84,21 +71,15 @@ uint8_t measure_task(uint8_t prio)
                 time_cnt.calibrate_timeout_cnt = 0;
                 time_flg.calibrate_flg = 0;
 
-                memset(ble_send_temp, 0, 20);
-                ble_send_temp[0] = 0xaa;
-                ble_send_temp[1] = 0x13;
-                ble_send_temp[2] = 0xc2;
-                ble_send_temp[3] = 0x02;
-                ble_send_temp[4] = 0x01;
-                
-                sum = 0;
-                for(i=0; i<19; i++){
-                    sum += ble_send_temp[i];
-                }
-                ble_send_temp[19] = sum;
+                frame_open(&packer, ble_send_temp, 0xc2, 0x02);
+                frame_put_u8(&packer, 0x01);
+                frame_close(&packer);
                 
                 send_ble_data(ble_send_temp, 20);
                 
+                /* 上传刚结束的一段 */
+                flash_calib_stop();
+                flash_calib_select(0);
                 calibrate_send_packet_cnt = 0;
                 set_task(BLUETOOTH, SEND_CALIBRATE_DATA);
             }
@@ -111,21 +92,12 @@ uint8_t measure_task(uint8_t prio)
                 time_cnt.calibrate_timeout_cnt = 0;
                 time_flg.calibrate_flg = 0;
                 
-                calibrate_packet_cnt = 0;
-//                free(calibrate_data_p);
-                
-                memset(ble_send_temp, 0, 20);
-                ble_send_temp[0] = 0xaa;
-                ble_send_temp[1] = 0x13;
-                ble_send_temp[2] = 0xc2;
-                ble_send_temp[3] = 0x02;
-                ble_send_temp[4] = 0x02;
+                /* 已采集的部分保留在flash中, 可以按段上传 */
+                flash_calib_stop();
                 
-                sum = 0;
-                for(i=0; i<19; i++){
-                    sum += ble_send_temp[i];
-                }
-                ble_send_temp[19] = sum;
+                frame_open(&packer, ble_send_temp, 0xc2, 0x02);
+                frame_put_u8(&packer, 0x02);
+                frame_close(&packer);
                 
                 send_ble_data(ble_send_temp, 20);
             }
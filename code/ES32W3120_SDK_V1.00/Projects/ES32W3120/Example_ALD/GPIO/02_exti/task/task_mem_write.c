@@ -32,6 +32,15 @@ uint8_t mem_write_task(uint8_t prio)
             }
                 break;
             
+            case FLASH_WRITE_PAGE:
+            {
+                /* 每次只执行一步, 让出给采样等高优先级任务 */
+                if(0 != flash_writer_run()){
+                    return false;
+                }
+            }
+                break;
+            
             default:
                 break; 
         }
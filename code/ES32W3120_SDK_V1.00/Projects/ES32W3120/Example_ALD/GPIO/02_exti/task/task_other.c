@@ -3,6 +3,7 @@
 #include "bsp_system.h"
 
 #include "app_common.h"
+#include "app_frame.h"
 
 #include "task_common.h"
 #include "task_other.h"
@@ -21,16 +22,16 @@ uint8_t send_pack_temp = 0;
 /* Private Function ---------------------------------------------------------- */
 
 /* Exported Variables -------------------------------------------------------- */
-extern uint8_t accelerometer_data_send_temp[FLASH_READ_BUFF_LEN];
+extern uint8_t *accelerometer_data_send_temp;
 extern uint8_t send_page_temp;
 extern system_state_t system_state;
+extern flash_range_t flash_range;
 
 uint8_t other_task(uint8_t prio)
 {
     uint8_t m_SYS_SubTask_prio=0;
     uint8_t send_data_temp[20];
-    uint8_t sum = 0;
-    uint8_t i = 0;
+    frame_packer_t packer;
     
     ES_LOG_PRINT("other_task\n");
     
@@ -41,27 +42,31 @@ uint8_t other_task(uint8_t prio)
         {
             case FLASH_DATA_SEND:
             {
+                /* 发送队列放不下这一块时让出, 有空间后重新置起 */
+                if(FLASH_READ_BUFF_LEN > uart_tx_free()){
+                    uart_tx_wait(OTHER, FLASH_DATA_SEND, FLASH_READ_BUFF_LEN);
+                    return true;
+                }
                 send_ble_data(accelerometer_data_send_temp, FLASH_READ_BUFF_LEN);
                 
                 if(10 <= send_page_temp){
-                    ald_delay_ms(10);
                     send_page_temp = 0;
                     
-                    memset(send_data_temp, 0, 20);
-                    send_data_temp[0] = 0xaa;
-                    send_data_temp[1] = 0x13;
-                    send_data_temp[2] = 0xc2;
-                    send_data_temp[3] = 0x05;
-                    send_data_temp[4] = 0x01;
+                    /* 一轮上传结束, 归还读缓存 */
+                    pool_free(accelerometer_data_send_temp);
+                    accelerometer_data_send_temp = NULL;
                     
-                    sum = 0;
-                    for(i=0; i<19; i++){
-                        sum += send_data_temp[i];
-                    }
-                    send_data_temp[19] = sum;
+                    frame_open(&packer, send_data_temp, 0xc2, 0x05);
+                    frame_put_u8(&packer, 0x01);
+                    frame_close(&packer);
                     
                     send_ble_data(send_data_temp, 20);
-                    system_state.system_flg.send_flash_data_flg = 1;
+                    if(1 == flash_range.active){
+                        flash_range_next();     //按时间范围上传不删除数据
+                    }
+                    else{
+                        system_state.system_flg.send_flash_data_flg = 1;
+                    }
                 }
                 else{
                     set_task(MEM_READ, FLASH_READ);
@@ -5,6 +5,7 @@
 #include "bsp_flash.h"
 
 #include "app_common.h"
+#include "app_calculate.h"
 
 #include "task_common.h"
 #include "task_safeguard.h"
@@ -44,6 +45,7 @@ uint8_t sg_task(uint8_t prio)
             case LOW_POWER_MODE:
             {
                 system_state.system_mode = E_LOW_POWER_MODE;
+                flash_writer_sync();    //关闭flash电源前写完缓存
                 lwp_mode_init();
             }
                 break;
@@ -53,6 +55,7 @@ uint8_t sg_task(uint8_t prio)
                 if(0x01 == system_state.system_flg.device_init_flg){
                     if(0x01 != system_state.system_flg.mpu6050_init_flg){
                         mpu6050_set();
+                        calculate_rate_set(RATE_LEVEL_NORMAL);
                     }
                     if(0x01 != system_state.system_flg.dx_bt24_t_init_flg){
                         dx_bt24_t_quick_init();
@@ -63,6 +66,12 @@ uint8_t sg_task(uint8_t prio)
                     system_state.system_flg.device_init_flg = 0x00;
                 }
                 system_state.system_flg.imu_data_flg = 0;
+                /* 断开后队列里的数据不再发送, 中止正在进行的上传 */
+                uart_tx_flush();
+                clear_task(OTHER, FLASH_DATA_SEND);
+                clear_task(MEM_READ, FLASH_READ);
+                clear_task(BLUETOOTH, SEND_CALIBRATE_DATA);
+                flash_upload_abort();
                 /* 蓝灯闪烁 */
                 led_twinkle();
                 system_state.system_mode = E_ADV_MODE;
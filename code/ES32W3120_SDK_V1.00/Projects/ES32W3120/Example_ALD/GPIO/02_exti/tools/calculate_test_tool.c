@@ -0,0 +1,417 @@
+/*
+ * Run the posture code (app/app_calculate.c) on the PC with fixed synthetic
+ * traces and check it against calculate_posture_ref() and against a model of
+ * the stillness rule written here. Build on the PC:
+ *
+ *   SDK=../../../../../..
+ *   gcc -O2 -o calculate_test_tool calculate_test_tool.c ../app/app_calculate.c ../app/app_frame.c \
+ *       -I. -I../Inc -I../Src -I../app -I../bsp -I../task \
+ *       -I$SDK/Drivers/CMSIS/Include -I$SDK/Drivers/CMSIS/Device/EastSoft/ES32W3120/Include \
+ *       -I$SDK/Drivers/CMSIS/Device/EastSoft/ES32W3120/Include/ES32W3120 \
+ *       -I$SDK/Drivers/ALD/ES32W3120/Include -I$SDK/Drivers/MD/ES32W3120/Include \
+ *       -I$SDK/Middlewares/Third_Party/RTT -I$SDK/Middlewares/EastSoft/BLE5.0/Log/Include -lm
+ *
+ * Usage:
+ *   calculate_test_tool posture
+ *       Sweep the sensor orientation over the sphere at several magnitudes,
+ *       plus the zero axis cases, through calculate_posture() and the
+ *       reference. Fails when an angle differs by more than
+ *       CALCULATE_ANGLE_TOL or the decision differs away from a threshold.
+ *   calculate_test_tool trace
+ *       Feed the fixed traces (sitting, slouching, leaning, lying, walking,
+ *       a long still stretch) sample by sample through
+ *       calculate_accelerometer(), at the read period it selects. Checks the
+ *       decision and alert of every sample, the sample where low power is
+ *       requested, and the sample count of the stored minute summaries.
+ *   calculate_test_tool all
+ *       Both.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "bsp_flash.h"
+#include "bsp_mpu6050.h"
+
+#include "app_calculate.h"
+#include "app_ble.h"
+#include "app_statistic.h"
+#include "app_common.h"
+#include "app_frame.h"
+
+#include "task_common.h"
+
+#define TEST_G                        16384   //1g, ±2g 量程
+#define TEST_DEG                      (3.14159265358979 / 180)
+
+/* 一段姿态: 传感器 x 轴和重力的夹角 tilt, 倾斜方向 dir (0 前倾, 90 侧倾, 180 后仰) */
+typedef struct {
+    const char *name;
+    uint32_t ms;                                //持续时间
+    double tilt;
+    double dir;
+    uint16_t noise;                             //每轴随机噪声幅度
+    uint16_t swing;                             //走动时的摆动幅度, 0 表示静止
+
+}test_segment_t;
+
+/* 驱动引用的全局变量 */
+system_state_t system_state;
+utc_time_t utc_time;
+timer_cnt_t time_cnt;
+uint8_t mpu6050_timeout = MPU6050_NORMAL_TIMEOUT;
+
+extern calculate_summary_t calculate_summary;
+
+/* 被测代码的输出 */
+static posture_e out_posture;
+static uint8_t out_alert;
+static uint16_t out_sample_ms;
+static uint8_t out_cnt;
+static uint8_t out_lpw;
+static uint32_t summary_cnt;
+static uint32_t summary_samples;
+static uint32_t noise_seed = 1;
+
+static const test_segment_t test_trace[] = {
+    {"sit upright",   90000,  10,   0,  60,    0},
+    {"slouch",        20000,  40,   0,  60,    0},
+    {"sit upright",   15000,   8,   0,  60,    0},
+    {"lean back",     10000,  12, 180,  60,    0},
+    {"lean sideways", 10000,  50,  90,  60,    0},
+    {"sit upright",    5000,   5,   0,  60,    0},
+    {"walk",          30000,  15,   0, 200, 3000},
+    {"lie down",      20000,  85,   0,  60,    0},
+    {"sit upright",  150000,  10,   0,  60,    0},
+    {"slouch",         5000,  30,   0, 200, 1500},
+};
+
+/* ---------------- 被测模块依赖的函数 ---------------- */
+
+int SEGGER_RTT_printf(unsigned BufferIndex, const char *sFormat, ...)
+{
+    return 0;
+}
+
+void set_task(uint8_t main_task, uint8_t sub_task)
+{
+    if((SG == main_task) && (LOW_POWER_MODE == sub_task)){
+        out_lpw = 1;
+    }
+}
+
+void mpu_set_rate(uint16_t rate)
+{
+}
+
+void motor_start(void)
+{
+    system_state.system_flg.motor_start_flg = 1;
+}
+
+void motor_stop(void)
+{
+    system_state.system_flg.motor_start_flg = 0;
+}
+
+void statistic_add(posture_e posture, uint8_t alert, uint16_t sample_ms)
+{
+    out_posture = posture;
+    out_alert = alert;
+    out_sample_ms = sample_ms;
+    out_cnt++;
+}
+
+void save_frame(uint8_t *frame)
+{
+    if(frame_check(frame) && (0xd5 == frame[2]) && (DATA_OFFLINE_SUMMARY == frame[3])){
+        summary_cnt++;
+        summary_samples += ((uint16_t)frame[17] << 8) | frame[18];
+    }
+}
+
+void save_accelerometer(uint16_t ax, uint16_t ay, uint16_t az)
+{
+}
+
+void save_accelerometer_flush(void)
+{
+}
+
+void save_still_marker(uint16_t cnt, utc_time_t *utc)
+{
+}
+
+void send_accelerometer(uint16_t ax, uint16_t ay, uint16_t az)
+{
+}
+
+uint8_t *flash_calib_slot(void)
+{
+    return NULL;
+}
+
+void flash_calib_commit(void)
+{
+}
+
+/* ---------------- 测试 ---------------- */
+
+static int16_t test_noise(uint16_t amp)
+{
+    noise_seed = noise_seed * 1103515245 + 12345;
+
+    return (0 == amp) ? 0 : (int16_t)((int32_t)((noise_seed >> 16) % (2 * amp + 1)) - amp);
+}
+
+static void test_sample(double g, double tilt, double dir, short *xyz)
+{
+    xyz[0] = (short)lround(g * cos(tilt * TEST_DEG));
+    xyz[1] = (short)lround(g * sin(tilt * TEST_DEG) * sin(dir * TEST_DEG));
+    xyz[2] = (short)lround(g * sin(tilt * TEST_DEG) * cos(dir * TEST_DEG));
+}
+
+/**
+  * @brief  Check whether a reference angle set is within one degree of a
+  *         decision threshold, where float rounding may pick either side.
+  */
+static uint8_t test_near_threshold(const uint16_t *angle)
+{
+    int16_t pitch = (int16_t)angle[0];
+    int16_t roll = (int16_t)angle[1];
+    int16_t tilt = (int16_t)angle[2];
+
+    return ((64 <= tilt) && (66 >= tilt)) || ((24 <= pitch) && (25 >= pitch)) || ((-1 <= pitch) && (0 >= pitch))
+        || ((9 <= roll) && (10 >= roll)) || ((-1 <= roll) && (0 >= roll));
+}
+
+/**
+  * @brief  Compare calculate_posture() with the reference on one sample.
+  * @retval 0 same, 1 different next to a threshold, 2 different.
+  */
+static uint8_t test_posture_one(short ax, short ay, short az)
+{
+    uint16_t angle[3] = {0};
+    uint16_t angle_ref[3] = {0};
+    posture_e posture = calculate_posture(ax, ay, az, angle);
+    posture_e posture_ref = calculate_posture_ref(ax, ay, az, angle_ref);
+
+    if(CALCULATE_ANGLE_TOL < calculate_angle_diff(angle, angle_ref)){
+        printf("angle  %6d %6d %6d: %d %d %d, ref %d %d %d\n", ax, ay, az,
+               (int16_t)angle[0], (int16_t)angle[1], (int16_t)angle[2],
+               (int16_t)angle_ref[0], (int16_t)angle_ref[1], (int16_t)angle_ref[2]);
+        return 2;
+    }
+    if(posture != posture_ref){
+        if(test_near_threshold(angle_ref)){
+            return 1;
+        }
+        printf("posture %6d %6d %6d: %u, ref %u\n", ax, ay, az, posture, posture_ref);
+        return 2;
+    }
+
+    return 0;
+}
+
+static int cmd_posture(void)
+{
+    static const double mag[] = {0.3, 0.8, 1.0, 1.2, 1.6};
+    static const short axis[][3] = {
+        {0, 0, 0}, {0, 5000, 0}, {0, 0, 5000}, {0, 0, -5000}, {0, 3000, 3000},
+        {5000, 0, 0}, {-5000, 0, 0}, {1, 16000, 0}, {100, -16000, 0}, {16000, 16000, 0},
+    };
+    short xyz[3];
+    uint32_t result[3] = {0};
+    uint32_t m = 0;
+    uint32_t tilt = 0;
+    uint32_t dir = 0;
+    uint32_t i = 0;
+
+    for(m=0; m<sizeof(mag) / sizeof(mag[0]); m++){
+        for(tilt=0; tilt<=180; tilt++){
+            for(dir=0; dir<360; dir+=3){
+                test_sample(mag[m] * TEST_G, tilt, dir, xyz);
+                result[test_posture_one(xyz[0], xyz[1], xyz[2])]++;
+            }
+        }
+    }
+    for(i=0; i<sizeof(axis) / sizeof(axis[0]); i++){
+        result[test_posture_one(axis[i][0], axis[i][1], axis[i][2])]++;
+    }
+
+    printf("posture samples  %u, same %u, next to a threshold %u, different %u\n",
+           result[0] + result[1] + result[2], result[0], result[1], result[2]);
+
+    return (0 != result[2]) ? 1 : 0;
+}
+
+/**
+  * @brief  Advance the clock by one sample, minutes roll over so the minute
+  *         summaries are closed.
+  */
+static void test_clock(uint16_t ms)
+{
+    static uint16_t ms_acc = 0;
+
+    ms_acc += ms;
+    while(1000 <= ms_acc){
+        ms_acc -= 1000;
+        if(60 <= ++utc_time.utc_s){
+            utc_time.utc_s = 0;
+            if(60 <= ++utc_time.utc_f){
+                utc_time.utc_f = 0;
+                utc_time.utc_h++;
+            }
+        }
+    }
+}
+
+static int cmd_trace(void)
+{
+    const test_segment_t *seg = NULL;
+    uint16_t angle_ref[3] = {0};
+    short ref[3] = {0};
+    short xyz[3];
+    posture_e last = POSTURE_NONE;
+    posture_e expect = POSTURE_NONE;
+    uint8_t motor = 0;
+    uint8_t alert = 0;
+    uint8_t still = 0;
+    uint8_t first = 1;
+    uint16_t sample_ms = 0;
+    uint32_t lpw_ms = 0;
+    uint32_t seg_ms = 0;
+    uint32_t samples = 0;
+    uint32_t bad = 0;
+    uint32_t boundary = 0;
+    uint32_t lpw_expect = 0;
+    uint32_t lpw_got = 0;
+    uint32_t lpw_first = 0;
+    uint32_t lpw_first_expect = 0;
+    uint32_t alerts = 0;
+    uint32_t i = 0;
+
+    utc_time.utc_y = 24;
+    utc_time.utc_m = 6;
+    utc_time.utc_d = 1;
+    utc_time.utc_h = 9;
+    system_state.shake_fre = 0x01;
+
+    for(i=0; i<sizeof(test_trace) / sizeof(test_trace[0]); i++){
+        seg = &test_trace[i];
+        for(seg_ms=0; seg_ms<seg->ms; seg_ms+=sample_ms){
+            sample_ms = mpu6050_timeout * TIME_TICK_MS;
+            test_sample(TEST_G, seg->tilt, seg->dir, xyz);
+            if(0 != seg->swing){
+                /* 走动: 约 2 步每秒的摆动 */
+                xyz[0] += (short)(seg->swing * sin(seg_ms * 2 * 3.14159265358979 / 500));
+                xyz[2] += (short)(seg->swing * cos(seg_ms * 2 * 3.14159265358979 / 700));
+            }
+            xyz[0] += test_noise(seg->noise);
+            xyz[1] += test_noise(seg->noise);
+            xyz[2] += test_noise(seg->noise);
+
+            /* 模型: 和参考样本各轴相差都小于阈值为静止, 运动时参考样本更新, 低功耗计时清零 */
+            still = 0;
+            if(first){
+                memcpy(ref, xyz, sizeof(ref));
+                first = 0;
+            }
+            else if((STILL_THRESHOLD > abs(ref[0] - xyz[0])) && (STILL_THRESHOLD > abs(ref[1] - xyz[1])) && (STILL_THRESHOLD > abs(ref[2] - xyz[2]))){
+                still = 1;
+                lpw_ms += sample_ms;
+            }
+            else{
+                lpw_ms = 0;
+                memcpy(ref, xyz, sizeof(ref));
+            }
+            if(still && (STILL_LPW_MS < lpw_ms)){
+                lpw_expect++;
+                if(0 == lpw_first_expect){
+                    lpw_first_expect = samples + 1;
+                }
+            }
+
+            out_cnt = 0;
+            out_lpw = 0;
+            calculate_accelerometer(xyz[0], xyz[1], xyz[2]);
+            samples++;
+            if(out_lpw){
+                lpw_got++;
+                if(0 == lpw_first){
+                    lpw_first = samples;
+                }
+            }
+
+            /* 静止时沿用上一次的判断, 否则按参考模型判断 */
+            if((1 != out_cnt) || (sample_ms != out_sample_ms)){
+                printf("%s: sample %u not counted once\n", seg->name, samples);
+                bad++;
+                continue;
+            }
+            if(still && (1 < samples)){
+                expect = last;
+            }
+            else{
+                expect = calculate_posture_ref(xyz[0], xyz[1], xyz[2], angle_ref);
+                if((expect != out_posture) && test_near_threshold(angle_ref)){
+                    boundary++;
+                    expect = out_posture;
+                }
+            }
+            alert = ((POSTURE_BAD == expect) && (0 == motor)) ? 1 : 0;
+            if(POSTURE_BAD == expect){
+                motor = 1;
+            }
+            else if(POSTURE_GOOD == expect){
+                motor = 0;
+            }
+            if((expect != out_posture) || (alert != out_alert)){
+                printf("%s: sample %u %d %d %d posture %u alert %u, expected %u %u\n",
+                       seg->name, samples, xyz[0], xyz[1], xyz[2], out_posture, out_alert, expect, alert);
+                bad++;
+            }
+            last = expect;
+            alerts += alert;
+
+            test_clock(sample_ms);
+        }
+    }
+
+    printf("trace samples    %u in %u segments, %u wrong, %u next to a threshold, %u alerts\n",
+           samples, (uint32_t)(sizeof(test_trace) / sizeof(test_trace[0])), bad, boundary, alerts);
+    printf("low power        first request at sample %u, expected %u; %u requests, expected %u\n",
+           lpw_first, lpw_first_expect, lpw_got, lpw_expect);
+    printf("minute summaries %u records, %u samples (%u still in the open minute)\n",
+           summary_cnt, summary_samples, calculate_summary.samples);
+
+    if((lpw_first != lpw_first_expect) || (lpw_got != lpw_expect) || (0 == lpw_expect)){
+        bad++;
+    }
+    if(summary_samples + calculate_summary.samples != samples){
+        bad++;
+    }
+
+    return (0 != bad) ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+
+    if((2 <= argc) && (0 == strcmp(argv[1], "posture"))){
+        return cmd_posture();
+    }
+    if((2 <= argc) && (0 == strcmp(argv[1], "trace"))){
+        return cmd_trace();
+    }
+    if((2 <= argc) && (0 == strcmp(argv[1], "all"))){
+        ret |= cmd_posture();
+        ret |= cmd_trace();
+        return ret;
+    }
+
+    fprintf(stderr, "usage: %s posture|trace|all\n", argv[0]);
+
+    return 1;
+}
@@ -0,0 +1,1089 @@
+/*
+ * Run the device storage code (bsp/bsp_flash.c) on the PC against the SPI NOR
+ * model in spi_nor_sim.c. The ALD calls used by the driver are replaced here,
+ * time is the virtual clock of the model. Build on the PC (Linux, fork/mmap):
+ *
+ *   SDK=../../../../../..
+ *   gcc -O2 -o flash_sim_tool flash_sim_tool.c spi_nor_sim.c ../bsp/bsp_flash.c ../bsp/bsp_pool.c ../app/app_codec.c \
+ *       ../app/app_frame.c \
+ *       -I. -I../Inc -I../Src -I../app -I../bsp -I../task \
+ *       -I$SDK/Drivers/CMSIS/Include -I$SDK/Drivers/CMSIS/Device/EastSoft/ES32W3120/Include \
+ *       -I$SDK/Drivers/CMSIS/Device/EastSoft/ES32W3120/Include/ES32W3120 \
+ *       -I$SDK/Drivers/ALD/ES32W3120/Include -I$SDK/Drivers/MD/ES32W3120/Include \
+ *       -I$SDK/Middlewares/Third_Party/RTT -I$SDK/Middlewares/EastSoft/BLE5.0/Log/Include
+ *
+ * Usage:
+ *   flash_sim_tool bench <pages> [frame_ms]
+ *       Store <pages> data pages through save_frame() and the background
+ *       writer, one frame every frame_ms (default 0: as fast as possible).
+ *       Reports throughput, flush latency, write amplification and erase
+ *       counts per sector.
+ *   flash_sim_tool powerloss <runs> [seed]
+ *       Boot, check the log, store a random number of pages and cut the power
+ *       at a random SPI byte, <runs> times on the same image. Every other run
+ *       also fails the erase or program of one first page of a sector. Fails
+ *       when a completed page is lost, a valid page holds wrong data, or the
+ *       driver programs over data that was not erased.
+ *   flash_sim_tool wrap <pages>
+ *       Store <pages> data pages without any upload ack, so the ring fills
+ *       and wraps. Fails unless every valid page of the image is reachable
+ *       from the read cursor in sequence order, before and after a reboot.
+ *   flash_sim_tool range <pages>
+ *       Store <pages> data pages one minute apart, with a stretch stored
+ *       before the clock was set and a torn page in the middle, then ask
+ *       flash_range_start() for every minute and compare the first page
+ *       with a linear scan of the headers.
+ *   flash_sim_tool calib <sessions> <frames>
+ *       Capture <sessions> calibration sessions of <frames> frames each, one
+ *       frame every 20 ms, into the calibration region, then rebuild the
+ *       session index as after a reboot and read every indexed session back.
+ *   flash_sim_tool legacy <send> <current>
+ *       Boot on an image of the old layout (flash_data_t in sector 0, pages
+ *       without header) with the given cursors. Fails unless the unsent old
+ *       pages are found in the log in order, also after more pages are
+ *       stored and after a reboot; a second image loses power in the middle
+ *       of the conversion and must keep a consistent prefix.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "bsp_flash.h"
+#include "bsp_settings.h"
+#include "bsp_dx_bt24_t.h"
+
+#include "app_common.h"
+
+#include "task_common.h"
+
+#include "spi_nor_sim.h"
+
+#define SIM_FLASH_SIZE                ((FLASH_CALIB_END + 1) * FLASH_PAGE_LEN)
+#define SIM_SECTOR_NUM                (SIM_FLASH_SIZE / NOR_SIM_SECTOR_LEN)
+#define SIM_CPU_NS                    200     //每次读时钟计入的CPU时间
+#define SIM_FRAME_PER_PAGE            (FLASH_WRITE_BUFF_LEN / 20)
+#define SIM_RANGE_UNTIMED             20      //range: 没有对时的页数
+#define SIM_UPLOAD_EVERY              8       //每几次数据段DMA插入一次上传读
+#define SIM_CRC_BYTE_NS               21      //CRC DMA 每字节一个48MHz周期
+#define SIM_SPI_HZ_MAX                12000000    //编程/擦除命令允许的SPI时钟
+#define SIM_LOG_PAGES                 (FLASH_DATA_END + 1 - FLASH_DATA_START)
+#define SIM_LEGACY_MAX                (SIM_LOG_PAGES - FLASH_PAGE_PER_SECTOR)    //legacy: 写游标的扇区不放旧数据
+
+/* 和子进程共享: flash 内容、擦除计数和结果 */
+typedef struct {
+    nor_sim_t sim;
+    uint8_t mem[SIM_FLASH_SIZE];
+    uint32_t erase[SIM_SECTOR_NUM];
+    uint32_t frame_no;                          //下一个帧编号
+    uint32_t done_seq;                          //已写完的最后一页的序号
+    uint32_t lost;                              //重启后丢失的已完成页
+    uint32_t bad_data;                          //页头有效但数据错误的页
+    uint32_t torn;                              //最后一次启动时页头无效的页
+    uint32_t next_seq;                          //重建后的下一页序号
+    uint32_t fault;                             //注入的扇区第一页写失败次数
+
+}sim_shared_t;
+
+/* DMA 传输: 启动时只记下缓冲, 传输时间到了在读时钟时完成并调用回调, 和中断一样 */
+typedef struct {
+    spi_handle_t *hperh;                        //NULL: 没有进行中的传输
+    uint8_t *tx;
+    uint8_t *rx;                                //NULL: 只发送
+    uint16_t size;
+    uint64_t end_ns;
+
+}sim_dma_t;
+
+/* CRC DMA: 到时间后在读时钟时算出结果, 之前 crc32_dma_busy() 为 1 */
+typedef struct {
+    const uint8_t *buf;                         //NULL: 没有进行中的计算
+    uint32_t *res;
+    uint16_t len;
+    uint64_t end_ns;
+
+}sim_crc_dma_t;
+
+static sim_shared_t *shared = NULL;
+static sim_dma_t sim_dma = {0};
+static sim_crc_dma_t sim_crc_dma = {0};
+static nor_sim_t *sim = NULL;
+static uint8_t write_pending = 0;
+static uint8_t fault_armed = 0;
+static uint8_t verbose = 0;
+
+/* 驱动引用的全局变量 */
+system_state_t system_state;
+utc_time_t utc_time;
+uint8_t mpu6050_timeout = 50;
+settings_stat_t settings_stat;
+
+extern flash_stat_t flash_stat;
+extern flash_writer_t flash_writer;
+extern flash_reserve_t flash_reserve;
+extern flash_calib_t flash_calib;
+extern flash_range_t flash_range;
+
+/* ---------------- ALD 和板级函数替代 ---------------- */
+
+static void sim_check_power(void)
+{
+    /* 注入的掉电已发生, 子进程在这里结束 */
+    if(sim->failed){
+        _exit(0);
+    }
+}
+
+static void sim_dma_run(void)
+{
+    spi_handle_t *hperh = sim_dma.hperh;
+    uint32_t hz = sim->spi_hz;
+    uint16_t i = 0;
+
+    if((NULL == hperh) || (sim->now_ns < sim_dma.end_ns)){
+        return;
+    }
+    sim_dma.hperh = NULL;
+
+    /* 传输时间启动时已算好, 字节按最高速率补发 */
+    sim->spi_hz = 4000000000U;
+    for(i=0; i<sim_dma.size; i++){
+        if(NULL != sim_dma.rx){
+            sim_dma.rx[i] = nor_sim_xfer(sim, sim_dma.tx[i]);
+        }
+        else{
+            nor_sim_xfer(sim, sim_dma.tx[i]);
+        }
+        sim_check_power();
+    }
+    sim->spi_hz = hz;
+
+    hperh->state = SPI_STATE_READY;
+    if(NULL != sim_dma.rx){
+        hperh->tx_rx_cplt_cbk(hperh);
+    }
+    else{
+        hperh->tx_cplt_cbk(hperh);
+    }
+}
+
+static void sim_crc_dma_run(void);
+
+static void sim_dma_start(spi_handle_t *hperh, uint8_t *tx, uint8_t *rx, uint16_t size)
+{
+    sim_dma.hperh = hperh;
+    sim_dma.tx = tx;
+    sim_dma.rx = rx;
+    sim_dma.size = size;
+    sim_dma.end_ns = sim->now_ns + (uint64_t)size * 8000000000ULL / sim->spi_hz;
+    hperh->state = (NULL != rx) ? SPI_STATE_BUSY_TX_RX : SPI_STATE_BUSY_TX;
+}
+
+static void sim_dma_conflict(void)
+{
+    /* DMA 还在传输时CPU动了总线, 按驱动错误计 */
+    if(NULL != sim_dma.hperh){
+        sim->stat.reject_cnt++;
+        fprintf(stderr, "spi bus used while dma is running\n");
+    }
+}
+
+void ald_gpio_init(GPIO_TypeDef *GPIOx, uint16_t pin, gpio_init_t *init)
+{
+}
+
+void ald_gpio_write_pin(GPIO_TypeDef *GPIOx, uint16_t pin, uint8_t val)
+{
+    if((SPI_NSS_PORT == GPIOx) && (SPI_NSS_PIN == pin)){
+        sim_dma_conflict();
+        /* 编程和擦除只在12MHz下验证过 */
+        if(val && sim->cs && ((0x02 == sim->cmd) || (0x20 == sim->cmd)) && (SIM_SPI_HZ_MAX < sim->spi_hz)){
+            sim->stat.reject_cnt++;
+            fprintf(stderr, "program or erase at %u Hz\n", sim->spi_hz);
+        }
+        nor_sim_cs(sim, val ? 0 : 1);
+    }
+    if((PWR_FLASH_PORT == GPIOx) && (PWR_FLASH_PIN == pin)){
+        nor_sim_power(sim, val ? 0 : 1);
+    }
+}
+
+ald_status_t ald_spi_init(spi_handle_t *hperh)
+{
+    sim->spi_hz = 48000000 >> (hperh->init.baud + 1);
+    hperh->state = SPI_STATE_READY;
+
+    return OK;
+}
+
+void ald_spi_speed_config(spi_handle_t *hperh, spi_baud_t speed)
+{
+    /* 只能在传输之间切换 */
+    sim_dma_conflict();
+    sim->spi_hz = 48000000 >> (speed + 1);
+}
+
+int32_t ald_spi_send_byte_fast(spi_handle_t *hperh, uint8_t data)
+{
+    sim_dma_conflict();
+    nor_sim_xfer(sim, data);
+    sim_check_power();
+
+    return OK;
+}
+
+uint8_t ald_spi_recv_byte_fast(spi_handle_t *hperh, int *status)
+{
+    uint8_t data = 0;
+
+    sim_dma_conflict();
+    data = nor_sim_xfer(sim, 0xff);
+
+    sim_check_power();
+    *status = OK;
+    
+    /* 注入故障: 扇区第一页擦除或编程时读状态失败, 写任务放弃这一页 */
+    if(fault_armed && (0 == (flash_writer.page % FLASH_PAGE_PER_SECTOR))
+       && ((FLASH_WRITER_PROGRAM_WAIT == flash_writer.state)
+           || ((FLASH_WRITER_ERASE_WAIT == flash_writer.state) && (FLASH_WRITER_RESERVE != flash_writer.next)))){
+        fault_armed = 0;
+        shared->fault++;
+        *status = ERROR;
+    }
+
+    return data;
+}
+
+ald_status_t ald_spi_send_by_dma(spi_handle_t *hperh, uint8_t *buf, uint16_t size, uint8_t channel)
+{
+    if(NULL != sim_dma.hperh){
+        return BUSY;
+    }
+    sim_dma_start(hperh, buf, NULL, size);
+
+    return OK;
+}
+
+ald_status_t ald_spi_send_recv_by_dma(spi_handle_t *hperh, uint8_t *tx_buf, uint8_t *rx_buf, uint16_t size, uint8_t tx_channel, uint8_t rx_channel)
+{
+    if(NULL != sim_dma.hperh){
+        return BUSY;
+    }
+    /* 读数据时MOSI被忽略, 补发时 tx 和 rx 可以是同一个缓冲 */
+    sim_dma_start(hperh, tx_buf, rx_buf, size);
+
+    return OK;
+}
+
+ald_status_t ald_spi_dma_stop(spi_handle_t *hperh)
+{
+    sim_dma.hperh = NULL;
+    hperh->state = SPI_STATE_READY;
+
+    return OK;
+}
+
+uint32_t ald_get_tick(void)
+{
+    nor_sim_advance(sim, SIM_CPU_NS);
+    sim_dma_run();
+    sim_crc_dma_run();
+
+    return (uint32_t)(sim->now_ns / 1000000);
+}
+
+void ald_delay_ms(__IO uint32_t delay)
+{
+    nor_sim_advance(sim, (uint64_t)delay * 1000000);
+    sim_dma_run();
+    sim_crc_dma_run();
+}
+
+uint32_t dwt_get_cycle(void)
+{
+    nor_sim_advance(sim, SIM_CPU_NS);
+    sim_dma_run();
+    sim_crc_dma_run();
+
+    return (uint32_t)(sim->now_ns * DWT_CYCLE_PER_US / 1000);
+}
+
+int SEGGER_RTT_printf(unsigned BufferIndex, const char *sFormat, ...)
+{
+    va_list args;
+    int n = 0;
+
+    if(0 == verbose){
+        return 0;
+    }
+    va_start(args, sFormat);
+    n = vfprintf(stderr, sFormat, args);
+    va_end(args);
+
+    return n;
+}
+
+uint16_t crc16_calc(uint16_t crc, const uint8_t *buf, uint32_t len)
+{
+    uint32_t i = 0;
+    uint8_t j = 0;
+
+    for(i=0; i<len; i++){
+        crc ^= (uint16_t)buf[i] << 8;
+        for(j=0; j<8; j++){
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+/* 软件 CRC-32, 和 crc32_init() 的硬件配置结果相同 */
+static uint32_t crc32_state = 0xffffffff;
+
+static uint32_t crc32_sw(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    uint32_t i = 0;
+    uint8_t j = 0;
+
+    for(i=0; i<len; i++){
+        crc ^= buf[i];
+        for(j=0; j<8; j++){
+            crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+
+    return crc;
+}
+
+void crc32_init(void)
+{
+    crc32_state = 0xffffffff;
+}
+
+static void sim_crc_dma_run(void)
+{
+    if((NULL == sim_crc_dma.buf) || (sim->now_ns < sim_crc_dma.end_ns)){
+        return;
+    }
+    crc32_state = crc32_sw(crc32_state, sim_crc_dma.buf, sim_crc_dma.len);
+    *sim_crc_dma.res = ~crc32_state;
+    sim_crc_dma.buf = NULL;
+}
+
+int crc32_start(void)
+{
+    if(NULL != sim_crc_dma.buf){
+        return -1;
+    }
+    crc32_state = 0xffffffff;
+
+    return 0;
+}
+
+uint32_t crc32_update(const uint8_t *buf, uint32_t len)
+{
+    /* DMA 计算中CPU又送数据, 两边的结果都不对, 按驱动错误计 */
+    if(NULL != sim_crc_dma.buf){
+        sim->stat.reject_cnt++;
+        fprintf(stderr, "crc used while dma is running\n");
+    }
+    crc32_state = crc32_sw(crc32_state, buf, len);
+
+    return ~crc32_state;
+}
+
+int crc32_update_by_dma(const uint8_t *buf, uint16_t len, uint32_t *res)
+{
+    if(NULL != sim_crc_dma.buf){
+        return -1;
+    }
+    sim_crc_dma.buf = buf;
+    sim_crc_dma.res = res;
+    sim_crc_dma.len = len;
+    sim_crc_dma.end_ns = sim->now_ns + (uint64_t)len * SIM_CRC_BYTE_NS;
+
+    return 0;
+}
+
+uint8_t crc32_dma_busy(void)
+{
+    return (NULL != sim_crc_dma.buf) ? 1 : 0;
+}
+
+void crc32_dma_stop(void)
+{
+    sim_crc_dma.buf = NULL;
+}
+
+uint32_t utc_get_minute(uint8_t utc_y, uint8_t utc_m, uint8_t utc_d, uint8_t utc_h, uint8_t utc_f)
+{
+    return ((uint32_t)(utc_y & 0x7f) << 20) | ((uint32_t)(utc_m & 0x0f) << 16) | ((uint32_t)(utc_d & 0x1f) << 11) | ((uint32_t)(utc_h & 0x1f) << 6) | (utc_f & 0x3f);
+}
+
+void set_task(uint8_t main_task, uint8_t sub_task)
+{
+    if((MEM_WRITE == main_task) && (FLASH_WRITE_PAGE == sub_task)){
+        write_pending = 1;
+    }
+}
+
+int send_ble_data(uint8_t *tx_buf, uint8_t tx_len)
+{
+    return 0;
+}
+
+void settings_init(void)
+{
+}
+
+int settings_get(uint8_t key, void *value, uint8_t len)
+{
+    return -1;
+}
+
+int settings_set(uint8_t key, const void *value, uint8_t len)
+{
+    return -1;
+}
+
+/* ---------------- 负载 ---------------- */
+
+/**
+  * @brief  Run the scheduler until the background writer is idle, like the
+  *         main loop: the MEM_WRITE task first, the idle hook otherwise.
+  *         Every SIM_UPLOAD_EVERY payload transfer an upload read comes in
+  *         while the DMA is still running.
+  * @param  until_ns: Also run the idle hook up to this time, 0 to skip.
+  */
+static void sim_run(uint64_t until_ns)
+{
+    static uint32_t dma_cnt = 0;
+    uint8_t buf[FLASH_DMA_MIN_LEN];
+
+    while(1){
+        if(write_pending){
+            if(0 == flash_writer_run()){
+                write_pending = 0;
+            }
+            if((FLASH_WRITER_DMA_WAIT == flash_writer.state) && (0 == (++dma_cnt % SIM_UPLOAD_EVERY))){
+                flash_read((uint32_t)system_state.flash_data.flash_data_send_page * FLASH_PAGE_LEN, (char *)buf, sizeof(buf));
+            }
+            if(FLASH_WRITER_IDLE == flash_writer.state){
+                shared->done_seq = system_state.flash_data.flash_data_seq - 1;
+            }
+            continue;
+        }
+        if(sim->now_ns >= until_ns){
+            return;
+        }
+        if((FLASH_WRITER_IDLE == flash_writer.state) && (FLASH_ERASE_AHEAD <= flash_reserve.cnt)){
+            /* 没有事可做, 等下一帧 */
+            nor_sim_advance(sim, until_ns - sim->now_ns);
+            return;
+        }
+        flash_writer_idle();
+    }
+}
+
+/* 帧: aa 13 d5 03, [4-7] 帧编号, [8-18] 编号生成的数据, [19] 和 */
+static void sim_frame(uint8_t *frame, uint32_t no)
+{
+    uint8_t sum = 0;
+    uint8_t i = 0;
+
+    frame[0] = 0xaa;
+    frame[1] = 0x13;
+    frame[2] = 0xd5;
+    frame[3] = 0x03;
+    memcpy(&frame[4], &no, 4);
+    for(i=8; i<19; i++){
+        frame[i] = (uint8_t)(no * 31 + i);
+    }
+    for(i=0; i<19; i++){
+        sum += frame[i];
+    }
+    frame[19] = sum;
+}
+
+static void sim_store(uint32_t pages, uint32_t frame_ms)
+{
+    uint8_t frame[20];
+    uint32_t i = 0;
+
+    for(i=0; i<pages * SIM_FRAME_PER_PAGE; i++){
+        sim_frame(frame, shared->frame_no++);
+        save_frame(frame);
+        sim_run(sim->now_ns + (uint64_t)frame_ms * 1000000);
+    }
+    flash_writer_sync();
+}
+
+/**
+  * @brief  Check every data page of the image directly: a page with a valid
+  *         header must hold consecutive frames.
+  * @retval Highest valid sequence number.
+  */
+static uint32_t sim_scan(void)
+{
+    flash_page_head_t head;
+    uint8_t frame[20];
+    uint32_t max_seq = 0;
+    uint32_t first = 0;
+    uint32_t crc = 0;
+    uint16_t page = 0;
+    uint16_t i = 0;
+
+    shared->torn = 0;
+    for(page=FLASH_DATA_START; page<=FLASH_DATA_END; page++){
+        const uint8_t *buf = &shared->mem[(uint32_t)page * FLASH_PAGE_LEN + FLASH_PAGE_HEAD_LEN];
+
+        memcpy(&head, &buf[-FLASH_PAGE_HEAD_LEN], sizeof(head));
+        if(FLASH_PAGE_MAGIC != head.magic){
+            continue;
+        }
+        crc = crc32_sw(0xffffffff, (const uint8_t *)&head.len, FLASH_PAGE_CRC_HEAD_LEN);
+        crc = ~crc32_sw(crc, buf, head.len);
+        if((FLASH_WRITE_BUFF_LEN != head.len) || (crc != head.crc)){
+            shared->torn++;
+            continue;
+        }
+        memcpy(&first, &buf[4], 4);
+        for(i=0; i<SIM_FRAME_PER_PAGE; i++){
+            sim_frame(frame, first + i);
+            if(0 != memcmp(frame, &buf[i * 20], 20)){
+                shared->bad_data++;
+                break;
+            }
+        }
+        if(head.seq > max_seq){
+            max_seq = head.seq;
+        }
+    }
+
+    return max_seq;
+}
+
+/**
+  * @brief  Wear report: erase count per sector of the data area.
+  */
+static void sim_wear(void)
+{
+    uint32_t min = 0xffffffff;
+    uint32_t max = 0;
+    uint64_t sum = 0;
+    uint32_t i = 0;
+
+    for(i=FLASH_DATA_START / FLASH_PAGE_PER_SECTOR; i<(FLASH_DATA_END + 1) / FLASH_PAGE_PER_SECTOR; i++){
+        if(shared->erase[i] < min){
+            min = shared->erase[i];
+        }
+        if(shared->erase[i] > max){
+            max = shared->erase[i];
+        }
+        sum += shared->erase[i];
+    }
+
+    printf("erase per sector min %u, max %u, avg %.2f (ack sector %u)\n", min, max,
+           (double)sum / ((FLASH_DATA_END + 1 - FLASH_DATA_START) / FLASH_PAGE_PER_SECTOR), shared->erase[0]);
+}
+
+static int cmd_bench(uint32_t pages, uint32_t frame_ms)
+{
+    uint64_t payload = (uint64_t)pages * FLASH_WRITE_BUFF_LEN;
+    double sec = 0;
+    flash_health_t health;
+
+    flash_init();
+    sim_store(pages, frame_ms);
+    sec = (double)sim->now_ns / 1e9;
+
+    printf("pages            %u (%u frames every %u ms)\n", pages, pages * SIM_FRAME_PER_PAGE, frame_ms);
+    printf("virtual time     %.2f s, flash busy %.2f s\n", sec, (double)sim->stat.busy_ns / 1e9);
+    printf("throughput       %.1f KB/s payload\n", payload / 1024.0 / sec);
+    printf("flush latency    avg %u us, max %u us\n", flash_stat.flush.cnt ? flash_stat.flush.us_sum / flash_stat.flush.cnt : 0, flash_stat.flush.us_max);
+    printf("write amplif.    %.3f (programmed %llu bytes for %llu payload bytes)\n",
+           (double)sim->stat.program_bytes / payload, (unsigned long long)sim->stat.program_bytes, (unsigned long long)payload);
+    printf("erase waits      %u of %u pages\n", flash_stat.erase_wait_cnt, pages);
+    printf("dropped frames   %u\n", flash_stat.drop_cnt);
+    sim_wear();
+    printf("driver errors    overwrite %llu, rejected %llu\n", (unsigned long long)sim->stat.overwrite_cnt, (unsigned long long)sim->stat.reject_cnt);
+    flash_health_get(&health);
+    printf("device health    sector erase %u, write amp %u%%, flush p50/p90/p99 %u/%u/%u ms, fail %u/%u, buffered %u pages\n",
+           health.sector_erase, health.write_amp, health.flush_p50, health.flush_p90, health.flush_p99,
+           health.program_fail, health.erase_fail, health.buffered);
+
+    return (sim->stat.overwrite_cnt || sim->stat.reject_cnt) ? 1 : 0;
+}
+
+/**
+  * @brief  One life of the device: boot from the image and check it, then
+  *         store pages until the injected power loss. Runs in a child.
+  */
+static void sim_life(uint32_t pages)
+{
+    uint32_t max_seq = 0;
+
+    flash_init();
+    max_seq = sim_scan();
+    shared->next_seq = system_state.flash_data.flash_data_seq;
+    if((max_seq + 1 != shared->next_seq) || (shared->done_seq > max_seq)){
+        shared->lost++;
+    }
+    shared->done_seq = max_seq;
+
+    /* 帧编号接着最后一个有效页, 掉电时缓存里的帧本来就会丢 */
+    shared->frame_no += SIM_FRAME_PER_PAGE * 2;
+    sim_store(pages, 0);
+}
+
+static int cmd_powerloss(uint32_t runs, uint32_t seed)
+{
+    uint32_t hit_program = 0;
+    uint32_t hit_erase = 0;
+    uint32_t i = 0;
+    pid_t pid = 0;
+
+    srand(seed);
+    for(i=0; i<runs; i++){
+        /* 每次写 1~300 页, 掉电点在预计的 SPI 字节数内随机 */
+        uint32_t pages = 1 + rand() % 300;
+
+        sim->failed = 0;
+        sim->fail_cmd = 0;
+        sim->fail_at = sim->byte_cnt + 1 + ((uint64_t)rand() * RAND_MAX + rand()) % ((uint64_t)pages * 1400 + 1);
+        fault_armed = (uint8_t)(rand() % 2);
+        pid = fork();
+        if(0 == pid){
+            sim_life(pages);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+        if(0x02 == sim->fail_cmd){
+            hit_program++;
+        }
+        if(0x20 == sim->fail_cmd){
+            hit_erase++;
+        }
+        nor_sim_power(sim, 0);
+        if(verbose){
+            printf("run %u: %u pages, next seq %u\n", i, pages, shared->next_seq);
+        }
+    }
+
+    /* 最后再启动一次检查 */
+    sim->failed = 0;
+    sim->fail_at = 0;
+    fault_armed = 0;
+    pid = fork();
+    if(0 == pid){
+        sim_life(0);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    printf("runs             %u, power lost during program %u, during erase %u\n", runs, hit_program, hit_erase);
+    printf("injected faults  %u first pages of a sector failed\n", shared->fault);
+    printf("pages written    up to seq %u\n", shared->next_seq - 1);
+    printf("lost pages       %u boots lost a completed page\n", shared->lost);
+    printf("bad pages        %u valid header with wrong data, %u torn\n", shared->bad_data, shared->torn);
+    sim_wear();
+    printf("driver errors    overwrite %llu, rejected %llu\n", (unsigned long long)sim->stat.overwrite_cnt, (unsigned long long)sim->stat.reject_cnt);
+
+    return (shared->lost || shared->bad_data || sim->stat.overwrite_cnt) ? 1 : 0;
+}
+
+/**
+  * @brief  Walk from the read cursor to the write cursor: every page must be
+  *         valid with consecutive sequence numbers, and no valid page of the
+  *         image may be left outside. Old pages from the write cursor to the
+  *         end of its sector do not count, the next append erases them.
+  * @retval Number of errors.
+  */
+static uint32_t sim_wrap_check(const char *when)
+{
+    flash_data_t *flash_data = &system_state.flash_data;
+    flash_health_t health;
+    flash_page_head_t head;
+    uint32_t valid = 0;
+    uint32_t walk = 0;
+    uint32_t seq = 0;
+    uint32_t errors = 0;
+    uint16_t page = 0;
+
+    for(page=FLASH_DATA_START; page<=FLASH_DATA_END; page++){
+        memcpy(&head, &shared->mem[(uint32_t)page * FLASH_PAGE_LEN], sizeof(head));
+        if((page >= flash_data->flash_data_current_page) && (page / FLASH_PAGE_PER_SECTOR == flash_data->flash_data_current_page / FLASH_PAGE_PER_SECTOR)){
+            continue;
+        }
+        if(FLASH_PAGE_MAGIC == head.magic){
+            valid++;
+        }
+    }
+
+    page = flash_data->flash_data_send_page;
+    while(page != flash_data->flash_data_current_page){
+        memcpy(&head, &shared->mem[(uint32_t)page * FLASH_PAGE_LEN], sizeof(head));
+        if((FLASH_PAGE_MAGIC != head.magic) || ((0 != walk) && (head.seq != seq + 1))){
+            errors++;
+        }
+        seq = head.seq;
+        walk++;
+        page = (FLASH_DATA_END == page) ? FLASH_DATA_START : page + 1;
+    }
+    if((walk != valid) || ((0 != walk) && (seq + 1 != flash_data->flash_data_seq))){
+        errors++;
+    }
+
+    flash_health_get(&health);
+    printf("%-16s send %u, current %u, buffered %u pages, %u valid in image, %u errors\n",
+           when, flash_data->flash_data_send_page, flash_data->flash_data_current_page, health.buffered, valid, errors);
+
+    return errors;
+}
+
+static int cmd_wrap(uint32_t pages)
+{
+    uint32_t errors = 0;
+
+    flash_init();
+    sim_store(pages, 0);
+    errors += sim_wrap_check("stored");
+
+    flash_init();
+    errors += sim_wrap_check("after reboot");
+    printf("driver errors    overwrite %llu, rejected %llu\n", (unsigned long long)sim->stat.overwrite_cnt, (unsigned long long)sim->stat.reject_cnt);
+
+    return (errors || sim->stat.overwrite_cnt || sim->stat.reject_cnt) ? 1 : 0;
+}
+
+/* 第 minute 分钟的时间, 从 24 年 1 月 1 日 0 点起 */
+static void sim_set_minute(uint32_t minute)
+{
+    utc_time.utc_y = 24;
+    utc_time.utc_m = 1;
+    utc_time.utc_d = (uint8_t)(1 + minute / 1440);
+    utc_time.utc_h = (uint8_t)(minute / 60 % 24);
+    utc_time.utc_f = (uint8_t)(minute % 60);
+}
+
+static int cmd_range(uint32_t pages)
+{
+    flash_data_t *flash_data = &system_state.flash_data;
+    flash_page_head_t head;
+    uint32_t untimed = pages / 3;
+    uint32_t errors = 0;
+    uint32_t start = 0;
+    uint32_t i = 0;
+    uint16_t expect = 0;
+    uint16_t page = 0;
+
+    flash_init();
+    for(i=0; i<pages; i++){
+        /* 中间一段像重启后还没对时 */
+        memset(&utc_time, 0, sizeof(utc_time));
+        if((i < untimed) || (i >= untimed + SIM_RANGE_UNTIMED)){
+            sim_set_minute(i);
+        }
+        sim_store(1, 0);
+    }
+
+    /* 撕掉一页的页头, 像写页失败 */
+    page = flash_data->flash_data_send_page + pages / 2;
+    memset(&shared->mem[(uint32_t)page * FLASH_PAGE_LEN], 0x00, 2);
+
+    for(i=0; i<pages; i++){
+        sim_set_minute(i);
+        start = utc_get_minute(utc_time.utc_y, utc_time.utc_m, utc_time.utc_d, utc_time.utc_h, utc_time.utc_f);
+
+        /* 线性扫描: 最后一个有时间且不晚于 start 的页, 没有则为最早的页 */
+        expect = flash_data->flash_data_send_page;
+        for(page=flash_data->flash_data_send_page; page!=flash_data->flash_data_current_page; page=(FLASH_DATA_END == page) ? FLASH_DATA_START : page + 1){
+            memcpy(&head, &shared->mem[(uint32_t)page * FLASH_PAGE_LEN], sizeof(head));
+            if((FLASH_PAGE_MAGIC == head.magic) && (FLASH_PAGE_TIME_NONE != head.time) && (head.time <= start)){
+                expect = page;
+            }
+        }
+
+        flash_range_start(start, 0);
+        if(flash_range.page != expect){
+            errors++;
+            if(verbose){
+                printf("minute %u: page %u, expected %u\n", i, flash_range.page, expect);
+            }
+        }
+    }
+
+    printf("range queries    %u, %u pages without time, %u wrong first page\n", pages, SIM_RANGE_UNTIMED, errors);
+
+    return errors ? 1 : 0;
+}
+
+/* 一段最多的帧数: 整个校准区 */
+static uint32_t sim_calib_max(void)
+{
+    return (FLASH_CALIB_END + 1 - FLASH_CALIB_START) * SIM_FRAME_PER_PAGE;
+}
+
+static int cmd_calib(uint32_t sessions, uint32_t frames)
+{
+    uint8_t frame[20];
+    uint8_t buf[10 * 20];
+    uint64_t start = 0;
+    uint64_t save_max = 0;
+    uint32_t bad = 0;
+    uint32_t short_cnt = 0;
+    uint32_t erase = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint16_t no = 0;
+    uint8_t cnt = 0;
+    int len = 0;
+
+    flash_init();
+    for(i=0; i<sessions; i++){
+        if(0 != flash_calib_start()){
+            printf("session %u start failed\n", i);
+            return 1;
+        }
+        for(j=0; j<frames; j++){
+            sim_frame(frame, (i << 16) | j);
+            start = sim->now_ns;
+            flash_calib_save(frame);
+            if(sim->now_ns - start > save_max){
+                save_max = sim->now_ns - start;
+            }
+            nor_sim_advance(sim, 20000000);
+        }
+        flash_calib_stop();
+    }
+
+    /* 像重启后一样重建索引, 读回每一段 */
+    memset(&flash_calib, 0, sizeof(flash_calib_t));
+    for(i=0; 0 <= (len = flash_calib_select(i)); i++){
+        const flash_calib_session_t *session = &flash_calib.session[flash_calib.upload];
+
+        if((uint32_t)len != ((frames < sim_calib_max()) ? frames : sim_calib_max())){
+            short_cnt++;
+        }
+        no = 0;
+        j = 0;
+        while(0 != (cnt = flash_calib_read(&no, buf, 10))){
+            uint8_t k = 0;
+
+            for(k=0; k<cnt; k++){
+                sim_frame(frame, ((uint32_t)session->id << 16) | (j + k));
+                if(0 != memcmp(frame, &buf[k * 20], 20)){
+                    bad++;
+                }
+            }
+            j += cnt;
+        }
+        if(verbose){
+            printf("session %u: page %u, %u frames\n", session->id, session->page, j);
+        }
+    }
+    for(j=FLASH_CALIB_START / FLASH_PAGE_PER_SECTOR; j<SIM_SECTOR_NUM; j++){
+        if(shared->erase[j] > erase){
+            erase = shared->erase[j];
+        }
+    }
+
+    printf("sessions         %u captured, %u indexed, %u shorter than captured\n", sessions, i, short_cnt);
+    printf("frames           %u per session, %u bad after reboot\n", frames, bad);
+    printf("save latency     max %.2f ms per frame\n", (double)save_max / 1e6);
+    printf("calib erase      max %u per sector\n", erase);
+    printf("driver errors    overwrite %llu, rejected %llu\n", (unsigned long long)sim->stat.overwrite_cnt, (unsigned long long)sim->stat.reject_cnt);
+
+    return (bad || short_cnt || sim->stat.overwrite_cnt || sim->stat.reject_cnt) ? 1 : 0;
+}
+
+/**
+  * @brief  Old layout image: page p of the old ring at page p + 4 holds the
+  *         frames numbered from p * SIM_FRAME_PER_PAGE, sector 0 the cursors.
+  */
+static void sim_legacy_image(uint16_t send, uint16_t current)
+{
+    flash_legacy_t legacy;
+    uint16_t page = 0;
+    uint16_t i = 0;
+
+    memset(shared->mem, 0xff, SIM_FLASH_SIZE);
+    for(page=FLASH_DATA_START; page<FLASH_LEGACY_LOST; page++){
+        for(i=0; i<SIM_FRAME_PER_PAGE; i++){
+            sim_frame(&shared->mem[(uint32_t)(page + FLASH_DATA_START) * FLASH_PAGE_LEN + i * 20], (uint32_t)page * SIM_FRAME_PER_PAGE + i);
+        }
+    }
+    memset(&legacy, 0, sizeof(legacy));
+    legacy.data_flag = 0xaa;
+    legacy.current_page = current;
+    legacy.send_page = send;
+    memcpy(shared->mem, &legacy, sizeof(legacy));
+}
+
+/**
+  * @brief  Old pages expected in the log: send up to current on the old ring
+  *         without the pages past the end of the chip; of a wrapped range the
+  *         longer part, at most the newest SIM_LEGACY_MAX.
+  * @retval Number of pages in expect.
+  */
+static uint16_t sim_legacy_expect(uint16_t send, uint16_t current, uint16_t *expect)
+{
+    uint16_t tail = 0;
+    uint16_t head = 0;
+    uint16_t n = 0;
+    uint16_t page = 0;
+
+    if(send <= current){
+        for(page=send; (page<current) && (page<FLASH_LEGACY_LOST); page++){
+            expect[n++] = page;
+        }
+    }
+    else{
+        tail = (send < FLASH_LEGACY_LOST) ? FLASH_LEGACY_LOST - send : 0;
+        head = current - FLASH_DATA_START;
+        for(page=(tail >= head) ? send : FLASH_DATA_START; (page<((tail >= head) ? FLASH_LEGACY_LOST : current)); page++){
+            expect[n++] = page;
+        }
+    }
+    if(SIM_LEGACY_MAX < n){
+        memmove(expect, &expect[n - SIM_LEGACY_MAX], SIM_LEGACY_MAX * sizeof(uint16_t));
+        n = SIM_LEGACY_MAX;
+    }
+
+    return n;
+}
+
+/**
+  * @brief  Walk the log from the read cursor: the first pages must be the
+  *         expected old pages in order, all of them when full is set.
+  *         Otherwise the walk ends at the first page without a valid header,
+  *         the torn tail of a conversion cut by power loss.
+  * @retval Number of errors.
+  */
+static uint32_t sim_legacy_check(const uint16_t *expect, uint16_t n, uint8_t full)
+{
+    flash_data_t *flash_data = &system_state.flash_data;
+    flash_page_head_t head;
+    uint8_t frame[20];
+    uint32_t errors = 0;
+    uint16_t page = flash_data->flash_data_send_page;
+    uint16_t walk = 0;
+    uint16_t i = 0;
+
+    for(walk=0; (walk<n) && (page!=flash_data->flash_data_current_page); walk++){
+        const uint8_t *buf = &shared->mem[(uint32_t)page * FLASH_PAGE_LEN];
+
+        memcpy(&head, buf, sizeof(head));
+        if((0 == full) && (FLASH_PAGE_MAGIC != head.magic)){
+            break;
+        }
+        if((FLASH_PAGE_MAGIC != head.magic) || (walk + 1 != head.seq)){
+            errors++;
+        }
+        for(i=0; i<SIM_FRAME_PER_PAGE; i++){
+            sim_frame(frame, (uint32_t)expect[walk] * SIM_FRAME_PER_PAGE + i);
+            if(0 != memcmp(frame, &buf[FLASH_PAGE_HEAD_LEN + i * 20], 20)){
+                errors++;
+                break;
+            }
+        }
+        page = (FLASH_DATA_END == page) ? FLASH_DATA_START : page + 1;
+    }
+    if(full && (walk != n)){
+        errors++;
+    }
+    printf("%-16s %u of %u old pages in the log, %u errors\n", full ? "converted" : "after power loss", walk, n, errors);
+
+    return errors;
+}
+
+static int cmd_legacy(uint16_t send, uint16_t current)
+{
+    static uint16_t expect[FLASH_LEGACY_END + 1];
+    uint32_t errors = 0;
+    uint16_t n = sim_legacy_expect(send, current, expect);
+    uint16_t i = 0;
+    pid_t pid = 0;
+
+    sim_legacy_image(send, current);
+    flash_init();
+    errors += sim_legacy_check(expect, n, 1);
+    for(i=0; i<FLASH_SECTOR_LEN; i++){
+        if(0xff != shared->mem[i]){
+            errors++;
+            break;
+        }
+    }
+    flash_init();
+    errors += sim_legacy_check(expect, n, 1);
+
+    /* 接着存新数据, 放得下时旧数据仍在最前面 */
+    shared->frame_no = 0x10000000;
+    sim_store((n + 100 + FLASH_PAGE_PER_SECTOR * (FLASH_ERASE_AHEAD + 1) <= SIM_LEGACY_MAX) ? 100 : 0, 0);
+    flash_init();
+    errors += sim_legacy_check(expect, n, 1);
+    errors += sim_wrap_check("new pages");
+
+    /* 转换到一半掉电 */
+    sim_legacy_image(send, current);
+    sim->failed = 0;
+    sim->fail_at = sim->byte_cnt + (uint64_t)n * 600 + 1;
+    pid = fork();
+    if(0 == pid){
+        flash_init();
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    nor_sim_power(sim, 0);
+    sim->fail_at = 0;
+    sim->failed = 0;
+    flash_init();
+    errors += sim_legacy_check(expect, n, 0);
+    printf("driver errors    overwrite %llu, rejected %llu\n", (unsigned long long)sim->stat.overwrite_cnt, (unsigned long long)sim->stat.reject_cnt);
+
+    return (errors || sim->stat.overwrite_cnt || sim->stat.reject_cnt) ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    shared = mmap(NULL, sizeof(sim_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(MAP_FAILED == shared){
+        perror("mmap");
+        return 1;
+    }
+    memset(shared, 0, sizeof(sim_shared_t));
+    sim = &shared->sim;
+    nor_sim_init(sim, shared->mem, SIM_FLASH_SIZE, shared->erase);
+    verbose = (NULL != getenv("FLASH_SIM_VERBOSE")) ? 1 : 0;
+
+    if((3 <= argc) && (0 == strcmp(argv[1], "bench"))){
+        return cmd_bench((uint32_t)atoi(argv[2]), (4 <= argc) ? (uint32_t)atoi(argv[3]) : 0);
+    }
+    if((3 <= argc) && (0 == strcmp(argv[1], "powerloss"))){
+        return cmd_powerloss((uint32_t)atoi(argv[2]), (4 <= argc) ? (uint32_t)atoi(argv[3]) : 1);
+    }
+    if((3 <= argc) && (0 == strcmp(argv[1], "wrap"))){
+        return cmd_wrap((uint32_t)atoi(argv[2]));
+    }
+    if((3 <= argc) && (0 == strcmp(argv[1], "range"))){
+        return cmd_range((uint32_t)atoi(argv[2]));
+    }
+    if((4 <= argc) && (0 == strcmp(argv[1], "calib"))){
+        return cmd_calib((uint32_t)atoi(argv[2]), (uint32_t)atoi(argv[3]));
+    }
+    if((4 <= argc) && (0 == strcmp(argv[1], "legacy"))){
+        return cmd_legacy((uint16_t)atoi(argv[2]), (uint16_t)atoi(argv[3]));
+    }
+
+    fprintf(stderr, "usage: %s bench <pages> [frame_ms]\n"
+                    "       %s powerloss <runs> [seed]\n"
+                    "       %s wrap <pages>\n"
+                    "       %s range <pages>\n"
+                    "       %s calib <sessions> <frames>\n"
+                    "       %s legacy <send> <current>\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+
+    return 1;
+}
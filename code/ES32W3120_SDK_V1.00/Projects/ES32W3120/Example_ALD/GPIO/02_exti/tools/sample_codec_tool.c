@@ -0,0 +1,292 @@
+/*
+ * Host side decoder and compression benchmark for the sample log codec
+ * (app/app_codec.c). Build on the PC:
+ *
+ *   gcc -DCODEC_HOST -I../app -o sample_codec_tool sample_codec_tool.c ../app/app_codec.c ../app/app_frame.c
+ *
+ * Usage:
+ *   sample_codec_tool decode <upload.bin>
+ *       Decode an upload dump (the 20 byte frames received from the device)
+ *       and print one CSV line per sample: time, period ms, ax, ay, az.
+ *       Both compressed blocks (type 0x08) and single samples (type 0x03)
+ *       are printed, damaged blocks are counted and skipped.
+ *   sample_codec_tool bench <trace> [period_ticks]
+ *       Re-encode a recorded trace with the device codec and report the
+ *       compression ratio. <trace> is an upload dump with 0x03 frames (raw
+ *       log turned on with SET_RAW_LOG and SAVE_CODEC_EN 0) or 0x04 frames
+ *       (a calibration session upload), or a text file with one "ax,ay,az"
+ *       line per sample. Every block is decoded again and compared with the
+ *       input.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "app_codec.h"
+
+#define FRAME_LEN                     20
+#define DATA_PAGE_NUM                 (1920 - 4)      //外部flash数据页数
+#define DATA_PAGE_PAYLOAD             1000            //每页数据长度
+
+typedef struct {
+    int16_t (*xyz)[3];
+    uint32_t cnt;
+    uint32_t size;
+
+}trace_t;
+
+typedef struct {
+    const uint8_t *head;
+    const int16_t (*expect)[3];
+    uint32_t errors;
+
+}check_ctx_t;
+
+uint16_t crc16_calc(uint16_t crc, const uint8_t *buf, uint32_t len)
+{
+    uint32_t i = 0;
+    uint8_t j = 0;
+
+    for(i=0; i<len; i++){
+        crc ^= (uint16_t)buf[i] << 8;
+        for(j=0; j<8; j++){
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+static uint8_t *load_file(const char *name, long *len)
+{
+    FILE *fp = fopen(name, "rb");
+    uint8_t *buf = NULL;
+
+    if(NULL == fp){
+        perror(name);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    buf = malloc(*len + 1);
+    if((NULL == buf) || (fread(buf, 1, *len, fp) != (size_t)*len)){
+        fclose(fp);
+        free(buf);
+        return NULL;
+    }
+    buf[*len] = 0;
+    fclose(fp);
+
+    return buf;
+}
+
+static int frame_valid(const uint8_t *frame)
+{
+    uint8_t sum = 0;
+    uint8_t i = 0;
+
+    if((0xaa != frame[0]) || (0x13 != frame[1])){
+        return 0;
+    }
+    for(i=0; i<19; i++){
+        sum += frame[i];
+    }
+
+    return sum == frame[19];
+}
+
+static void print_sample(void *ctx, uint8_t index, const int16_t *xyz)
+{
+    const uint8_t *head = ctx;
+    uint32_t ms = (uint32_t)index * head[6] * 10;
+
+    printf("20%02u-%02u-%02u %02u:%02u:%02u+%u,%u,%d,%d,%d\n",
+           head[7], head[8], head[9], head[10], head[11], head[12], ms,
+           head[6] * 10, xyz[0], xyz[1], xyz[2]);
+}
+
+static int cmd_decode(const char *name)
+{
+    uint32_t blocks = 0;
+    uint32_t bad = 0;
+    uint32_t single = 0;
+    long len = 0;
+    long pos = 0;
+    int ret = 0;
+    uint8_t *buf = load_file(name, &len);
+
+    if(NULL == buf){
+        return 1;
+    }
+
+    printf("time,period_ms,ax,ay,az\n");
+    while(pos + FRAME_LEN <= len){
+        const uint8_t *frame = &buf[pos];
+
+        if(!frame_valid(frame) || (0xd5 != frame[2])){
+            pos += FRAME_LEN;
+            continue;
+        }
+        if(CODEC_DATA_TYPE == frame[3]){
+            ret = codec_block_decode(frame, (uint16_t)((len - pos < 0xffff) ? len - pos : 0xffff), print_sample, (void *)frame);
+            if(0 > ret){
+                bad++;
+                pos += FRAME_LEN;
+                continue;
+            }
+            blocks++;
+            pos += ret;
+            continue;
+        }
+        if(0x03 == frame[3]){
+            printf("20%02u-%02u-%02u %02u:%02u:%02u+0,,%d,%d,%d\n",
+                   frame[10], frame[11], frame[12], frame[13], frame[14], frame[15],
+                   (int16_t)((frame[4] << 8) | frame[5]),
+                   (int16_t)((frame[6] << 8) | frame[7]),
+                   (int16_t)((frame[8] << 8) | frame[9]));
+            single++;
+        }
+        pos += FRAME_LEN;
+    }
+
+    fprintf(stderr, "blocks %u, damaged %u, single samples %u\n", blocks, bad, single);
+    free(buf);
+
+    return 0;
+}
+
+static void trace_add(trace_t *trace, int ax, int ay, int az)
+{
+    if(trace->cnt == trace->size){
+        trace->size = trace->size ? trace->size * 2 : 4096;
+        trace->xyz = realloc(trace->xyz, trace->size * sizeof(*trace->xyz));
+        if(NULL == trace->xyz){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    trace->xyz[trace->cnt][0] = (int16_t)ax;
+    trace->xyz[trace->cnt][1] = (int16_t)ay;
+    trace->xyz[trace->cnt][2] = (int16_t)az;
+    trace->cnt++;
+}
+
+static void trace_load(trace_t *trace, const uint8_t *buf, long len)
+{
+    long pos = 0;
+    int ax = 0, ay = 0, az = 0, n = 0;
+
+    /* 上传数据: 取出 0x03 原始数据帧或 0x04 校准数据帧 */
+    for(pos=0; pos + FRAME_LEN <= len; pos += FRAME_LEN){
+        const uint8_t *frame = &buf[pos];
+
+        if(frame_valid(frame) && (0xd5 == frame[2]) && ((0x03 == frame[3]) || (0x04 == frame[3]))){
+            trace_add(trace, (int16_t)((frame[4] << 8) | frame[5]),
+                             (int16_t)((frame[6] << 8) | frame[7]),
+                             (int16_t)((frame[8] << 8) | frame[9]));
+        }
+    }
+    if(0 != trace->cnt){
+        return;
+    }
+
+    /* 文本: 每行 ax,ay,az */
+    pos = 0;
+    while(pos < len){
+        if(3 == sscanf((const char *)&buf[pos], "%d,%d,%d%n", &ax, &ay, &az, &n)){
+            trace_add(trace, ax, ay, az);
+        }
+        while((pos < len) && ('\n' != buf[pos])){
+            pos++;
+        }
+        pos++;
+    }
+}
+
+static void check_sample(void *ctx, uint8_t index, const int16_t *xyz)
+{
+    check_ctx_t *check = ctx;
+    uint8_t i = 0;
+
+    for(i=0; i<3; i++){
+        if(xyz[i] != check->expect[index][i]){
+            check->errors++;
+            return;
+        }
+    }
+}
+
+static int cmd_bench(const char *name, uint8_t period)
+{
+    const uint8_t utc[6] = {0};
+    codec_block_t block;
+    check_ctx_t check = {0};
+    trace_t trace = {0};
+    uint64_t coded = 0;
+    uint64_t raw = 0;
+    uint32_t blocks = 0;
+    uint32_t first = 0;
+    uint32_t i = 0;
+    uint16_t block_len = 0;
+    double ratio = 0;
+    long len = 0;
+    uint8_t *buf = load_file(name, &len);
+
+    if(NULL == buf){
+        return 1;
+    }
+    trace_load(&trace, buf, len);
+    free(buf);
+    if(0 == trace.cnt){
+        fprintf(stderr, "no samples in %s\n", name);
+        return 1;
+    }
+
+    /* 和设备一样分块: 块满后开始新块 */
+    i = 0;
+    while(i < trace.cnt){
+        first = i;
+        codec_block_start(&block, utc, period, trace.xyz[i++]);
+        while((i < trace.cnt) && (1 == codec_block_add(&block, trace.xyz[i]))){
+            i++;
+        }
+        block_len = codec_block_finish(&block);
+
+        check.expect = (const int16_t (*)[3])&trace.xyz[first];
+        if((block_len != codec_block_decode(block.buf, block_len, check_sample, &check)) || (block.cnt != i - first)){
+            check.errors++;
+        }
+        coded += block_len;
+        blocks++;
+    }
+    raw = (uint64_t)trace.cnt * FRAME_LEN;
+    ratio = (double)raw / coded;
+
+    printf("samples          %u\n", trace.cnt);
+    printf("blocks           %u (%.1f samples/block)\n", blocks, (double)trace.cnt / blocks);
+    printf("raw bytes        %llu (%d per sample)\n", (unsigned long long)raw, FRAME_LEN);
+    printf("coded bytes      %llu (%.2f per sample)\n", (unsigned long long)coded, (double)coded / trace.cnt);
+    printf("ratio            %.2f\n", ratio);
+    printf("history at %u ms %.1f h raw, %.1f h coded\n", period * 10,
+           (double)DATA_PAGE_NUM * DATA_PAGE_PAYLOAD / FRAME_LEN * period / 100 / 3600,
+           (double)DATA_PAGE_NUM * DATA_PAGE_PAYLOAD / FRAME_LEN * ratio * period / 100 / 3600);
+    printf("round trip       %s\n", check.errors ? "FAILED" : "ok");
+    free(trace.xyz);
+
+    return check.errors ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    if((3 <= argc) && (0 == strcmp(argv[1], "decode"))){
+        return cmd_decode(argv[2]);
+    }
+    if((3 <= argc) && (0 == strcmp(argv[1], "bench"))){
+        return cmd_bench(argv[2], (4 <= argc) ? (uint8_t)atoi(argv[3]) : 50);
+    }
+
+    fprintf(stderr, "usage: %s decode <upload.bin>\n"
+                    "       %s bench <trace> [period_ticks]\n", argv[0], argv[0]);
+
+    return 1;
+}
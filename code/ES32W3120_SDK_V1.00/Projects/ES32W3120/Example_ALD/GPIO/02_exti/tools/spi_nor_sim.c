@@ -0,0 +1,275 @@
+#include <string.h>
+
+#include "spi_nor_sim.h"
+
+/* 默认参数按 GD25Q16 手册典型值 */
+#define NOR_SIM_ID                    0xc84015
+#define NOR_SIM_SPI_HZ                12000000
+#define NOR_SIM_TPP_NS                700000
+#define NOR_SIM_TSE_NS                50000000
+#define NOR_SIM_TRES1_NS              3000
+
+#define NOR_SIM_WIP                   0x01
+#define NOR_SIM_WEL                   0x02
+
+void nor_sim_init(nor_sim_t *sim, uint8_t *mem, uint32_t size, uint32_t *erase)
+{
+    memset(sim, 0, sizeof(nor_sim_t));
+    sim->mem = mem;
+    sim->size = size;
+    sim->erase = erase;
+    sim->id = NOR_SIM_ID;
+    sim->spi_hz = NOR_SIM_SPI_HZ;
+    sim->tpp_ns = NOR_SIM_TPP_NS;
+    sim->tse_ns = NOR_SIM_TSE_NS;
+    sim->tres1_ns = NOR_SIM_TRES1_NS;
+    sim->power = 1;
+
+    memset(mem, 0xff, size);
+    memset(erase, 0, size / NOR_SIM_SECTOR_LEN * sizeof(uint32_t));
+}
+
+/**
+  * @brief  Finish the running program or erase when its time is up. On a
+  *         power loss only the part done so far is applied: a prefix of the
+  *         page or of the sector, the rest keeps the old content.
+  */
+static void nor_sim_update(nor_sim_t *sim, uint8_t lost)
+{
+    uint64_t done = 0;
+    uint32_t len = 0;
+    uint32_t i = 0;
+
+    if(0 == sim->busy_cmd){
+        return;
+    }
+    if((0 == lost) && (sim->now_ns < sim->busy_end)){
+        return;
+    }
+
+    done = sim->busy_end - sim->busy_start;
+    if(lost && (sim->now_ns < sim->busy_end)){
+        done = sim->now_ns - sim->busy_start;
+    }
+
+    if(0x02 == sim->busy_cmd){
+        len = (uint32_t)(sim->page_len * done / (sim->busy_end - sim->busy_start));
+        for(i=0; i<len; i++){
+            /* 页内地址回绕 */
+            uint32_t offset = (sim->busy_addr + i) & (NOR_SIM_PAGE_LEN - 1);
+            uint32_t addr = (sim->busy_addr & ~(NOR_SIM_PAGE_LEN - 1)) | offset;
+
+            if(sim->page_buf[offset] & ~sim->mem[addr]){
+                sim->stat.overwrite_cnt++;
+            }
+            sim->mem[addr] &= sim->page_buf[offset];
+        }
+    }
+    else{
+        len = (uint32_t)(NOR_SIM_SECTOR_LEN * done / (sim->busy_end - sim->busy_start));
+        memset(&sim->mem[sim->busy_addr], 0xff, len);
+        if(NOR_SIM_SECTOR_LEN == len){
+            sim->erase[sim->busy_addr / NOR_SIM_SECTOR_LEN]++;
+        }
+    }
+
+    sim->busy_cmd = 0;
+}
+
+/**
+  * @brief  Move the virtual clock, a running program or erase may finish.
+  */
+void nor_sim_advance(nor_sim_t *sim, uint64_t ns)
+{
+    sim->now_ns += ns;
+    nor_sim_update(sim, 0);
+}
+
+uint8_t nor_sim_busy(nor_sim_t *sim)
+{
+    nor_sim_update(sim, 0);
+
+    return (0 != sim->busy_cmd) ? 1 : 0;
+}
+
+/**
+  * @brief  Switch the supply. Power off while busy leaves a torn page or a
+  *         partly erased sector, power on starts from the reset state.
+  */
+void nor_sim_power(nor_sim_t *sim, uint8_t on)
+{
+    if(on == sim->power){
+        return;
+    }
+    if(0 == on){
+        nor_sim_update(sim, 1);
+    }
+    sim->power = on;
+    sim->dpd = 0;
+    sim->wel = 0;
+    sim->cs = 0;
+    sim->pos = 0;
+}
+
+static void nor_sim_start(nor_sim_t *sim, uint8_t cmd, uint32_t addr, uint64_t ns)
+{
+    sim->busy_cmd = cmd;
+    sim->busy_addr = addr;
+    sim->busy_start = sim->now_ns;
+    sim->busy_end = sim->now_ns + ns;
+    sim->stat.busy_ns += ns;
+    sim->wel = 0;
+}
+
+/**
+  * @brief  Select or release the chip. Program and erase start on release,
+  *         like the real part.
+  */
+void nor_sim_cs(nor_sim_t *sim, uint8_t select)
+{
+    if(select == sim->cs){
+        return;
+    }
+    sim->cs = select;
+    if(select){
+        sim->pos = 0;
+        return;
+    }
+    if((0 == sim->power) || (0 == sim->pos)){
+        return;
+    }
+
+    sim->stat.cmd_cnt++;
+    if(sim->dpd){
+        if(0xab == sim->cmd){
+            sim->dpd = 0;
+            nor_sim_advance(sim, sim->tres1_ns);
+        }
+        return;
+    }
+    nor_sim_update(sim, 0);
+
+    switch(sim->cmd){
+        case 0x06:
+            if(0 == sim->busy_cmd){
+                sim->wel = 1;
+            }
+            break;
+
+        case 0x04:
+            if(0 == sim->busy_cmd){
+                sim->wel = 0;
+            }
+            break;
+
+        case 0x02:
+            if((4 > sim->pos) || (0 == sim->wel) || sim->busy_cmd){
+                sim->stat.reject_cnt++;
+                break;
+            }
+            sim->page_len = (NOR_SIM_PAGE_LEN < sim->pos - 4) ? NOR_SIM_PAGE_LEN : (uint16_t)(sim->pos - 4);
+            sim->stat.program_cnt++;
+            sim->stat.program_bytes += sim->page_len;
+            nor_sim_start(sim, 0x02, sim->addr, sim->tpp_ns);
+            break;
+
+        case 0x20:
+            if((4 != sim->pos) || (0 == sim->wel) || sim->busy_cmd){
+                sim->stat.reject_cnt++;
+                break;
+            }
+            sim->stat.erase_cnt++;
+            nor_sim_start(sim, 0x20, sim->addr & ~(NOR_SIM_SECTOR_LEN - 1), sim->tse_ns);
+            break;
+
+        case 0xb9:
+            if(0 == sim->busy_cmd){
+                sim->dpd = 1;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+  * @brief  Clock one byte while selected.
+  * @param  mosi: Byte from the master.
+  * @retval Byte on MISO, 0xff when nothing drives it.
+  */
+uint8_t nor_sim_xfer(nor_sim_t *sim, uint8_t mosi)
+{
+    uint8_t miso = 0xff;
+    uint32_t pos = sim->pos;
+
+    nor_sim_advance(sim, 8000000000ULL / sim->spi_hz);
+    sim->byte_cnt++;
+    if((0 != sim->fail_at) && (sim->byte_cnt >= sim->fail_at) && (0 == sim->failed)){
+        sim->failed = 1;
+        sim->fail_cmd = sim->busy_cmd;
+        nor_sim_power(sim, 0);
+    }
+    if((0 == sim->power) || (0 == sim->cs)){
+        return 0xff;
+    }
+
+    sim->pos++;
+    if(0 == pos){
+        sim->cmd = mosi;
+        sim->addr = 0;
+        return 0xff;
+    }
+    if(sim->dpd){
+        return 0xff;
+    }
+
+    switch(sim->cmd){
+        case 0x05:
+            nor_sim_update(sim, 0);
+            miso = (sim->busy_cmd ? NOR_SIM_WIP : 0) | (sim->wel ? NOR_SIM_WEL : 0);
+            break;
+
+        case 0x9f:
+            if(4 > pos){
+                miso = (uint8_t)(sim->id >> (8 * (3 - pos)));
+            }
+            break;
+
+        case 0xab:
+            break;
+
+        case 0x02:
+        case 0x03:
+        case 0x0b:
+        case 0x20:
+            if(4 > pos){
+                sim->addr = ((sim->addr << 8) | mosi) % sim->size;
+                break;
+            }
+            if(0x02 == sim->cmd){
+                /* 按页内地址锁存, 超过一页时回绕覆盖 */
+                if(4 == pos){
+                    memset(sim->page_buf, 0xff, NOR_SIM_PAGE_LEN);
+                }
+                sim->page_buf[(sim->addr + pos - 4) & (NOR_SIM_PAGE_LEN - 1)] = mosi;
+                break;
+            }
+            if((0x0b == sim->cmd) && (4 == pos)){
+                break;      //空字节
+            }
+            nor_sim_update(sim, 0);
+            if(sim->busy_cmd){
+                break;      //忙时读不到数据
+            }
+            miso = sim->mem[sim->addr];
+            sim->addr = (sim->addr + 1) % sim->size;
+            sim->stat.read_bytes++;
+            break;
+
+        default:
+            break;
+    }
+
+    return miso;
+}
@@ -0,0 +1,81 @@
+#ifndef __SPI_NOR_SIM_H
+#define __SPI_NOR_SIM_H
+
+/*
+ * 上位机 SPI NOR flash 模型, 按字节收发, 供 tools/flash_sim_tool.c 驱动
+ * bsp/bsp_flash.c 使用. 支持驱动用到的命令:
+ *   02 页编程, 03 读, 0B 快速读, 05 读状态, 06/04 写使能/禁止, 20 扇区擦除,
+ *   9F 读ID, B9 深度掉电, AB 退出深度掉电
+ * 编程只能把 1 写成 0, 擦除把整个扇区写成 0xff; 编程和擦除按 tPP/tSE 计入
+ * 虚拟时钟, 期间 WIP 置位. 可以在任意一个 SPI 字节处注入掉电.
+ */
+#include <stdint.h>
+
+#define NOR_SIM_PAGE_LEN              256
+#define NOR_SIM_SECTOR_LEN            4096
+
+typedef struct {
+    uint64_t cmd_cnt;                           //执行的命令数
+    uint64_t read_bytes;
+    uint64_t program_bytes;                     //编程命令写入的字节数
+    uint64_t program_cnt;
+    uint64_t erase_cnt;
+    uint64_t busy_ns;                           //编程和擦除占用的时间
+    uint64_t overwrite_cnt;                     //编程时把 0 写成 1 的字节数, 驱动错误
+    uint64_t reject_cnt;                        //没有写使能或忙时收到的编程/擦除命令
+
+}nor_sim_stat_t;
+
+typedef struct {
+    uint8_t *mem;
+    uint32_t size;
+    uint32_t id;                                //JEDEC ID, 3 字节
+    uint32_t spi_hz;
+    uint32_t tpp_ns;
+    uint32_t tse_ns;
+    uint32_t tres1_ns;
+    uint32_t *erase;                            //每个扇区的擦除次数
+
+    /* 虚拟时钟 */
+    uint64_t now_ns;
+
+    /* 命令状态 */
+    uint8_t cs;                                 //1: 选中
+    uint8_t power;                              //1: 上电
+    uint8_t dpd;                                //1: 深度掉电
+    uint8_t wel;
+    uint8_t cmd;
+    uint32_t pos;                               //本条命令已收到的字节数
+    uint32_t addr;
+
+    /* 正在执行的编程或擦除 */
+    uint8_t busy_cmd;
+    uint64_t busy_start;
+    uint64_t busy_end;
+    uint32_t busy_addr;
+    uint16_t page_len;
+    uint8_t page_buf[NOR_SIM_PAGE_LEN];
+
+    /* 掉电注入: 第 fail_at 个 SPI 字节时掉电, 0 不注入 */
+    uint64_t byte_cnt;
+    uint64_t fail_at;
+    uint8_t failed;
+    uint8_t fail_cmd;                           //掉电时正在执行的编程(02)或擦除(20)
+
+    nor_sim_stat_t stat;
+
+}nor_sim_t;
+
+void nor_sim_init(nor_sim_t *sim, uint8_t *mem, uint32_t size, uint32_t *erase);
+
+void nor_sim_power(nor_sim_t *sim, uint8_t on);
+
+void nor_sim_cs(nor_sim_t *sim, uint8_t select);
+
+uint8_t nor_sim_xfer(nor_sim_t *sim, uint8_t mosi);
+
+void nor_sim_advance(nor_sim_t *sim, uint64_t ns);
+
+uint8_t nor_sim_busy(nor_sim_t *sim);
+
+#endif